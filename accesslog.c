@@ -0,0 +1,265 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/mman.h>
+#include <sys/prctl.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "accesslog.h"
+#include "http.h"
+#include "config.h"
+
+/**
+ * represents a slot of the ring buffer
+ * its sequence tells whose turn it is: the producer of position `seq` may fill it, and the logger may read position `seq-1`
+ */
+typedef struct {
+	uint64_t seq;
+	logrecord_t rec;
+} logslot_t;
+
+/**
+ * represents the ring buffer shared by the workers and the logger
+ * workers claim positions by moving `tail` with a compare-and-swap, and only the logger moves the head
+ */
+typedef struct {
+	uint64_t tail;
+	char pad[56]; // keeps the contended tail on its own cache line
+	uint64_t head; // kept here so that a restarted logger resumes where the previous one stopped
+	uint64_t dropped;
+	pid_t logger; // 0 while the logger isn't running, in which case records are written at once
+	logslot_t slots[SERVER_LOGRING];
+} logring_t;
+
+/**
+ * the ring buffer, or NULL if the logger wasn't started
+ */
+static logring_t* ring;
+
+void accesslog_setAddr(logrecord_t* rec, const struct sockaddr* addr) {
+	rec->family=0;
+	if(addr && addr->sa_family==AF_INET6) {
+		rec->family=AF_INET6;
+		memcpy(rec->addr, &((const struct sockaddr_in6*) addr)->sin6_addr, 16);
+	} else if(addr && addr->sa_family==AF_INET) {
+		rec->family=AF_INET;
+		memcpy(rec->addr, &((const struct sockaddr_in*) addr)->sin_addr, 4);
+	}
+}
+
+/**
+ * appends a string to a line
+ * @param ptr, where to write it
+ * @param end, the end of the buffer
+ * @param s
+ * @param len
+ * @returns the end of the string, or NULL if it doesn't fit
+ */
+static char* putStr(char* ptr, char* end, const char* s, size_t len) {
+	if(!ptr || (size_t) (end-ptr)<len) return NULL;
+	memcpy(ptr, s, len);
+	return ptr+len;
+}
+
+size_t accesslog_format(const logrecord_t* rec, char* buf, size_t len) {
+	char* ptr=buf;
+	char* end=buf+len;
+	for(const char* f=SERVER_LOGFORMAT; *f && ptr; f++) {
+		if(*f!='%' || !f[1]) {
+			ptr=putStr(ptr, end, f, 1);
+			continue;
+		}
+
+		char tmp[64];
+		const char* s=tmp;
+		int n=-1;
+		switch(*++f) {
+			case 'a':
+				if(!rec->family || !inet_ntop(rec->family, rec->addr, tmp, sizeof(tmp))) strcpy(tmp, "-");
+				break;
+			case 't': {
+				time_t t=rec->time/1000000000;
+				struct tm tm;
+				gmtime_r(&t, &tm);
+				n=strftime(tmp, sizeof(tmp), "%d/%b/%Y:%H:%M:%S +0000", &tm);
+				break;
+			}
+			case 'm':
+				s=rec->method<0?"-":http_methodName(rec->method);
+				break;
+			case 'U':
+				s=*rec->url?rec->url:"-";
+				break;
+			case 's':
+				n=snprintf(tmp, sizeof(tmp), "%u", rec->status);
+				break;
+			case 'b':
+				n=snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long) rec->bytes);
+				break;
+			case 'D': // in microseconds, as Apache does
+				n=snprintf(tmp, sizeof(tmp), "%llu", (unsigned long long) rec->latency/1000);
+				break;
+			case '%':
+				s="%";
+				break;
+			default: // unknown directives are kept as they are
+				s=f-1;
+				n=2;
+		}
+		ptr=putStr(ptr, end, s, n<0?strlen(s):(size_t) n);
+	}
+	ptr=putStr(ptr, end, "\n", 1);
+	return ptr?(size_t) (ptr-buf):0;
+}
+
+/**
+ * writes a whole buffer
+ * @param fd
+ * @param buf
+ * @param len
+ */
+static void writeAll(int fd, const char* buf, size_t len) {
+	while(len) {
+		ssize_t a=write(fd, buf, len);
+		if(a<0 && errno==EINTR) continue;
+		if(a<=0) return;
+		buf+=a;
+		len-=a;
+	}
+}
+
+int accesslog_push(const logrecord_t* rec) {
+	if(!ring || !__atomic_load_n(&ring->logger, __ATOMIC_ACQUIRE)) {
+		char line[SERVER_MAXURL+256];
+		size_t len=accesslog_format(rec, line, sizeof(line));
+		writeAll(STDOUT_FILENO, line, len);
+		return 0;
+	}
+
+	uint64_t pos=__atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+	logslot_t* slot;
+	for(;;) {
+		slot=ring->slots+pos%SERVER_LOGRING;
+		uint64_t seq=__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+		int64_t diff=(int64_t) (seq-pos);
+		if(!diff) {
+			if(__atomic_compare_exchange_n(&ring->tail, &pos, pos+1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) break;
+		} else if(diff<0) { // the logger is a whole ring behind, so the record is dropped rather than waited for
+			__atomic_fetch_add(&ring->dropped, 1, __ATOMIC_RELAXED);
+			return -1;
+		} else {
+			pos=__atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+		}
+	}
+	slot->rec=*rec;
+	__atomic_store_n(&slot->seq, pos+1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/**
+ * formats and writes what is in the ring buffer, in large writes, until the parent process exits
+ * @param fd
+ */
+static void loggerLoop(int fd) {
+	static char buf[SERVER_LOGBUF];
+	uint64_t head=__atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	uint64_t dropped=__atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+	for(;;) {
+		size_t len=0;
+		for(;;) {
+			logslot_t* slot=ring->slots+head%SERVER_LOGRING;
+			if(__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE)!=head+1) break;
+			size_t l=accesslog_format(&slot->rec, buf+len, sizeof(buf)-len);
+			if(!l && len) { // the batch is full
+				writeAll(fd, buf, len);
+				len=0;
+				l=accesslog_format(&slot->rec, buf, sizeof(buf));
+			}
+			len+=l;
+			__atomic_store_n(&slot->seq, head+SERVER_LOGRING, __ATOMIC_RELEASE);
+			__atomic_store_n(&ring->head, ++head, __ATOMIC_RELAXED);
+		}
+		if(len) writeAll(fd, buf, len);
+
+		uint64_t d=__atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+		if(d!=dropped) {
+			fprintf(stderr, "accesslog: %llu records dropped\n", (unsigned long long) (d-dropped));
+			dropped=d;
+		}
+
+		// records pile up in the meantime, and are written together
+		struct timespec ts={0, SERVER_LOGINTERVAL*1000000L};
+		nanosleep(&ts, NULL);
+	}
+}
+
+/**
+ * the fd the log is written to
+ */
+static int logfd=-1;
+
+/**
+ * forks the logger, which writes what is in the ring buffer from its head
+ * @returns 0 on success, -1 on error
+ */
+static int startLogger(void) {
+	// the logger mustn't be reaped before its pid is known
+	sigset_t mask, old;
+	sigemptyset(&mask);
+	sigaddset(&mask, SIGCHLD);
+	sigprocmask(SIG_BLOCK, &mask, &old);
+
+	pid_t parent=getpid();
+	pid_t pid=fork();
+	if(pid==0) {
+		// the logger goes away with the server
+		sigprocmask(SIG_SETMASK, &old, NULL);
+		prctl(PR_SET_PDEATHSIG, SIGTERM);
+		if(getppid()!=parent) _exit(0);
+		loggerLoop(logfd);
+		_exit(0);
+	}
+	if(pid>0) __atomic_store_n(&ring->logger, pid, __ATOMIC_RELEASE);
+	sigprocmask(SIG_SETMASK, &old, NULL);
+	return pid<0?-1:0;
+}
+
+int accesslog_init(int fd) {
+	logring_t* r=mmap(NULL, sizeof(logring_t), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(r==MAP_FAILED) return -1;
+	for(uint64_t i=0; i<SERVER_LOGRING; i++) r->slots[i].seq=i;
+
+	ring=r;
+	logfd=fd;
+	if(startLogger()) {
+		ring=NULL;
+		munmap(r, sizeof(logring_t));
+		return -1;
+	}
+	return 0;
+}
+
+int accesslog_exited(pid_t pid) {
+	if(!ring || pid<=0 || __atomic_load_n(&ring->logger, __ATOMIC_ACQUIRE)!=pid) return 0;
+	__atomic_store_n(&ring->logger, 0, __ATOMIC_RELEASE);
+	return 1;
+}
+
+int accesslog_restart(void) {
+	static time_t started;
+	if(!ring || __atomic_load_n(&ring->logger, __ATOMIC_ACQUIRE)) return 0;
+
+	// don't spin if the logger dies as soon as it is started
+	if(time(NULL)-started<1) sleep(1);
+	started=time(NULL);
+	fprintf(stderr, "accesslog: the logger exited, restarting it\n");
+	return startLogger();
+}
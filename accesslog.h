@@ -0,0 +1,72 @@
+#ifndef _ACCESSLOG_H
+#define _ACCESSLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+/**
+ * represents a line of the access log, before it is formatted
+ */
+typedef struct {
+	uint64_t time; // when the request was read, in nanoseconds since the epoch
+	uint64_t latency; // nanoseconds from the request being read to its response being written
+	uint64_t bytes; // bytes of the response written
+	uint16_t status;
+	int8_t method; // a `method_t`, or -1 if the request couldn't be parsed
+	uint8_t family; // AF_INET or AF_INET6, 0 if the address of the client is unknown
+	uint8_t addr[16];
+	char url[224]; // truncated, null-terminated
+} logrecord_t;
+
+/**
+ * starts the logger process, which formats records with `SERVER_LOGFORMAT` and writes them in batches
+ * @param fd, where the log is written
+ * @returns 0 on success, -1 on error
+ * @remark to be called before forking, so that the processes forked afterwards share the ring buffer of the logger
+ */
+int accesslog_init(int fd);
+
+/**
+ * tells the access log that a child process exited
+ * @param pid
+ * @returns 1 if it was the logger, 0 otherwise
+ * @remark records are written at once by the processes logging them until the logger is restarted
+ * @remark async-signal-safe
+ */
+int accesslog_exited(pid_t pid);
+
+/**
+ * restarts the logger if it exited, resuming at the first record it didn't write
+ * @returns 0 on success, or if the logger is running, -1 on error
+ * @remark to be called by the process which called `accesslog_init`
+ */
+int accesslog_restart(void);
+
+/**
+ * copies the address of a client into a record
+ * @param rec
+ * @param addr, or NULL if it is unknown
+ */
+void accesslog_setAddr(logrecord_t* rec, const struct sockaddr* addr);
+
+/**
+ * queues a record for the logger without blocking
+ * @param rec
+ * @returns 0 on success, -1 if the ring buffer is full, in which case the record is dropped and counted
+ * @remark records are written at once when the logger isn't running
+ */
+int accesslog_push(const logrecord_t* rec);
+
+/**
+ * formats a record as a line of the log
+ * @param rec
+ * @param buf
+ * @param len, the size of the buffer
+ * @returns the length of the line, with its line ending, or 0 if it doesn't fit
+ */
+size_t accesslog_format(const logrecord_t* rec, char* buf, size_t len);
+
+#endif
@@ -0,0 +1,75 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/**
+ * rounds a size up to the alignment of the arena
+ * @param size
+ * @returns the aligned size
+ */
+static size_t align(size_t size) {
+	return (size+_Alignof(max_align_t)-1)&~(_Alignof(max_align_t)-1);
+}
+
+arena_t* arena_create(size_t size) {
+	arena_t* arena=malloc(sizeof(arena_t));
+	if(!arena) return NULL;
+	size=align(size);
+	arena->base=malloc(sizeof(arenablock_t)+size);
+	if(!arena->base) {
+		free(arena);
+		return NULL;
+	}
+	arena->base->next=NULL;
+	arena->size=size;
+	arena->extra=NULL;
+	arena_reset(arena);
+	return arena;
+}
+
+void arena_destroy(arena_t* arena) {
+	if(!arena) return;
+	arena_reset(arena);
+	free(arena->base);
+	free(arena);
+}
+
+void arena_reset(arena_t* arena) {
+	while(arena->extra) {
+		arenablock_t* next=arena->extra->next;
+		free(arena->extra);
+		arena->extra=next;
+	}
+	arena->ptr=(char*) arena->base->data;
+	arena->end=arena->ptr+arena->size;
+}
+
+void* arena_alloc(arena_t* arena, size_t size) {
+	size=align(size);
+	if((size_t) (arena->end-arena->ptr)<size) {
+		// overflow into a new block, big enough for large allocations
+		size_t bsize=size>arena->size?size:arena->size;
+		arenablock_t* block=malloc(sizeof(arenablock_t)+bsize);
+		if(!block) return NULL;
+		block->next=arena->extra;
+		arena->extra=block;
+		arena->ptr=(char*) block->data;
+		arena->end=arena->ptr+bsize;
+	}
+	void* ptr=arena->ptr;
+	arena->ptr+=size;
+	return ptr;
+}
+
+char* arena_strdup(arena_t* arena, const char* str) {
+	return arena_strndup(arena, str, strlen(str));
+}
+
+char* arena_strndup(arena_t* arena, const char* str, size_t len) {
+	char* dup=arena_alloc(arena, len+1);
+	if(!dup) return NULL;
+	memcpy(dup, str, len);
+	dup[len]=0;
+	return dup;
+}
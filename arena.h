@@ -0,0 +1,73 @@
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <stddef.h>
+
+/**
+ * represents a block of memory owned by an arena
+ */
+typedef struct arenablock_t arenablock_t;
+typedef struct arenablock_t {
+	arenablock_t* next;
+	max_align_t data[];
+} arenablock_t;
+
+/**
+ * represents a bump allocator
+ * everything allocated from an arena is freed at once when it is reset or destroyed
+ */
+typedef struct {
+	char* ptr;
+	char* end;
+	size_t size;
+	arenablock_t* base;
+	arenablock_t* extra;
+} arena_t;
+
+/**
+ * creates an arena
+ * @param size, the size of its first block, which is kept across resets
+ * @returns the arena, or NULL on error
+ */
+arena_t* arena_create(size_t size);
+
+/**
+ * frees an arena and everything allocated from it
+ * @param arena, or NULL
+ */
+void arena_destroy(arena_t* arena);
+
+/**
+ * frees everything allocated from an arena, keeping it usable
+ * @param arena
+ * @remark this is O(1) unless the arena outgrew its first block
+ */
+void arena_reset(arena_t* arena);
+
+/**
+ * allocates memory from an arena
+ * @param arena
+ * @param size
+ * @returns a pointer to `size` bytes suitably aligned for any type, or NULL on error
+ * @remark the memory is not initialized
+ */
+void* arena_alloc(arena_t* arena, size_t size);
+
+/**
+ * copies a string into an arena
+ * @param arena
+ * @param str, not NULL
+ * @returns the copy, or NULL on error
+ */
+char* arena_strdup(arena_t* arena, const char* str);
+
+/**
+ * copies a part of a string into an arena, terminating it
+ * @param arena
+ * @param str, not NULL
+ * @param len, the number of bytes to copy
+ * @returns the copy, or NULL on error
+ */
+char* arena_strndup(arena_t* arena, const char* str, size_t len);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+#include <stdio.h>
+#include <time.h>
+
+/**
+ * returns the current time of a monotonic clock
+ * @returns a time in seconds
+ */
+static inline double bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec+ts.tv_nsec/1e9;
+}
+
+/**
+ * keeps the compiler from optimizing away a computed value
+ * @param ptr
+ */
+static inline void bench_use(const void* ptr) {
+	__asm__ volatile("" : : "g"(ptr) : "memory");
+}
+
+/**
+ * prints the result of a benchmark as a single JSON line
+ * @param name
+ * @param ops, the number of operations done
+ * @param bytes, the number of bytes processed, or 0
+ * @param seconds, the time it took
+ */
+static inline void bench_report(const char* name, long ops, double bytes, double seconds) {
+	printf("{\"bench\":\"%s\",\"ops\":%ld,\"seconds\":%.6f,\"ns_per_op\":%.2f", name, ops, seconds, seconds*1e9/ops);
+	if(bytes>0) printf(",\"gb_per_s\":%.3f", bytes/seconds/1e9);
+	printf("}\n");
+	fflush(stdout);
+}
+
+#endif
@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+#include "bench.h"
+#include "../headers.h"
+
+/**
+ * the headers of a request as sent by a browser
+ */
+static char* requestHeaders[][2]={
+	{"Host", "localhost:8080"},
+	{"User-Agent", "Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0"},
+	{"Accept", "image/avif,image/webp,*/*"},
+	{"Accept-Language", "en-US,en;q=0.5"},
+	{"Accept-Encoding", "gzip, deflate, br"},
+	{"Connection", "keep-alive"},
+	{"Referer", "http://localhost:8080/"},
+	{"Cookie", "session=0123456789abcdef0123456789abcdef; theme=dark"},
+	{"Sec-Fetch-Dest", "image"},
+	{"Sec-Fetch-Mode", "no-cors"},
+	{"Sec-Fetch-Site", "same-origin"},
+	{"If-None-Match", "W/\"1a2b-3c4d-5e6f\""},
+	{"Cache-Control", "max-age=0"}
+};
+#define NREQUESTHEADERS ((int) (sizeof(requestHeaders)/sizeof(*requestHeaders)))
+
+/**
+ * the names looked up by the server for each request
+ */
+static char* lookups[]={"Connection", "Transfer-Encoding", "Content-Length", "Accept-Encoding", "If-None-Match", "Range", "User-Agent", "X-Forwarded-For"};
+#define NLOOKUPS ((int) (sizeof(lookups)/sizeof(*lookups)))
+
+/**
+ * the linked list the header table replaced, kept as a baseline
+ */
+typedef struct listheader_t listheader_t;
+typedef struct listheader_t {
+	char* name;
+	char* value;
+	listheader_t* next;
+} listheader_t;
+
+static char* listGet(listheader_t* first, char* name) {
+	for(listheader_t* header=first; header; header=header->next) {
+		if(!strcasecmp(header->name, name)) return header->value;
+	}
+	return NULL;
+}
+
+static int listSet(listheader_t** first, char* name, char* value) {
+	char* dup=strdup(value);
+	if(!dup) return -1;
+	for(listheader_t* header=*first; header; header=header->next) {
+		if(!strcasecmp(header->name, name)) {
+			free(header->value);
+			header->value=dup;
+			return 0;
+		}
+	}
+	listheader_t** link=first;
+	while(*link) link=&(*link)->next;
+	listheader_t* header=malloc(sizeof(listheader_t));
+	if(!header) return -1;
+	header->name=strdup(name);
+	header->value=dup;
+	header->next=NULL;
+	*link=header;
+	return 0;
+}
+
+static void listClear(listheader_t** first) {
+	while(*first) {
+		listheader_t* next=(*first)->next;
+		free((*first)->name);
+		free((*first)->value);
+		free(*first);
+		*first=next;
+	}
+}
+
+/**
+ * builds the headers of a response, as the server does for each request
+ * @param iterations
+ */
+static void benchResponse(long iterations) {
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		listheader_t* first=NULL;
+		listSet(&first, "Server", "Custom HTTP");
+		listSet(&first, "Content-Type", "text/html");
+		listSet(&first, "Content-Length", "174");
+		listSet(&first, "Connection", "keep-alive");
+		bench_use(first);
+		listClear(&first);
+	}
+	bench_report("headers_response_list", iterations, 0, bench_now()-start);
+
+	arena_t* arena=arena_create(4096);
+	if(!arena) abort();
+	start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		headers_t headers;
+		http_initHeaders(&headers, arena, 16);
+		http_setHeaderId(&headers, HDR_SERVER, "Custom HTTP");
+		http_setHeader(&headers, "Content-Type", "text/html");
+		http_setHeaderId(&headers, HDR_CONTENT_LENGTH, "174");
+		http_setHeaderId(&headers, HDR_CONNECTION, "keep-alive");
+		bench_use(&headers);
+		arena_reset(arena);
+	}
+	bench_report("headers_response_table", iterations, 0, bench_now()-start);
+	arena_destroy(arena);
+}
+
+/**
+ * looks up the headers of a request, as the server does for each request
+ * @param iterations
+ */
+static void benchLookup(long iterations) {
+	listheader_t* first=NULL;
+	for(int i=0; i<NREQUESTHEADERS; i++) listSet(&first, requestHeaders[i][0], requestHeaders[i][1]);
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		for(int j=0; j<NLOOKUPS; j++) bench_use(listGet(first, lookups[j]));
+	}
+	bench_report("headers_lookup_list", iterations*NLOOKUPS, 0, bench_now()-start);
+	listClear(&first);
+
+	arena_t* arena=arena_create(4096);
+	if(!arena) abort();
+	headers_t headers;
+	http_initHeaders(&headers, arena, NREQUESTHEADERS);
+	for(int i=0; i<NREQUESTHEADERS; i++) {
+		http_appendHeader(&headers, requestHeaders[i][0], strlen(requestHeaders[i][0]), requestHeaders[i][1]);
+	}
+	start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		for(int j=0; j<NLOOKUPS; j++) bench_use(http_getHeader(&headers, lookups[j]));
+	}
+	bench_report("headers_lookup_table", iterations*NLOOKUPS, 0, bench_now()-start);
+
+	start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		bench_use(http_getHeaderId(&headers, HDR_CONNECTION));
+		bench_use(http_getHeaderId(&headers, HDR_TRANSFER_ENCODING));
+		bench_use(http_getHeaderId(&headers, HDR_CONTENT_LENGTH));
+		bench_use(http_getHeaderId(&headers, HDR_ACCEPT_ENCODING));
+		bench_use(http_getHeaderId(&headers, HDR_IF_NONE_MATCH));
+		bench_use(http_getHeaderId(&headers, HDR_RANGE));
+	}
+	bench_report("headers_lookup_id", iterations*6, 0, bench_now()-start);
+	arena_destroy(arena);
+}
+
+int main(int argc, char** argv) {
+	long iterations=argc>1?atol(argv[1]):1000000;
+	benchResponse(iterations);
+	benchLookup(iterations);
+	return 0;
+}
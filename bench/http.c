@@ -0,0 +1,157 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "../http.h"
+#include "../arena.h"
+#include "../config.h"
+
+/**
+ * a request as sent by a browser
+ */
+static const char request[]=
+	"GET /images/avatar.jpg?size=large&format=jpeg HTTP/1.1\r\n"
+	"Host: localhost:8080\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+	"Accept: image/avif,image/webp,*/*\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Connection: keep-alive\r\n"
+	"Referer: http://localhost:8080/\r\n"
+	"Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+	"Sec-Fetch-Dest: image\r\n"
+	"Sec-Fetch-Mode: no-cors\r\n"
+	"Sec-Fetch-Site: same-origin\r\n"
+	"If-None-Match: W/\"1a2b-3c4d-5e6f\"\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+/**
+ * a query string with some escaped characters, as sent by a form
+ */
+static const char decoded[]="q=caf\xc3\xa9 cr\xc3\xa8me br\xc3\xbbl\xc3\xa9" "e&sort=price/asc&page=2&filters=vegan,gluten-free&ref=https://example.com/search?x=1";
+
+/**
+ * requests whose body has an ambiguous length, and the status they are answered with before being handled, 0 if they are handled
+ */
+static const struct {
+	const char* head;
+	int status;
+} framings[]={
+	{"POST / HTTP/1.1\r\nHost: x\r\nTransfer-Encoding: chunked\r\nContent-Length: 5\r\n\r\n", 400},
+	{"POST / HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\nContent-Length: 6\r\n\r\n", 400},
+	{"POST / HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\nX-Other: 1\r\ncontent-length: 50\r\n\r\n", 400},
+	{"POST / HTTP/1.1\r\nHost: x\r\nContent-Length: 5\r\nContent-Length: 5\r\n\r\n", 0}
+};
+
+/**
+ * checks that requests are framed as the server must, so that what is benchmarked is what is served
+ */
+static void check(void) {
+	arena_t* arena=arena_create(SERVER_ARENA);
+	if(!arena) abort();
+	for(size_t i=0; i<sizeof(framings)/sizeof(*framings); i++) {
+		char buf[256];
+		size_t len=strlen(framings[i].head);
+		memcpy(buf, framings[i].head, len);
+		parser_t parser;
+		parser_init(&parser, NULL);
+		if(parser_feed(&parser, buf, len)!=PARSER_DONE) abort();
+		res_t* res=http_begin(-1, NULL, buf, len, &parser, arena, 1);
+		if(!res) abort();
+		int status=res->state&HTTP_RES_ENDED?res->status:0;
+		if(status!=framings[i].status) {
+			fprintf(stderr, "framing %zu: got %d, expected %d\n", i, status, framings[i].status);
+			abort();
+		}
+		res->log=NULL; // nothing was served
+		http_destroyResponse(res);
+		arena_reset(arena);
+	}
+	arena_destroy(arena);
+}
+
+/**
+ * parses the request into a request object, headers included, as the server does for each request
+ * @param iterations
+ */
+static void benchParseRequest(long iterations) {
+	size_t len=sizeof(request)-1;
+	char buf[sizeof(request)];
+	arena_t* arena=arena_create(SERVER_ARENA);
+	if(!arena) abort();
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		memcpy(buf, request, len);
+		req_t* req=http_parseRequestBuf(-1, buf, len, arena);
+		if(!req) abort();
+		bench_use(req);
+		arena_reset(arena);
+	}
+	bench_report("http_parseRequest", iterations, (double) len*iterations, bench_now()-start);
+	arena_destroy(arena);
+}
+
+/**
+ * encodes and decodes the query string
+ * @param iterations
+ */
+static void benchUrl(long iterations) {
+	arena_t* arena=arena_create(SERVER_ARENA);
+	if(!arena) abort();
+	char* encoded=http_urlencode((char*) decoded, NULL);
+	if(!encoded) abort();
+
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		char* s=http_urlencode((char*) decoded, arena);
+		if(!s) abort();
+		bench_use(s);
+		arena_reset(arena);
+	}
+	bench_report("http_urlencode", iterations, (double) (sizeof(decoded)-1)*iterations, bench_now()-start);
+
+	start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		char* s=http_urldecode(encoded, arena);
+		if(!s) abort();
+		bench_use(s);
+		arena_reset(arena);
+	}
+	bench_report("http_urldecode", iterations, (double) strlen(encoded)*iterations, bench_now()-start);
+
+	free(encoded);
+	arena_destroy(arena);
+}
+
+/**
+ * parses a request and reads fields of its query string, as a handler would
+ * @param iterations
+ */
+static void benchQuery(long iterations) {
+	static const char head[]="GET /search?q=caf%C3%A9+cr%C3%A8me+br%C3%BBl%C3%A9e&sort=price%2Fasc&page=2&filters=vegan%2Cgluten-free HTTP/1.1\r\nHost: localhost\r\n\r\n";
+	size_t len=sizeof(head)-1;
+	char buf[sizeof(head)];
+	arena_t* arena=arena_create(SERVER_ARENA);
+	if(!arena) abort();
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		memcpy(buf, head, len);
+		req_t* req=http_parseRequestBuf(-1, buf, len, arena);
+		if(!req || !http_getQuery(req, "q", NULL) || !http_getQuery(req, "page", NULL)) abort();
+		bench_use(req);
+		arena_reset(arena);
+	}
+	bench_report("http_getQuery", iterations, (double) len*iterations, bench_now()-start);
+	arena_destroy(arena);
+}
+
+int main(int argc, char** argv) {
+	long iterations=argc>1?atol(argv[1]):1000000;
+	check();
+	benchParseRequest(iterations);
+	benchUrl(iterations);
+	benchQuery(iterations);
+	return 0;
+}
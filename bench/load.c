@@ -0,0 +1,323 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+
+#include "bench.h"
+
+/**
+ * a HTTP load generator, keeping connections alive
+ * closed-loop: each connection sends its next request as soon as it has its response, which measures throughput
+ * open-loop (`-r`): requests are due at a fixed rate whatever the server does, and their latency counts from when they were due, so that a stalled server isn't hidden by requests that weren't sent
+ */
+
+#define MAXBUF 65536
+
+/**
+ * represents a client connection
+ */
+typedef struct {
+	int fd;
+	int busy; // 1 while a request is in flight
+	double due; // when the request in flight was due
+	size_t sent; // bytes of the request sent
+	char in[MAXBUF];
+	size_t inlen;
+	long long bodyleft; // bytes of the body still to be read, -1 while reading the head
+	int closing; // 1 if the server closes the connection after this response
+} client_t;
+
+/**
+ * the options of the run
+ */
+static const char* host="127.0.0.1";
+static const char* port="8080";
+static const char* path="/";
+static char request[1024];
+static size_t requestlen;
+static struct addrinfo* addr;
+
+/**
+ * the latencies of the responses, in seconds
+ */
+static double* latencies;
+static long nlatencies;
+static long caplatencies;
+static long errors;
+static double bytes;
+
+/**
+ * records a latency
+ * @param seconds
+ */
+static void record(double seconds) {
+	if(nlatencies==caplatencies) {
+		caplatencies=caplatencies?caplatencies*2:65536;
+		latencies=realloc(latencies, caplatencies*sizeof(double));
+		if(!latencies) abort();
+	}
+	latencies[nlatencies++]=seconds;
+}
+
+/**
+ * (re)connects a client
+ * @param epfd
+ * @param c
+ * @returns 0 on success, -1 on error
+ */
+static int clientConnect(int epfd, client_t* c) {
+	if(c->fd>=0) close(c->fd);
+	c->fd=socket(addr->ai_family, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if(c->fd<0) return -1;
+	int one=1;
+	setsockopt(c->fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+	if(connect(c->fd, addr->ai_addr, addr->ai_addrlen) && errno!=EINPROGRESS) return -1;
+	c->busy=0;
+	c->inlen=0;
+	c->bodyleft=-1;
+	c->closing=0;
+	struct epoll_event ev={.events=EPOLLIN|EPOLLOUT|EPOLLET, .data.ptr=c};
+	return epoll_ctl(epfd, EPOLL_CTL_ADD, c->fd, &ev);
+}
+
+/**
+ * sends what is left of the request of a client
+ * @param c
+ * @returns 0 on success, -1 on error
+ */
+static int clientSend(client_t* c) {
+	while(c->sent<requestlen) {
+		ssize_t a=send(c->fd, request+c->sent, requestlen-c->sent, MSG_NOSIGNAL);
+		if(a<0 && (errno==EAGAIN || errno==EWOULDBLOCK || errno==ENOTCONN)) return 0;
+		if(a<0 && errno==EINTR) continue;
+		if(a<=0) return -1;
+		c->sent+=a;
+	}
+	return 0;
+}
+
+/**
+ * starts a request on an idle client
+ * @param c
+ * @param due, when the request was due
+ * @returns 0 on success, -1 on error
+ */
+static int clientStart(client_t* c, double due) {
+	c->busy=1;
+	c->due=due;
+	c->sent=0;
+	return clientSend(c);
+}
+
+/**
+ * reads what the server sent to a client
+ * @param c
+ * @returns the number of responses completed, or -1 if the connection is to be reopened
+ */
+static int clientRead(client_t* c) {
+	int done=0;
+	for(;;) {
+		ssize_t a=recv(c->fd, c->in+c->inlen, sizeof(c->in)-c->inlen, 0);
+		if(a<0 && errno==EINTR) continue;
+		if(a<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return done;
+		if(a<=0) return -1;
+		c->inlen+=a;
+		bytes+=a;
+
+		for(;;) {
+			if(c->bodyleft<0) {
+				char* end=memmem(c->in, c->inlen, "\r\n\r\n", 4);
+				if(!end) {
+					if(c->inlen==sizeof(c->in)) return -1;
+					break;
+				}
+				*end='\0';
+				int status=c->inlen>12?atoi(c->in+9):0;
+				char* cl=strcasestr(c->in, "\r\ncontent-length:");
+				if(!cl || status<200 || status>=400) errors++;
+				if(!cl) return -1; // only bodies of known length can be told apart
+				c->bodyleft=atoll(cl+17);
+				c->closing=strcasestr(c->in, "\r\nconnection: close")!=NULL;
+				size_t head=end+4-c->in;
+				memmove(c->in, c->in+head, c->inlen-head);
+				c->inlen-=head;
+			}
+			size_t n=(size_t) c->bodyleft<c->inlen?(size_t) c->bodyleft:c->inlen;
+			memmove(c->in, c->in+n, c->inlen-n);
+			c->inlen-=n;
+			c->bodyleft-=n;
+			if(c->bodyleft) break;
+
+			// the response is complete
+			c->bodyleft=-1;
+			c->busy=0;
+			record(bench_now()-c->due);
+			done++;
+			if(c->closing) return -1;
+			if(!c->inlen) break;
+		}
+	}
+}
+
+/**
+ * compares latencies, for `qsort`
+ */
+static int compareLatencies(const void* a, const void* b) {
+	double x=*(const double*) a;
+	double y=*(const double*) b;
+	return (x>y)-(x<y);
+}
+
+/**
+ * returns a percentile of the sorted latencies
+ * @param p, between 0 and 1
+ * @returns a latency in microseconds
+ */
+static double percentile(double p) {
+	if(!nlatencies) return 0;
+	long i=(long) (p*nlatencies+0.999999)-1;
+	if(i<0) i=0;
+	if(i>=nlatencies) i=nlatencies-1;
+	return latencies[i]*1e6;
+}
+
+/**
+ * parses a URL such as http://127.0.0.1:8080/index.html
+ * @param url
+ * @returns 0 on success, -1 if the URL isn't understood
+ */
+static int parseUrl(char* url) {
+	if(strncmp(url, "http://", 7)) return -1;
+	char* h=url+7;
+	char* slash=strchr(h, '/');
+	path=slash?strdup(slash):"/";
+	if(slash) *slash='\0';
+	char* colon=strrchr(h, ':');
+	if(colon) {
+		*colon='\0';
+		port=colon+1;
+	}
+	host=h;
+	return 0;
+}
+
+int main(int argc, char** argv) {
+	int nclients=16;
+	double duration=5;
+	double rate=0;
+	const char* name=NULL;
+	int opt;
+	while((opt=getopt(argc, argv, "c:d:r:n:"))!=-1) {
+		switch(opt) {
+			case 'c': nclients=atoi(optarg); break;
+			case 'd': duration=atof(optarg); break;
+			case 'r': rate=atof(optarg); break;
+			case 'n': name=optarg; break;
+			default:
+				fprintf(stderr, "usage: %s [-c connections] [-d seconds] [-r requests per second] [-n name] http://host:port/path\n", argv[0]);
+				return 2;
+		}
+	}
+	if(optind>=argc || parseUrl(argv[optind]) || nclients<1) {
+		fprintf(stderr, "usage: %s [-c connections] [-d seconds] [-r requests per second] [-n name] http://host:port/path\n", argv[0]);
+		return 2;
+	}
+	requestlen=snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: %s:%s\r\nUser-Agent: bench/load\r\n\r\n", path, host, port);
+
+	struct addrinfo hints={.ai_socktype=SOCK_STREAM};
+	int err=getaddrinfo(host, port, &hints, &addr);
+	if(err) {
+		fprintf(stderr, "getaddrinfo(): %s\n", gai_strerror(err));
+		return 1;
+	}
+
+	int epfd=epoll_create1(EPOLL_CLOEXEC);
+	client_t* clients=calloc(nclients, sizeof(client_t));
+	if(epfd<0 || !clients) {
+		perror("load");
+		return 1;
+	}
+	for(int i=0; i<nclients; i++) {
+		clients[i].fd=-1;
+		if(clientConnect(epfd, clients+i)) {
+			perror("connect()");
+			return 1;
+		}
+	}
+
+	double start=bench_now();
+	double end=start+duration;
+	long issued=0;
+	long reconnects=0;
+	struct epoll_event events[256];
+	for(;;) {
+		double now=bench_now();
+		if(now>=end) break;
+
+		// start the requests which are due on idle connections, the others wait and their latency grows
+		for(int i=0; i<nclients; i++) {
+			client_t* c=clients+i;
+			if(c->busy) continue;
+			double due=rate>0?start+issued/rate:now;
+			if(due>now) break;
+			if(clientStart(c, due)) {
+				if(clientConnect(epfd, c)) goto failed;
+				reconnects++;
+				continue;
+			}
+			issued++;
+		}
+
+		int timeout=1;
+		if(rate>0) {
+			double next=start+issued/rate-bench_now();
+			timeout=next>0?(int) (next*1000):0;
+			if(timeout>1) timeout=1;
+		}
+		int n=epoll_wait(epfd, events, sizeof(events)/sizeof(*events), timeout);
+		if(n<0 && errno!=EINTR) goto failed;
+		for(int i=0; i<n; i++) {
+			client_t* c=events[i].data.ptr;
+			if((events[i].events&EPOLLOUT) && c->busy && clientSend(c)) {
+				errors++;
+				if(clientConnect(epfd, c)) goto failed;
+				reconnects++;
+				continue;
+			}
+			if(events[i].events&(EPOLLIN|EPOLLHUP|EPOLLERR)) {
+				int rst=clientRead(c);
+				if(rst<0) {
+					if(c->busy) errors++;
+					if(clientConnect(epfd, c)) goto failed;
+					reconnects++;
+				}
+			}
+		}
+	}
+
+	double elapsed=bench_now()-start;
+	qsort(latencies, nlatencies, sizeof(double), compareLatencies);
+	char label[256];
+	snprintf(label, sizeof(label), "%s", name?name:path);
+	printf("{\"bench\":\"load\",\"name\":\"%s\",\"mode\":\"%s\",\"connections\":%d,\"rate\":%.0f,\"seconds\":%.3f,\"requests\":%ld,\"errors\":%ld,\"reconnects\":%ld,\"rps\":%.1f,\"mb_per_s\":%.2f,\"p50_us\":%.1f,\"p99_us\":%.1f,\"p999_us\":%.1f,\"max_us\":%.1f}\n",
+		label, rate>0?"open":"closed", nclients, rate, elapsed, nlatencies, errors, reconnects, nlatencies/elapsed, bytes/elapsed/1e6,
+		percentile(0.5), percentile(0.99), percentile(0.999), nlatencies?latencies[nlatencies-1]*1e6:0);
+	return errors || !nlatencies?1:0;
+
+failed:
+	perror("load");
+	return 1;
+}
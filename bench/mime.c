@@ -0,0 +1,93 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <sys/stat.h>
+
+#include "bench.h"
+#include "../mime.h"
+
+/**
+ * file names with the type they should resolve to
+ */
+static const char* names[][2]={
+	{"index.html", "text/html"},
+	{"style.CSS", "text/css"},
+	{"app.js", "text/javascript"},
+	{"images/avatar.jpg", "image/jpeg"},
+	{"images/logo.png", "image/png"},
+	{"fonts/text.woff2", "font/woff2"},
+	{"video.webm", "video/webm"},
+	{"archive.tar.gz", "application/gzip"}
+};
+
+/**
+ * checks the lookups the benchmarks rely on
+ */
+static void check(void) {
+	for(size_t i=0; i<sizeof(names)/sizeof(*names); i++) {
+		const char* type=mime_fromExtension(names[i][0]);
+		if(!type || strcmp(type, names[i][1])) {
+			fprintf(stderr, "%s: got %s, expected %s\n", names[i][0], type?type:"NULL", names[i][1]);
+			abort();
+		}
+	}
+	if(mime_fromExtension("Makefile") || mime_fromExtension("dir.d/file") || mime_fromExtension("file.unknown")) abort();
+	if(strcmp(mime_sniff("\x89PNG\r\n\x1a\n....", 12), "image/png")) abort();
+	if(strcmp(mime_sniff("  <!DOCTYPE html>", 17), "text/html")) abort();
+}
+
+/**
+ * resolves types from extensions
+ * @param iterations
+ */
+static void benchExtension(long iterations) {
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		const char* type=mime_fromExtension(names[i&7][0]);
+		bench_use((void*) type);
+	}
+	bench_report("mime_extension", iterations, 0, bench_now()-start);
+}
+
+/**
+ * resolves the type of a file without an extension, once sniffed and then from the cache
+ * @param iterations
+ */
+static void benchCached(long iterations) {
+	char path[]="/tmp/mimebenchXXXXXX";
+	int fd=mkstemp(path);
+	if(fd<0) abort();
+	unlink(path);
+	if(write(fd, "<!DOCTYPE html>\n<html></html>\n", 30)!=30) abort();
+	struct stat st;
+	if(fstat(fd, &st)) abort();
+
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		char buf[512];
+		ssize_t len=pread(fd, buf, sizeof(buf), 0);
+		const char* type=mime_sniff(buf, len<0?0:len);
+		bench_use((void*) type);
+	}
+	bench_report("mime_sniff", iterations, 0, bench_now()-start);
+
+	start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		const char* type=mime_type(fd, path, &st);
+		bench_use((void*) type);
+	}
+	bench_report("mime_cached", iterations, 0, bench_now()-start);
+	if(strcmp(mime_type(fd, path, &st), "text/html")) abort();
+	close(fd);
+}
+
+int main(int argc, char** argv) {
+	long iterations=argc>1?atol(argv[1]):1000000;
+	check();
+	benchExtension(iterations);
+	benchCached(iterations);
+	return 0;
+}
@@ -0,0 +1,98 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "bench.h"
+#include "../parser.h"
+
+/**
+ * a request as sent by a browser
+ */
+static const char request[]=
+	"GET /images/avatar.jpg?size=large&format=jpeg HTTP/1.1\r\n"
+	"Host: localhost:8080\r\n"
+	"User-Agent: Mozilla/5.0 (X11; Linux x86_64; rv:109.0) Gecko/20100101 Firefox/115.0\r\n"
+	"Accept: image/avif,image/webp,*/*\r\n"
+	"Accept-Language: en-US,en;q=0.5\r\n"
+	"Accept-Encoding: gzip, deflate, br\r\n"
+	"Connection: keep-alive\r\n"
+	"Referer: http://localhost:8080/\r\n"
+	"Cookie: session=0123456789abcdef0123456789abcdef; theme=dark\r\n"
+	"Sec-Fetch-Dest: image\r\n"
+	"Sec-Fetch-Mode: no-cors\r\n"
+	"Sec-Fetch-Site: same-origin\r\n"
+	"If-None-Match: W/\"1a2b-3c4d-5e6f\"\r\n"
+	"Cache-Control: max-age=0\r\n"
+	"\r\n";
+
+/**
+ * parses the request in one go
+ * @param iterations
+ */
+static void benchWhole(long iterations) {
+	size_t len=sizeof(request)-1;
+	parser_t parser;
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		parser_init(&parser, NULL);
+		if(parser_feed(&parser, request, len)!=PARSER_DONE) abort();
+		bench_use(&parser);
+	}
+	bench_report("parser_whole", iterations, (double) len*iterations, bench_now()-start);
+}
+
+/**
+ * parses the request as if it arrived in segments of a given size
+ * @param name
+ * @param iterations
+ * @param step, the size of each segment
+ */
+static void benchFragmented(const char* name, long iterations, size_t step) {
+	size_t len=sizeof(request)-1;
+	parser_t parser;
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		parser_init(&parser, NULL);
+		int rst=PARSER_AGAIN;
+		for(size_t fed=step; rst==PARSER_AGAIN; fed+=step) {
+			rst=parser_feed(&parser, request, fed<len?fed:len);
+		}
+		if(rst!=PARSER_DONE) abort();
+		bench_use(&parser);
+	}
+	bench_report(name, iterations, (double) len*iterations, bench_now()-start);
+}
+
+/**
+ * parses a batch of pipelined requests
+ * @param iterations
+ * @param depth, the number of requests in the batch
+ */
+static void benchPipelined(long iterations, int depth) {
+	size_t len=sizeof(request)-1;
+	char* buf=malloc(len*depth);
+	if(!buf) abort();
+	for(int i=0; i<depth; i++) memcpy(buf+i*len, request, len);
+
+	parser_t parser;
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		size_t off=0;
+		for(int j=0; j<depth; j++) {
+			parser_init(&parser, NULL);
+			if(parser_feed(&parser, buf+off, len*depth-off)!=PARSER_DONE) abort();
+			off+=parser.pos;
+		}
+		bench_use(&parser);
+	}
+	bench_report("parser_pipelined16", iterations*depth, (double) len*depth*iterations, bench_now()-start);
+	free(buf);
+}
+
+int main(int argc, char** argv) {
+	long iterations=argc>1?atol(argv[1]):1000000;
+	benchWhole(iterations);
+	benchFragmented("parser_fragmented64", iterations, 64);
+	benchFragmented("parser_fragmented1", iterations/20, 1);
+	benchPipelined(iterations/16, 16);
+	return 0;
+}
@@ -0,0 +1,107 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+
+#include "bench.h"
+#include "../router.h"
+
+/**
+ * a route as the server used to store them, in a linked list sorted in descending order
+ */
+typedef struct route_t route_t;
+typedef struct route_t {
+	char* route;
+	void* data;
+	route_t* next;
+} route_t;
+
+/**
+ * adds a route to a list, as the server used to
+ * @param first
+ * @param route
+ * @param data
+ */
+static void listAdd(route_t** first, char* route, void* data) {
+	route_t* r=malloc(sizeof(route_t));
+	if(!r) abort();
+	r->route=route;
+	r->data=data;
+	while(*first && strcmp((*first)->route, route)>0) first=&(*first)->next;
+	r->next=*first;
+	*first=r;
+}
+
+/**
+ * finds the first route matching a URL, as the server used to
+ * @param first
+ * @param url
+ * @returns the data of the route, or NULL
+ */
+static void* listMatch(route_t* first, const char* url) {
+	for(route_t* r=first; r; r=r->next) {
+		if(strstr(url, r->route)==url) return r->data;
+	}
+	return NULL;
+}
+
+/**
+ * builds the name of the nth route
+ * @param buf
+ * @param n
+ * @returns buf
+ */
+static char* routeName(char* buf, int n) {
+	sprintf(buf, "/api/v%d/resource%d/items", n%7, n);
+	return buf;
+}
+
+/**
+ * compares lookups in a list and in a router holding the same routes
+ * @param nroutes
+ * @param iterations
+ */
+static void benchRoutes(int nroutes, long iterations) {
+	router_t* router=router_create();
+	route_t* list=NULL;
+	if(!router) abort();
+	for(int i=0; i<nroutes; i++) {
+		char buf[64];
+		char* route=strdup(routeName(buf, i));
+		if(!route) abort();
+		listAdd(&list, route, route);
+		if(router_add(router, ROUTER_ANY, route, route)) abort();
+	}
+	if(router_add(router, ROUTER_ANY, "/", "/")) abort();
+	listAdd(&list, "/", "/");
+
+	// look up a handful of URLs spread over the routes, and one only the root matches
+	char urls[8][64];
+	for(int i=0; i<7; i++) strcat(routeName(urls[i], (long) nroutes*i/7), "/42?x=1");
+	strcpy(urls[7], "/index.html");
+
+	char name[64];
+	double start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		void* data=listMatch(list, urls[i&7]);
+		bench_use(data);
+	}
+	sprintf(name, "router_list%d", nroutes);
+	bench_report(name, iterations, 0, bench_now()-start);
+
+	routematch_t matches[SERVER_MAXMATCHES];
+	start=bench_now();
+	for(long i=0; i<iterations; i++) {
+		int other;
+		if(!router_match(router, 0, urls[i&7], matches, SERVER_MAXMATCHES, &other)) abort();
+		bench_use(matches);
+	}
+	sprintf(name, "router_tree%d", nroutes);
+	bench_report(name, iterations, 0, bench_now()-start);
+}
+
+int main(int argc, char** argv) {
+	long iterations=argc>1?atol(argv[1]):1000000;
+	benchRoutes(10, iterations);
+	benchRoutes(10000, iterations/100);
+	return 0;
+}
@@ -0,0 +1,313 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+
+#include "body.h"
+#include "config.h"
+
+/**
+ * the states of the reader
+ */
+enum {
+	BODY_DATA, // in the body, or in a chunk
+	BODY_SIZE, // before the size line of a chunk
+	BODY_CRLF, // before the line ending a chunk
+	BODY_TRAILERS, // in the trailers
+	BODY_DONE
+};
+
+/**
+ * gives the current time, to measure how long the body takes
+ * @returns milliseconds of CLOCK_MONOTONIC
+ */
+static long long bodyNow(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000LL+ts.tv_nsec/1000000;
+}
+
+void http_initBody(reqbody_t* body, int fd, const char* in, size_t inlen, int chunked, size_t length, int expect) {
+	body->fd=fd;
+	body->chunked=chunked;
+	body->state=chunked?BODY_SIZE:length?BODY_DATA:BODY_DONE;
+	body->remaining=chunked?0:length;
+	body->total=0;
+	body->in=in;
+	body->inlen=inlen;
+	body->inpos=0;
+	body->expect=expect;
+	body->error=0;
+	body->linelen=0;
+	body->nonblock=0;
+	body->deadline=bodyNow()+SERVER_BODYTIMEOUT*1000LL;
+	body->spool=-1;
+	body->spilled=0;
+	body->spooled=0;
+}
+
+/**
+ * reads bytes of the body from the socket, waiting for them unless the body is non-blocking
+ * @param body
+ * @param buf
+ * @param len
+ * @param flags, given to `recv`
+ * @returns the number of bytes read, 0 if the client closed the connection, -1 on error
+ */
+static ssize_t bodyRecv(reqbody_t* body, char* buf, size_t len, int flags) {
+	if(body->expect) { // the client waits for our go before sending the body
+		body->expect=0;
+		static const char cont[]="HTTP/1.1 100 Continue\r\n\r\n";
+		if(send(body->fd, cont, sizeof(cont)-1, MSG_NOSIGNAL)<0) return -1;
+	}
+	for(;;) {
+		// blocking sockets are polled too, so that the wait is bounded
+		ssize_t a=recv(body->fd, buf, len, flags|MSG_DONTWAIT);
+		if(a>=0) return a;
+		if(errno==EINTR) continue;
+		if(errno!=EAGAIN && errno!=EWOULDBLOCK) return -1;
+		// a client sending a byte now and then must not hold the connection forever
+		long long left=body->deadline-bodyNow();
+		if(left<=0) {
+			errno=ETIMEDOUT;
+			return -1;
+		}
+		if(body->nonblock) {
+			errno=EAGAIN;
+			return -1;
+		}
+		struct pollfd pfd={body->fd, POLLIN, 0};
+		int p=poll(&pfd, 1, left<SERVER_KEEPALIVE_TIMEOUT*1000?(int) left:SERVER_KEEPALIVE_TIMEOUT*1000);
+		if(p<0 && errno!=EINTR) return -1;
+		if(!p) {
+			errno=ETIMEDOUT;
+			return -1;
+		}
+	}
+}
+
+/**
+ * reads bytes of the body, first from those read along with the head, then from the socket
+ * @param body
+ * @param buf
+ * @param len
+ * @param peek, 1 to leave the bytes to be read again
+ * @returns the number of bytes read, -1 on error or if the body is cut short
+ */
+static ssize_t bodyInput(reqbody_t* body, char* buf, size_t len, int peek) {
+	if(body->inpos<body->inlen) {
+		size_t n=body->inlen-body->inpos;
+		if(n>len) n=len;
+		memcpy(buf, body->in+body->inpos, n);
+		if(!peek) body->inpos+=n;
+		return n;
+	}
+	ssize_t a=bodyRecv(body, buf, len, peek?MSG_PEEK:0);
+	if(!a) errno=EPROTO;
+	return a>0?a:-1;
+}
+
+/**
+ * reads a framing line of a chunked body, without reading anything past it
+ * @param body, whose `line` gets the line, without its line ending
+ * @returns 1 once the line is complete, 0 if only part of it was read, -1 on error
+ * @remark what was read of the line is kept when the socket has nothing more to read, so that it is completed by the next call
+ */
+static int readLine(reqbody_t* body) {
+	char buf[sizeof(body->line)];
+	size_t room=sizeof(body->line)-body->linelen;
+	if(!room) {
+		errno=EPROTO;
+		return -1;
+	}
+	ssize_t a=bodyInput(body, buf, room, 1);
+	if(a<0) return -1;
+	char* nl=memchr(buf, '\n', a);
+	size_t n=nl?(size_t) (nl-buf)+1:(size_t) a;
+	if(bodyInput(body, body->line+body->linelen, n, 0)!=(ssize_t) n) return -1;
+	body->linelen+=n;
+	if(!nl) return 0;
+
+	body->linelen-=body->linelen>1 && body->line[body->linelen-2]=='\r'?2:1;
+	body->line[body->linelen]='\0';
+	return 1;
+}
+
+/**
+ * reads the framing before the data of a chunked body
+ * @param body
+ * @returns 0 on success, -1 on error
+ */
+static int readFraming(reqbody_t* body) {
+	while(body->state!=BODY_DATA && body->state!=BODY_DONE) {
+		int rst=readLine(body);
+		if(rst<=0) {
+			if(!rst) continue;
+			return -1;
+		}
+		body->linelen=0;
+		if(body->state==BODY_SIZE) {
+			char* end;
+			errno=0;
+			unsigned long long size=strtoull(body->line, &end, 16);
+			if(end==body->line || errno || (*end && *end!=';' && *end!=' ' && *end!='\t')) {
+				errno=EPROTO;
+				return -1;
+			}
+			if(size>SERVER_MAXBODY || body->total+size>SERVER_MAXBODY) {
+				errno=EFBIG;
+				return -1;
+			}
+			body->remaining=size;
+			body->state=size?BODY_DATA:BODY_TRAILERS;
+		} else if(body->state==BODY_CRLF) {
+			if(*body->line) {
+				errno=EPROTO;
+				return -1;
+			}
+			body->state=BODY_SIZE;
+		} else if(!*body->line) { // the trailers, which are ignored, end with an empty line
+			body->state=BODY_DONE;
+		}
+	}
+	return 0;
+}
+
+/**
+ * reads some of the body of a request from the client, without its chunked framing
+ * @param body
+ * @param buf
+ * @param len
+ * @returns the number of bytes read, 0 at the end of the body, -1 on error
+ * @remark errors but EAGAIN are remembered, as the framing of the body is lost after them
+ */
+static ssize_t bodyRead(reqbody_t* body, char* buf, size_t len) {
+	if(body->error) {
+		errno=body->error;
+		return -1;
+	}
+	if(body->chunked && readFraming(body)) {
+		if(errno!=EAGAIN) body->error=errno;
+		return -1;
+	}
+	if(body->state==BODY_DONE || !len) return 0;
+
+	if(len>body->remaining) len=body->remaining;
+	ssize_t a=bodyInput(body, buf, len, 0);
+	if(a<0) {
+		if(errno!=EAGAIN) body->error=errno;
+		return -1;
+	}
+	body->remaining-=a;
+	body->total+=a;
+	if(!body->remaining) body->state=body->chunked?BODY_CRLF:BODY_DONE;
+	return a;
+}
+
+ssize_t http_readBody(reqbody_t* body, char* buf, size_t len) {
+	if(body->spool<0 || body->state!=BODY_DONE) return bodyRead(body, buf, len);
+	ssize_t a;
+	while((a=read(body->spool, buf, len))<0 && errno==EINTR);
+	return a;
+}
+
+int http_bodyStatus(int err) {
+	switch(err) {
+		case EFBIG: return 413;
+		case EPROTO: return 400;
+		case ETIMEDOUT: return 408;
+		default: return 500;
+	}
+}
+
+/**
+ * writes a whole buffer to a file
+ * @param fd
+ * @param buf
+ * @param len
+ * @returns 0 on success, -1 on error
+ */
+static int writeAll(int fd, const char* buf, size_t len) {
+	while(len) {
+		ssize_t a=write(fd, buf, len);
+		if(a<0 && errno==EINTR) continue;
+		if(a<0) return -1;
+		buf+=a;
+		len-=a;
+	}
+	return 0;
+}
+
+/**
+ * reads the rest of the body into its spool, which is kept in memory until it grows too long
+ * @param body
+ * @returns 0 once the whole body is in the spool, which is then at its start, -1 on error
+ */
+static int bodySpool(reqbody_t* body) {
+	if(body->spool<0) {
+		body->spool=memfd_create("body", MFD_CLOEXEC);
+		if(body->spool<0) return -1;
+	}
+
+	char buf[SERVER_PIPEBUF];
+	ssize_t a;
+	while((a=bodyRead(body, buf, sizeof(buf)))>0) {
+		if(!body->spilled && body->spooled+a>SERVER_BODYMEM) {
+			int file=open(SERVER_TMPDIR, O_TMPFILE|O_RDWR|O_CLOEXEC, 0600);
+			if(file<0) break;
+			off_t off=0;
+			if(body->spooled && sendfile(file, body->spool, &off, body->spooled)!=(ssize_t) body->spooled) {
+				int err=errno;
+				close(file);
+				errno=err;
+				break;
+			}
+			close(body->spool);
+			body->spool=file;
+			body->spilled=1;
+		}
+		if(writeAll(body->spool, buf, a)) break;
+		body->spooled+=a;
+	}
+	if(!a && !lseek(body->spool, 0, SEEK_SET)) return 0;
+	// what was read is lost with the spool, so the body can't be read anymore
+	if(errno!=EAGAIN) body->error=errno;
+	return -1;
+}
+
+int http_bodyFd(reqbody_t* body, size_t* len) {
+	if(bodySpool(body)) return -1;
+	*len=body->spooled;
+	int fd=body->spool;
+	body->spool=-1;
+	body->spilled=0;
+	body->spooled=0;
+	return fd;
+}
+
+int http_spoolBody(reqbody_t* body) {
+	body->nonblock=1;
+	return bodySpool(body);
+}
+
+void http_closeBody(reqbody_t* body) {
+	if(body->spool>=0) close(body->spool);
+	body->spool=-1;
+}
+
+int http_skipBody(reqbody_t* body, size_t max) {
+	char buf[4096];
+	size_t skipped=0;
+	ssize_t a;
+	while(skipped<=max && (a=bodyRead(body, buf, sizeof(buf)))>0) skipped+=a;
+	return body->state==BODY_DONE?0:-1;
+}
@@ -0,0 +1,94 @@
+#ifndef _BODY_H
+#define _BODY_H
+
+#include <stddef.h>
+
+#include <sys/types.h>
+
+/**
+ * represents the body of a request, read from the client as it is consumed
+ * the reader never reads past the end of the body, so that pipelined requests are left on the socket
+ */
+typedef struct {
+	int fd; // the client socket
+	int chunked; // 1 for a chunked body, 0 for a body with a Content-Length
+	int state;
+	size_t remaining; // bytes left in the body, or in the current chunk
+	size_t total; // bytes of the body read so far
+	const char* in; // the start of the body, read along with the head
+	size_t inlen;
+	size_t inpos; // how much of it was consumed, framing included
+	int expect; // 1 if the client waits for a 100 Continue before sending the body
+	int error; // the errno of the first failed read, after which the body can't be read anymore
+	char line[128]; // the framing line being read, for chunked bodies
+	size_t linelen;
+	int nonblock; // 1 if reads return EAGAIN rather than wait for the client
+	long long deadline; // when the whole body must have been read, in milliseconds of CLOCK_MONOTONIC
+	int spool; // the file the body is read into by `http_spoolBody` or `http_bodyFd`, or -1
+	int spilled; // 1 once the spool was moved from memory to a file
+	size_t spooled; // the length of the spool
+} reqbody_t;
+
+/**
+ * initializes the body of a request
+ * @param body
+ * @param fd, the client socket, blocking or not
+ * @param in, the bytes read after the head of the request, which may belong to the body
+ * @param inlen
+ * @param chunked, 1 if the body is chunked
+ * @param length, the Content-Length of the body if it isn't chunked
+ * @param expect, 1 if the client sent `Expect: 100-continue`
+ */
+void http_initBody(reqbody_t* body, int fd, const char* in, size_t inlen, int chunked, size_t length, int expect);
+
+/**
+ * reads some of the body of a request, without its chunked framing
+ * @param body
+ * @param buf
+ * @param len
+ * @returns the number of bytes read, 0 at the end of the body, -1 on error
+ * @remark errno is set to EFBIG if the body is longer than `SERVER_MAXBODY`, to EPROTO if its framing is invalid or it is cut short, or to ETIMEDOUT if the client stays silent for `SERVER_KEEPALIVE_TIMEOUT` seconds, or doesn't send the whole body within `SERVER_BODYTIMEOUT` seconds
+ * @remark a body read whole by `http_spoolBody` is read from its spool
+ */
+ssize_t http_readBody(reqbody_t* body, char* buf, size_t len);
+
+/**
+ * returns the status to answer a request whose body couldn't be read
+ * @param err, the errno set by `http_readBody`
+ * @returns an error status
+ */
+int http_bodyStatus(int err);
+
+/**
+ * reads the rest of the body of a request, and gives it as a file
+ * bodies up to `SERVER_BODYMEM` bytes are kept in memory, and longer ones are spilled to an unlinked file in `SERVER_TMPDIR`
+ * @param body
+ * @param len, set to the length of the body
+ * @returns a seekable fd at the start of the body, to be closed by the caller, or -1 on error
+ */
+int http_bodyFd(reqbody_t* body, size_t* len);
+
+/**
+ * reads what the client sent of the body of a request into its spool, without waiting for the rest
+ * this lets event loops read the body as the socket becomes readable, before handlers which need it whole are called
+ * @param body
+ * @returns 0 once the whole body is read, in which case `http_readBody` and `http_bodyFd` give it from the spool, -1 on error
+ * @remark errno is set to EAGAIN if the client has more to send, in which case it is called again once the socket is readable
+ */
+int http_spoolBody(reqbody_t* body);
+
+/**
+ * releases the spool of the body of a request, if it has one
+ * @param body
+ */
+void http_closeBody(reqbody_t* body);
+
+/**
+ * discards the rest of the body of a request, so that the next request on the connection can be read
+ * @param body
+ * @param max, how many bytes are worth discarding
+ * @returns 0 if the body was discarded, -1 if it is too long or on error, in which case the connection must be closed
+ */
+int http_skipBody(reqbody_t* body, size_t max);
+
+#endif
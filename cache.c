@@ -0,0 +1,504 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <time.h>
+#include <signal.h>
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "cache.h"
+#include "config.h"
+
+/**
+ * the unit in which the byte budget is allocated
+ */
+#define PAGE 4096
+
+/**
+ * the longest paths which can be cached
+ */
+#define MAXPATH 128
+
+/**
+ * the longest entity tags which can be cached
+ */
+#define MAXETAG 64
+
+/**
+ * the processes which can pin a response at once, others miss it
+ */
+#define MAXPINS 8
+
+/**
+ * the states of a slot
+ */
+#define SLOT_FREE 0
+#define SLOT_FILLING 1 // allocated, but not yet visible
+#define SLOT_USED 2
+#define SLOT_STALE 3 // no longer visible, but still pinned
+
+/**
+ * represents the state of a file a response depends on
+ */
+typedef struct {
+	char path[MAXPATH];
+	int exists;
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	off_t size;
+} dep_t;
+
+/**
+ * represents the pins of a process on a cached response
+ */
+typedef struct {
+	pid_t pid;
+	int refs;
+} pin_t;
+
+/**
+ * represents a cached response
+ */
+typedef struct {
+	int state;
+	pid_t owner; // the process filling the slot
+	int refs; // the number of responses being sent from this slot
+	pin_t pins[MAXPINS]; // who they are sent by, so that the pins of dead processes can be dropped
+	int referenced; // the CLOCK bit, set on every hit
+	int next; // the next slot of the bucket, or -1
+	uint64_t hash;
+	int dir;
+	int variant;
+	char path[MAXPATH];
+	int ndeps;
+	dep_t deps[CACHE_MAXDEPS];
+	time_t checked; // when the files were last checked for changes
+	char etag[MAXETAG];
+	time_t modified;
+	size_t page;
+	size_t npages;
+	size_t headlen;
+	size_t bodylen;
+} slot_t;
+
+struct cache_t {
+	pthread_mutex_t lock;
+	size_t npages;
+	int nslots;
+	int nbuckets;
+	int hand; // the CLOCK hand
+	char* data;
+	uint64_t* bitmap; // the allocated pages
+	int* buckets; // the first slot of each bucket, or -1
+	slot_t slots[];
+};
+
+/**
+ * hashes the key of a response
+ * @param dir
+ * @param path
+ * @param variant
+ * @returns the hash
+ */
+static uint64_t hashKey(int dir, const char* path, int variant) {
+	uint64_t h=0xcbf29ce484222325ull^(uint64_t) dir^((uint64_t) variant<<32);
+	for(; *path; path++) {
+		h^=(unsigned char) *path;
+		h*=0x100000001b3ull;
+	}
+	return h;
+}
+
+/**
+ * gets the current time, in seconds
+ * @returns the time
+ */
+static time_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+	return ts.tv_sec;
+}
+
+static void reclaimAll(cache_t* cache);
+
+/**
+ * locks the cache, recovering it if a process died while holding the lock
+ * @param cache
+ */
+static void lock(cache_t* cache) {
+	if(pthread_mutex_lock(&cache->lock)==EOWNERDEAD) {
+		pthread_mutex_consistent(&cache->lock);
+		reclaimAll(cache);
+	}
+}
+
+/**
+ * unlocks the cache
+ * @param cache
+ */
+static void unlock(cache_t* cache) {
+	pthread_mutex_unlock(&cache->lock);
+}
+
+cache_t* cache_create(size_t size, int entries) {
+	if(entries<1) return NULL;
+
+	size_t npages=size/PAGE;
+	int nbuckets=1;
+	while(nbuckets<entries) nbuckets*=2;
+	size_t meta=sizeof(cache_t)+entries*sizeof(slot_t)+nbuckets*sizeof(int)+(npages+63)/64*sizeof(uint64_t);
+	meta=(meta+PAGE-1)/PAGE*PAGE;
+
+	cache_t* cache=mmap(NULL, meta+npages*PAGE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(cache==MAP_FAILED) return NULL;
+
+	pthread_mutexattr_t attr;
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+	pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+	int err=pthread_mutex_init(&cache->lock, &attr);
+	pthread_mutexattr_destroy(&attr);
+	if(err) {
+		munmap(cache, meta+npages*PAGE);
+		errno=err;
+		return NULL;
+	}
+
+	// the mapping is zeroed, so every slot and page starts free
+	cache->npages=npages;
+	cache->nslots=entries;
+	cache->nbuckets=nbuckets;
+	cache->buckets=(int*) (cache->slots+entries);
+	cache->bitmap=(uint64_t*) (cache->buckets+nbuckets);
+	cache->data=(char*) cache+meta;
+	for(int i=0; i<nbuckets; i++) cache->buckets[i]=-1;
+	return cache;
+}
+
+/**
+ * finds a visible slot
+ * @param cache, locked
+ * @param dir
+ * @param path
+ * @param variant
+ * @param hash
+ * @returns the index of the slot, or -1
+ */
+static int find(cache_t* cache, int dir, const char* path, int variant, uint64_t hash) {
+	for(int i=cache->buckets[hash&(cache->nbuckets-1)]; i>=0; i=cache->slots[i].next) {
+		slot_t* slot=cache->slots+i;
+		if(slot->hash==hash && slot->dir==dir && slot->variant==variant && !strcmp(slot->path, path)) return i;
+	}
+	return -1;
+}
+
+/**
+ * records the state of a file
+ * @param dep
+ * @param st, or NULL if the file doesn't exist
+ */
+static void setDep(dep_t* dep, const struct stat* st) {
+	dep->exists=!!st;
+	if(!st) return;
+	dep->dev=st->st_dev;
+	dep->ino=st->st_ino;
+	dep->mtime=st->st_mtim;
+	dep->size=st->st_size;
+}
+
+/**
+ * checks if the files a response depends on are unchanged
+ * @param slot
+ * @returns 1 if they are, 0 otherwise
+ */
+static int checkDeps(slot_t* slot) {
+	for(int i=0; i<slot->ndeps; i++) {
+		dep_t* dep=slot->deps+i;
+		struct stat st;
+		int exists=!fstatat(slot->dir, dep->path, &st, 0);
+		if(exists!=dep->exists) return 0;
+		if(exists && (st.st_dev!=dep->dev || st.st_ino!=dep->ino || st.st_size!=dep->size || st.st_mtim.tv_sec!=dep->mtime.tv_sec || st.st_mtim.tv_nsec!=dep->mtime.tv_nsec)) return 0;
+	}
+	return 1;
+}
+
+/**
+ * marks pages as free or allocated
+ * @param cache, locked
+ * @param page
+ * @param n
+ * @param used
+ */
+static void markPages(cache_t* cache, size_t page, size_t n, int used) {
+	for(size_t p=page; p<page+n; p++) {
+		if(used) cache->bitmap[p/64]|=1ull<<(p%64);
+		else cache->bitmap[p/64]&=~(1ull<<(p%64));
+	}
+}
+
+/**
+ * finds the first run of free pages long enough
+ * @param cache, locked
+ * @param n
+ * @returns the first page of the run, or -1
+ */
+static ssize_t findPages(cache_t* cache, size_t n) {
+	size_t run=0;
+	for(size_t p=0; p<cache->npages; p++) {
+		if(cache->bitmap[p/64]==~0ull && !(p%64)) { // skip full words
+			run=0;
+			p+=63;
+			continue;
+		}
+		if(cache->bitmap[p/64]&(1ull<<(p%64))) {
+			run=0;
+		} else if(++run==n) {
+			return p+1-n;
+		}
+	}
+	return -1;
+}
+
+/**
+ * frees a slot and its pages
+ * @param cache, locked
+ * @param i
+ */
+static void freeSlot(cache_t* cache, int i) {
+	slot_t* slot=cache->slots+i;
+	markPages(cache, slot->page, slot->npages, 0);
+	slot->state=SLOT_FREE;
+}
+
+/**
+ * makes a slot invisible, and frees it unless it is pinned
+ * @param cache, locked
+ * @param i, a visible slot
+ */
+static void dropSlot(cache_t* cache, int i) {
+	slot_t* slot=cache->slots+i;
+	int* link=cache->buckets+(slot->hash&(cache->nbuckets-1));
+	while(*link!=i) link=&cache->slots[*link].next;
+	*link=slot->next;
+
+	if(slot->refs) slot->state=SLOT_STALE;
+	else freeSlot(cache, i);
+}
+
+/**
+ * checks if a process is gone
+ * @param pid
+ * @returns 1 if it is, 0 otherwise
+ * @remark processes which died but weren't reaped yet still count, and are checked again later
+ */
+static int gone(pid_t pid) {
+	return kill(pid, 0) && errno==ESRCH;
+}
+
+/**
+ * drops what dead processes left in a slot: the slot itself if it died filling it, and its pins otherwise
+ * @param cache, locked
+ * @param i
+ */
+static void reclaim(cache_t* cache, int i) {
+	slot_t* slot=cache->slots+i;
+	if(slot->state==SLOT_FILLING) {
+		if(gone(slot->owner)) freeSlot(cache, i);
+		return;
+	}
+	if(!slot->refs) return;
+	for(int j=0; j<MAXPINS; j++) {
+		pin_t* pin=slot->pins+j;
+		if(!pin->refs || !gone(pin->pid)) continue;
+		slot->refs-=pin->refs;
+		pin->refs=0;
+	}
+	if(!slot->refs && slot->state==SLOT_STALE) freeSlot(cache, i);
+}
+
+/**
+ * drops what dead processes left in every slot
+ * @param cache, locked
+ */
+static void reclaimAll(cache_t* cache) {
+	for(int i=0; i<cache->nslots; i++) reclaim(cache, i);
+}
+
+/**
+ * evicts a response which wasn't hit since the hand last passed over it
+ * @param cache, locked
+ * @returns 1 if a response was evicted, 0 if none can be
+ */
+static int evict(cache_t* cache) {
+	for(int n=0; n<2*cache->nslots; n++) {
+		int i=cache->hand;
+		slot_t* slot=cache->slots+i;
+		cache->hand=(i+1)%cache->nslots;
+		if(slot->state==SLOT_FILLING || slot->refs) reclaim(cache, i);
+		if(slot->state!=SLOT_USED || slot->refs) continue;
+		if(slot->referenced) {
+			slot->referenced=0;
+			continue;
+		}
+		dropSlot(cache, i);
+		return 1;
+	}
+	return 0;
+}
+
+int cache_lookup(cache_t* cache, int dir, const char* path, int variant, cacheref_t* ref) {
+	if(!cache || strlen(path)>=MAXPATH) return 0;
+	uint64_t hash=hashKey(dir, path, variant);
+
+	lock(cache);
+	int i=find(cache, dir, path, variant, hash);
+	if(i<0) {
+		unlock(cache);
+		return 0;
+	}
+
+	slot_t* slot=cache->slots+i;
+	time_t t=now();
+	if(t-slot->checked>=SERVER_CACHEREVALIDATE) {
+		if(!checkDeps(slot)) {
+			dropSlot(cache, i);
+			unlock(cache);
+			return 0;
+		}
+		slot->checked=t;
+	}
+
+	// the pin is noted under the pid of the process, which may not have a free entry
+	pid_t pid=getpid();
+	int pin=-1;
+	for(int j=0; j<MAXPINS; j++) {
+		if(slot->pins[j].refs && slot->pins[j].pid==pid) {
+			pin=j;
+			break;
+		}
+		if(!slot->pins[j].refs && pin<0) pin=j;
+	}
+	if(pin<0) {
+		unlock(cache);
+		return 0;
+	}
+	slot->pins[pin].pid=pid;
+	slot->pins[pin].refs++;
+	slot->refs++;
+	slot->referenced=1;
+	ref->cache=cache;
+	ref->slot=i;
+	ref->pin=pin;
+	ref->head=cache->data+slot->page*PAGE;
+	ref->headlen=slot->headlen;
+	ref->body=ref->head+slot->headlen;
+	ref->bodylen=slot->bodylen;
+	ref->etag=slot->etag;
+	ref->modified=slot->modified;
+	unlock(cache);
+	return 1;
+}
+
+int cache_insert(cache_t* cache, int dir, const char* path, int variant, const cachedep_t* deps, int ndeps, int fd, const struct stat* st, const char* etag, time_t modified, const char* head, size_t headlen) {
+	if(!cache || strlen(path)>=MAXPATH || strlen(etag)>=MAXETAG || ndeps>CACHE_MAXDEPS) return -1;
+	for(int i=0; i<ndeps; i++) {
+		if(strlen(deps[i].path)>=MAXPATH) return -1;
+	}
+	if(!S_ISREG(st->st_mode) || st->st_size>SERVER_CACHEMAXFILE) return -1;
+	size_t n=(headlen+st->st_size+PAGE-1)/PAGE;
+	if(n>cache->npages) return -1;
+	uint64_t hash=hashKey(dir, path, variant);
+
+	// reserve a slot and pages, which no one else sees until they are filled
+	lock(cache);
+	if(find(cache, dir, path, variant, hash)>=0) {
+		unlock(cache);
+		return 0;
+	}
+	int i;
+	for(;;) {
+		for(i=0; i<cache->nslots && cache->slots[i].state!=SLOT_FREE; i++);
+		if(i<cache->nslots) break;
+		if(!evict(cache)) {
+			unlock(cache);
+			return -1;
+		}
+	}
+	ssize_t page;
+	while((page=findPages(cache, n))<0) {
+		if(!evict(cache)) {
+			unlock(cache);
+			return -1;
+		}
+	}
+	markPages(cache, page, n, 1);
+	slot_t* slot=cache->slots+i;
+	slot->state=SLOT_FILLING;
+	slot->owner=getpid();
+	slot->refs=0;
+	memset(slot->pins, 0, sizeof(slot->pins));
+	slot->referenced=0;
+	slot->hash=hash;
+	slot->dir=dir;
+	slot->variant=variant;
+	strcpy(slot->path, path);
+	slot->ndeps=ndeps;
+	for(int j=0; j<ndeps; j++) {
+		strcpy(slot->deps[j].path, deps[j].path);
+		setDep(slot->deps+j, deps[j].st);
+	}
+	slot->checked=now();
+	strcpy(slot->etag, etag);
+	slot->modified=modified;
+	slot->page=page;
+	slot->npages=n;
+	slot->headlen=headlen;
+	slot->bodylen=st->st_size;
+	unlock(cache);
+
+	// fill them without holding the lock
+	char* data=cache->data+page*PAGE;
+	memcpy(data, head, headlen);
+	size_t off=0;
+	while(off<slot->bodylen) {
+		ssize_t a=pread(fd, data+headlen+off, slot->bodylen-off, off);
+		if(a<0 && errno==EINTR) continue;
+		if(a<=0) break;
+		off+=a;
+	}
+
+	lock(cache);
+	if(off<slot->bodylen || find(cache, dir, path, variant, hash)>=0) {
+		freeSlot(cache, i);
+		unlock(cache);
+		return off<slot->bodylen?-1:0;
+	}
+	slot->state=SLOT_USED;
+	int* bucket=cache->buckets+(hash&(cache->nbuckets-1));
+	slot->next=*bucket;
+	*bucket=i;
+	unlock(cache);
+	return 0;
+}
+
+void cache_release(cacheref_t* ref) {
+	cache_t* cache=ref->cache;
+	if(!cache) return;
+	ref->cache=NULL;
+
+	lock(cache);
+	slot_t* slot=cache->slots+ref->slot;
+	pin_t* pin=slot->pins+ref->pin;
+	if(pin->refs && pin->pid==getpid()) {
+		pin->refs--;
+		if(!--slot->refs && slot->state==SLOT_STALE) freeSlot(cache, ref->slot);
+	}
+	unlock(cache);
+}
@@ -0,0 +1,89 @@
+#ifndef _CACHE_H
+#define _CACHE_H
+
+#include <stddef.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**
+ * represents a cache of static responses, shared by all the processes forked after its creation
+ */
+typedef struct cache_t cache_t;
+
+/**
+ * represents a file a cached response was built from, checked to know if the response is still valid
+ */
+typedef struct {
+	const char* path; // relative to the directory of the response
+	const struct stat* st; // the state of the file, or NULL if it didn't exist
+} cachedep_t;
+
+/**
+ * the maximum number of files a cached response can depend on
+ */
+#define CACHE_MAXDEPS 4
+
+/**
+ * represents a cached response pinned in memory while it is being sent
+ */
+typedef struct {
+	cache_t* cache; // NULL if nothing is pinned
+	int slot;
+	int pin; // the entry of the pins of the slot which holds this one
+	const char* head; // the status line and headers of the response, without the terminating empty line
+	size_t headlen;
+	const char* body;
+	size_t bodylen;
+	const char* etag; // the validators of the response
+	time_t modified;
+} cacheref_t;
+
+/**
+ * creates a cache in shared memory
+ * @param size, the byte budget of the cached responses
+ * @param entries, the maximum number of cached responses
+ * @returns the cache, or NULL on error
+ * @remark the cache is only shared with processes forked after it was created
+ */
+cache_t* cache_create(size_t size, int entries);
+
+/**
+ * finds and pins a cached response
+ * @param cache, or NULL
+ * @param dir, the directory fd the path is relative to
+ * @param path, as requested
+ * @param variant, which tells apart the responses to a path, such as the encodings accepted by the client
+ * @param ref, filled with the response
+ * @returns 1 on a hit, 0 on a miss
+ * @remark the files the response was built from are checked at most every `SERVER_CACHEREVALIDATE` seconds, and the response is dropped if one of them changed
+ * @remark a hit must be released with `cache_release` once sent
+ * @remark the pins of processes which die, and the slots they were filling, are reclaimed once the cache runs out of room
+ */
+int cache_lookup(cache_t* cache, int dir, const char* path, int variant, cacheref_t* ref);
+
+/**
+ * caches the response for a file, evicting the least recently used responses if needed
+ * @param cache, or NULL
+ * @param dir, the directory fd the path is relative to
+ * @param path, as requested
+ * @param variant
+ * @param deps, the files the response depends on, including its body
+ * @param ndeps, at most `CACHE_MAXDEPS`
+ * @param fd, the open body, whose offset isn't changed
+ * @param st, the result of `fstat` on the fd
+ * @param etag, the entity tag of the response
+ * @param modified, the modification time of the response
+ * @param head, the status line and headers of the response, without the terminating empty line
+ * @param headlen
+ * @returns 0 on success, -1 if the response wasn't cached
+ */
+int cache_insert(cache_t* cache, int dir, const char* path, int variant, const cachedep_t* deps, int ndeps, int fd, const struct stat* st, const char* etag, time_t modified, const char* head, size_t headlen);
+
+/**
+ * unpins a cached response
+ * @param ref, which may not be pinned
+ */
+void cache_release(cacheref_t* ref);
+
+#endif
@@ -1,46 +1,155 @@
+#define _GNU_SOURCE
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <unistd.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <signal.h>
 
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#include <sys/socket.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
 
 #include "cgi.h"
+#include "fcgi.h"
 #include "http.h"
 
 extern char** environ;
 
 
-static int readline(int fd, char* buf, int len) {
-	while(len) {
-		int a=read(fd, buf, 1);
-		if(a<0) return 0;
-		else if(a==0) break;
-		if(*buf!='\r') buf++;
-		if(*buf=='\n') break;
-		len--;
+/**
+ * reaps the scripts which exited, so that they don't linger as zombies
+ * @param sig
+ */
+static void reap(int sig) {
+	(void)(sig);
+	int err=errno;
+	while(waitpid(-1, NULL, WNOHANG)>0);
+	errno=err;
+}
+
+/**
+ * installs the handler reaping the scripts, once per process
+ * @returns 0 on success, -1 on error
+ */
+static int reapAsync(void) {
+	static int installed;
+	if(installed) return 0;
+	struct sigaction sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sa_handler=reap;
+	sa.sa_flags=SA_RESTART|SA_NOCLDSTOP;
+	sigemptyset(&sa.sa_mask);
+	if(sigaction(SIGCHLD, &sa, NULL)) return -1;
+	installed=1;
+	return 0;
+}
+
+ssize_t cgi_parseHeaders(res_t* res, char* buf, size_t len) {
+	// the head ends with an empty line
+	size_t end=0;
+	for(size_t i=0, start=0; i<len && !end; i++) {
+		if(buf[i]!='\n') continue;
+		if(i==start || (i==start+1 && buf[start]=='\r')) end=i+1;
+		start=i+1;
+	}
+	if(!end) return 0;
+
+	int status=0;
+	char* line=buf;
+	while(line<buf+end) {
+		char* eol=memchr(line, '\n', buf+end-line);
+		char* next=eol+1;
+		if(eol>line && eol[-1]=='\r') eol--;
+		*eol='\0';
+		char* colon=strchr(line, ':');
+		if(colon && colon>line) {
+			*colon='\0';
+			char* value=colon+1;
+			while(*value==' ' || *value=='\t') value++;
+			if(!strcasecmp(line, "Status")) status=atoi(value);
+			else http_setHeader(res->headers, line, value);
+		} else if(*line) {
+			fprintf(stderr, "cgi: ignoring malformed header line\n");
+		}
+		line=next;
+	}
+	if(status>=100 && status<600) res->status=status;
+	else if(http_getHeader(res->headers, "Location")) res->status=302;
+	return end;
+}
+
+int cgi_variables(req_t* req, const char* script, const char* qs, const char* length, int (*visit)(void* udata, const char* name, const char* value), void* udata) {
+	char addr[INET6_ADDRSTRLEN]="";
+	const struct sockaddr* peer=req->peer;
+	if(peer && peer->sa_family==AF_INET6) inet_ntop(AF_INET6, &((const struct sockaddr_in6*) peer)->sin6_addr, addr, sizeof(addr));
+	else if(peer && peer->sa_family==AF_INET) inet_ntop(AF_INET, &((const struct sockaddr_in*) peer)->sin_addr, addr, sizeof(addr));
+	char* uri=qs?arena_alloc(req->arena, strlen(req->realurl)+strlen(qs)+2):req->realurl;
+	if(!uri) return -1;
+	if(qs) sprintf(uri, "%s?%s", req->realurl, qs);
+
+	const char* vars[][2]={
+		{"GATEWAY_INTERFACE", "CGI/1.1"},
+		{"SERVER_SOFTWARE", "Custom HTTP"},
+		{"SERVER_PROTOCOL", req->version>=11?"HTTP/1.1":"HTTP/1.0"},
+		{"REQUEST_METHOD", http_methodName(req->method)},
+		{"REQUEST_URI", uri},
+		{"SCRIPT_NAME", req->realurl},
+		{"SCRIPT_FILENAME", script},
+		{"QUERY_STRING", qs?qs:""},
+		{"REMOTE_ADDR", addr},
+		{"REDIRECT_STATUS", "200"} // php refuses to run scripts which weren't given to it by a server otherwise
+	};
+	for(size_t i=0; i<sizeof(vars)/sizeof(*vars); i++) {
+		if(visit(udata, vars[i][0], vars[i][1])) return -1;
+	}
+	if(length && visit(udata, "CONTENT_LENGTH", length)) return -1;
+
+	headers_t* headers=req->headers;
+	for(int i=0; i<headers->count; i++) {
+		header_t* h=headers->table+i;
+		if(h->id==HDR_CONTENT_LENGTH || h->id==HDR_TRANSFER_ENCODING) continue;
+		char name[5+SERVER_MAXHEAD+1];
+		size_t len=0;
+		if(h->id!=HDR_CONTENT_TYPE) {
+			memcpy(name, "HTTP_", 5);
+			len=5;
+		}
+		for(size_t j=0; j<h->namelen && len<sizeof(name)-1; j++) {
+			char c=h->name[j];
+			name[len++]=c=='-'?'_':(c>='a' && c<='z')?c-'a'+'A':c;
+		}
+		name[len]='\0';
+		if(visit(udata, name, h->value)) return -1;
 	}
-	*buf=0;
-	return 1;
+	return 0;
+}
+
+/**
+ * sets a variable of the environment of a script
+ * @param udata, unused
+ * @param name
+ * @param value
+ * @returns 0 on success, -1 on error
+ */
+static int putEnv(void* udata, const char* name, const char* value) {
+	(void)(udata);
+	return setenv(name, value, 1);
 }
 
 int cgi_php(req_t* req, res_t* res, void* data) {
 	int dfd=(int) (intptr_t) data;
 
-	// parse the url and querystring
-	char urlbuf[1024];
-	strncpy(urlbuf, req->url, sizeof(urlbuf)-1);
-	char* url=urlbuf;
-	char* qs=strrchr(req->url, '?');
-	if(qs) {
-		url[qs-req->url]=0;
-		qs++;
-	}
+	// the query string was split from the path when the request was parsed
+	char* url=req->url;
+	char* qs=req->query;
 	if(*url=='/') url++;
 	if(strstr(url, "..")) {
 		http_res_error(res, 400);
@@ -75,10 +184,23 @@ int cgi_php(req_t* req, res_t* res, void* data) {
 	path[t]=0;
 	close(fd);
 
-	// make a pipe
+	// the body is read whole before the script runs, so that it can be given to either interpreter
+	int body=-1;
+	size_t bodylen=0;
+	if(req->body && (body=http_bodyFd(req->body, &bodylen))<0) {
+		if(errno!=EFBIG && errno!=EPROTO && errno!=ETIMEDOUT) perror("http_bodyFd()");
+		http_res_error(res, http_bodyStatus(errno));
+		return 0;
+	}
+
+	// a FastCGI server spares the startup of an interpreter per request
+	if(!fcgi_handle(req, res, path, qs, body, bodylen)) return 0;
+
+	// make a pipe, which no other child may inherit, or its end of file would never come
 	int pipefd[2];
-	if(pipe(pipefd)) {
-		perror("pipe()");
+	if(reapAsync() || pipe2(pipefd, O_CLOEXEC)) {
+		perror("pipe2()");
+		if(body>=0) close(body);
 		http_res_error(res, 500);
 		return 0;
 	}
@@ -88,34 +210,31 @@ int cgi_php(req_t* req, res_t* res, void* data) {
 	if(pid<0 && errno==EAGAIN) pid=fork();
 	if(pid<0) {
 		perror("fork()");
+		close(pipefd[0]);
+		close(pipefd[1]);
+		if(body>=0) close(body);
 		http_res_error(res, 500);
 		return 0;
 	} else if(pid==0) {
-		close(pipefd[0]);
+		int in=body>=0?body:open("/dev/null", O_RDONLY);
+		if(in>=0) dup2(in, 0);
 		dup2(pipefd[1], 1);
+		// php-cgi runs the script the environment names, and reads as much of its stdin as it says
+		char length[24];
+		snprintf(length, sizeof(length), "%zu", bodylen);
+		if(cgi_variables(req, path, qs, body>=0?length:NULL, putEnv, NULL)) _exit(127);
 		char* argv[]={
 			"env",
 			"php-cgi",
-			path,
-			"--",
-			qs,
 			NULL
 		};
 		execve("/usr/bin/env", argv, environ);
-		exit(0);
-	} else {
-		close(pipefd[1]);
-		wait(NULL);
-
-		char line[10240];
-		while(readline(pipefd[0], line, sizeof(line)-1)) {
-			if(!*line) break;
-			char* delim=strstr(line, ": ");
-			*delim=0;
-			char* value=delim+2;
-			http_setHeader(res->headers, line, value);
-		}
-		http_res_pipe(res, pipefd[0]);
-		return 0;
+		_exit(127);
 	}
+	close(pipefd[1]);
+	if(body>=0) close(body);
+
+	// the output, headers first, is read when the response is framed, while the script runs, as it would block on a full pipe otherwise
+	http_res_pipeHead(res, pipefd[0], cgi_parseHeaders);
+	return 0;
 }
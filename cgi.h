@@ -1,10 +1,35 @@
 #ifndef _CGI_H
 #define _CGI_H
 
+#include <sys/types.h>
+
 #include "http.h"
 
 /**
- * handles a request and response using a PHP CGI
+ * parses the CGI headers which precede the output of a script, if they are complete
+ * @param res, whose status and headers are set from them
+ * @param buf, the start of the output, modified in place
+ * @param len
+ * @returns the length of the head, including the empty line which ends it, or 0 if it isn't complete yet
+ * @remark a `Status` header sets the status of the response, which is a 302 if there is a `Location` but no status
+ */
+ssize_t cgi_parseHeaders(res_t* res, char* buf, size_t len);
+
+/**
+ * gives the CGI meta-variables of a request, with which scripts are run
+ * headers become HTTP_ variables, except those which have their own, and the framing of the body, which was decoded
+ * @param req
+ * @param script, the absolute path of the script
+ * @param qs, the query string, or NULL
+ * @param length, the length of the body, or NULL if the request has none
+ * @param visit, called with each name and value, returning 0 to go on
+ * @param udata, given to `visit`
+ * @returns 0 on success, -1 on error or as soon as `visit` fails
+ */
+int cgi_variables(req_t* req, const char* script, const char* qs, const char* length, int (*visit)(void* udata, const char* name, const char* value), void* udata);
+
+/**
+ * handles a request and response using PHP, by FastCGI if `SERVER_FCGI` is reachable, or by forking php-cgi otherwise
  * @param req
  * @param res
  * @param data, a fd to the CGI directory
@@ -0,0 +1,184 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdint.h>
+
+#include "compress.h"
+#include "config.h"
+
+/**
+ * represents a memoized compression result
+ */
+typedef struct {
+	uint64_t hash[2]; // two independent hashes of the content
+	size_t len; // the length of the content
+	int encoding;
+	int referenced; // the CLOCK bit, set on every hit
+	char* data; // the content followed by its compressed form, NULL if the slot is free
+	size_t datalen; // the length of the compressed form
+} memo_t;
+
+/**
+ * the memoized results, the bytes they use, and the CLOCK hand
+ */
+static memo_t memos[SERVER_COMPRESSMEMOENTRIES];
+static size_t memoBytes;
+static int memoHand;
+
+const char* compress_name(int encoding) {
+	return encoding==COMPRESS_GZIP?"gzip":"deflate";
+}
+
+int compress_eligible(const char* type) {
+	if(!type) return 0;
+	size_t len=strcspn(type, "; \t");
+	const char* list=SERVER_COMPRESSTYPES;
+	while(*list) {
+		while(*list==',' || *list==' ') list++;
+		size_t tlen=strcspn(list, ", ");
+		if(tlen && list[tlen-1]=='*') { // a wildcard subtype
+			if(len>=tlen-1 && !strncasecmp(type, list, tlen-1)) return 1;
+		} else if(tlen==len && !strncasecmp(type, list, len)) {
+			return 1;
+		}
+		list+=tlen;
+	}
+	return 0;
+}
+
+int compress_init(compressor_t* c, int encoding) {
+	memset(&c->z, 0, sizeof(c->z));
+	// window bits above 15 ask zlib for a gzip wrapper rather than a zlib one
+	int bits=encoding==COMPRESS_GZIP?15+16:15;
+	return deflateInit2(&c->z, SERVER_COMPRESSLEVEL, Z_DEFLATED, bits, 8, Z_DEFAULT_STRATEGY)==Z_OK?0:-1;
+}
+
+int compress_update(compressor_t* c, const char* in, size_t len, int flush, char** out, size_t* outlen, size_t* outcap) {
+	c->z.next_in=(Bytef*) in;
+	c->z.avail_in=len;
+	for(;;) {
+		if(*outcap-*outlen<1024) {
+			size_t cap=*outcap?*outcap*2:deflateBound(&c->z, len)+64;
+			char* buf=realloc(*out, cap);
+			if(!buf) return -1;
+			*out=buf;
+			*outcap=cap;
+		}
+		c->z.next_out=(Bytef*) *out+*outlen;
+		c->z.avail_out=*outcap-*outlen;
+		int rst=deflate(&c->z, flush==COMPRESS_FINISH?Z_FINISH:flush==COMPRESS_SYNC?Z_SYNC_FLUSH:Z_NO_FLUSH);
+		*outlen=*outcap-c->z.avail_out;
+		if(rst==Z_STREAM_END) return 0;
+		if(rst!=Z_OK && rst!=Z_BUF_ERROR) return -1;
+		if(flush!=COMPRESS_FINISH && !c->z.avail_in && c->z.avail_out) return 0;
+	}
+}
+
+void compress_end(compressor_t* c) {
+	deflateEnd(&c->z);
+}
+
+/**
+ * hashes some content twice, with independent functions
+ * @param in
+ * @param len
+ * @param hash, set to the hashes
+ */
+static void hashContent(const char* in, size_t len, uint64_t* hash) {
+	uint64_t a=0xcbf29ce484222325ull;
+	uint64_t b=0x9e3779b97f4a7c15ull^len;
+	size_t i=0;
+	for(; i+8<=len; i+=8) {
+		uint64_t w;
+		memcpy(&w, in+i, 8);
+		a=(a^w)*0x100000001b3ull;
+		b=(b^w)*0xff51afd7ed558ccdull;
+		b^=b>>32;
+	}
+	for(; i<len; i++) {
+		a=(a^(unsigned char) in[i])*0x100000001b3ull;
+		b=(b^(unsigned char) in[i])*0xc4ceb9fe1a85ec53ull;
+	}
+	hash[0]=a^(a>>29);
+	hash[1]=b^(b>>31);
+}
+
+/**
+ * frees a memoized result
+ * @param memo
+ */
+static void forget(memo_t* memo) {
+	memoBytes-=memo->len+memo->datalen;
+	free(memo->data);
+	memo->data=NULL;
+}
+
+/**
+ * remembers a compression result along with its content, evicting the results which weren't used lately to make room
+ * @param hash
+ * @param in, the content
+ * @param len
+ * @param encoding
+ * @param data
+ * @param datalen
+ */
+static void memoize(const uint64_t* hash, const char* in, size_t len, int encoding, const char* data, size_t datalen) {
+	size_t size=len+datalen;
+	if(size>SERVER_COMPRESSMEMO/4) return;
+	memo_t* memo=memos+hash[0]%SERVER_COMPRESSMEMOENTRIES;
+	if(memo->data) forget(memo);
+	for(int n=0; memoBytes+size>SERVER_COMPRESSMEMO && n<2*SERVER_COMPRESSMEMOENTRIES; n++) {
+		memo_t* victim=memos+memoHand;
+		memoHand=(memoHand+1)%SERVER_COMPRESSMEMOENTRIES;
+		if(!victim->data) continue;
+		if(victim->referenced) victim->referenced=0;
+		else forget(victim);
+	}
+	if(memoBytes+size>SERVER_COMPRESSMEMO) return;
+
+	memo->data=malloc(size);
+	if(!memo->data) return;
+	memcpy(memo->data, in, len);
+	memcpy(memo->data+len, data, datalen);
+	memo->datalen=datalen;
+	memo->hash[0]=hash[0];
+	memo->hash[1]=hash[1];
+	memo->len=len;
+	memo->encoding=encoding;
+	memo->referenced=0;
+	memoBytes+=size;
+}
+
+int compress_buffer(int encoding, const char* in, size_t len, int memo, char** out, size_t* outlen) {
+	uint64_t hash[2];
+	if(memo) {
+		hashContent(in, len, hash);
+		memo_t* m=memos+hash[0]%SERVER_COMPRESSMEMOENTRIES;
+		// the hashes only rule out other contents quickly, as contents can be crafted to share them
+		if(m->data && m->hash[0]==hash[0] && m->hash[1]==hash[1] && m->len==len && m->encoding==encoding && !memcmp(m->data, in, len)) {
+			*out=malloc(m->datalen);
+			if(!*out) return -1;
+			memcpy(*out, m->data+len, m->datalen);
+			*outlen=m->datalen;
+			m->referenced=1;
+			return 0;
+		}
+	}
+
+	compressor_t c;
+	if(compress_init(&c, encoding)) return -1;
+	char* buf=NULL;
+	size_t buflen=0;
+	size_t bufcap=0;
+	int rst=compress_update(&c, in, len, COMPRESS_FINISH, &buf, &buflen, &bufcap);
+	compress_end(&c);
+	if(rst) {
+		free(buf);
+		return -1;
+	}
+
+	if(memo) memoize(hash, in, len, encoding, buf, buflen);
+	*out=buf;
+	*outlen=buflen;
+	return 0;
+}
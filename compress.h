@@ -0,0 +1,83 @@
+#ifndef _COMPRESS_H
+#define _COMPRESS_H
+
+#include <stddef.h>
+
+#include <zlib.h>
+
+/**
+ * the encodings responses can be compressed with on the fly
+ */
+#define COMPRESS_NONE 0
+#define COMPRESS_GZIP 1
+#define COMPRESS_DEFLATE 2
+
+/**
+ * how much of its input a streaming compressor outputs
+ */
+#define COMPRESS_MORE 0 // as much as it sees fit, more input follows
+#define COMPRESS_FINISH 1 // everything, this is the end of the stream
+#define COMPRESS_SYNC 2 // everything, so that the output so far can be decompressed, though more input follows
+
+/**
+ * represents a streaming compressor
+ */
+typedef struct {
+	z_stream z;
+} compressor_t;
+
+/**
+ * gets the name of an encoding, as used in Content-Encoding
+ * @param encoding, not `COMPRESS_NONE`
+ * @returns the name
+ */
+const char* compress_name(int encoding);
+
+/**
+ * checks if a content type is worth compressing
+ * @param type, the value of a Content-Type header, or NULL
+ * @returns 1 if it is one of `SERVER_COMPRESSTYPES`, 0 otherwise
+ */
+int compress_eligible(const char* type);
+
+/**
+ * initializes a streaming compressor
+ * @param c
+ * @param encoding, not `COMPRESS_NONE`
+ * @returns 0 on success, -1 on error
+ */
+int compress_init(compressor_t* c, int encoding);
+
+/**
+ * compresses some data, appending the output to a growable buffer
+ * @param c
+ * @param in
+ * @param len
+ * @param flush, `COMPRESS_MORE`, `COMPRESS_FINISH` or `COMPRESS_SYNC`
+ * @param out, the buffer, realloc'd as needed
+ * @param outlen, its length
+ * @param outcap, its capacity
+ * @returns 0 on success, -1 on error
+ */
+int compress_update(compressor_t* c, const char* in, size_t len, int flush, char** out, size_t* outlen, size_t* outcap);
+
+/**
+ * frees the state of a streaming compressor
+ * @param c
+ */
+void compress_end(compressor_t* c);
+
+/**
+ * compresses a whole buffer
+ * @param encoding, not `COMPRESS_NONE`
+ * @param in
+ * @param len
+ * @param memoize, 1 to remember the result, so that the same content is never compressed twice
+ * @param out, set to the compressed data, to be freed by the caller
+ * @param outlen, set to its length
+ * @returns 0 on success, -1 on error
+ * @remark memoized results are kept per process with their content, which is compared on a hit, within `SERVER_COMPRESSMEMO` bytes
+ */
+int compress_buffer(int encoding, const char* in, size_t len, int memoize, char** out, size_t* outlen);
+
+#endif
@@ -9,6 +9,90 @@
 #define LISTEN_BACKLOG 128
 #endif
 
+#ifndef SERVER_WORKERS
+#define SERVER_WORKERS 4 // 0 to fork a process per connection
+#endif
+
+#ifndef SERVER_EVENTLOOP
+#define SERVER_EVENTLOOP 0 // 1 to multiplex clients with epoll in each worker, 2 with io_uring
+#endif
+
+#ifndef SERVER_MAXHEAD
+#define SERVER_MAXHEAD 8192
+#endif
+
+#ifndef SERVER_MAXURL
+#define SERVER_MAXURL 4096
+#endif
+
+#ifndef SERVER_MAXHEADERS
+#define SERVER_MAXHEADERS 64
+#endif
+
+#ifndef SERVER_MAXPARAMS
+#define SERVER_MAXPARAMS 8 // route parameters per request
+#endif
+
+#ifndef SERVER_MAXMATCHES
+#define SERVER_MAXMATCHES 8 // routes tried per request
+#endif
+
+#ifndef SERVER_MAXRANGES
+#define SERVER_MAXRANGES 16 // byte ranges served per request, more are answered with the whole file
+#endif
+
+#ifndef SERVER_ARENA
+#define SERVER_ARENA 16384 // bytes allocated per connection for its requests
+#endif
+
+#ifndef SERVER_KEEPALIVE_TIMEOUT
+#define SERVER_KEEPALIVE_TIMEOUT 5 // seconds
+#endif
+
+#ifndef SERVER_KEEPALIVE_MAX
+#define SERVER_KEEPALIVE_MAX 100 // requests per connection
+#endif
+
+#ifndef SERVER_MAXEVENTS
+#define SERVER_MAXEVENTS 256
+#endif
+
+#ifndef SERVER_URINGENTRIES
+#define SERVER_URINGENTRIES 256 // entries of the submission queue of each io_uring worker
+#endif
+
+#ifndef SERVER_MAXBODY
+#define SERVER_MAXBODY 67108864 // bytes, longer request bodies are refused with a 413
+#endif
+
+#ifndef SERVER_BODYMEM
+#define SERVER_BODYMEM 1048576 // bytes of a request body kept in memory, longer ones are spilled to a file
+#endif
+
+#ifndef SERVER_BODYSKIP
+#define SERVER_BODYSKIP 65536 // bytes of a request body discarded to keep the connection open, when handlers don't read it
+#endif
+
+#ifndef SERVER_BODYTIMEOUT
+#define SERVER_BODYTIMEOUT 60 // seconds a client may take to send a request body, however steadily, before it is answered with a 408
+#endif
+
+#ifndef SERVER_TMPDIR
+#define SERVER_TMPDIR "/tmp" // where long request bodies are spilled
+#endif
+
+#ifndef SERVER_PIPEBUF
+#define SERVER_PIPEBUF 65536
+#endif
+
+#ifndef SERVER_STREAMBUF
+#define SERVER_STREAMBUF 262144 // bytes of a body of unknown length buffered to measure it, longer ones are streamed chunked
+#endif
+
+#ifndef SERVER_PIPETIMEOUT
+#define SERVER_PIPETIMEOUT 30 // seconds the producer of a body of unknown length, such as a script, may stay silent before its response is given up
+#endif
+
 #ifndef SERVER_ROOT
 #define SERVER_ROOT "public"
 #endif
@@ -17,6 +101,42 @@
 #define SERVER_CGI_ROOT "cgi"
 #endif
 
+#ifndef SERVER_FCGI
+#define SERVER_FCGI "/run/php/php-fpm.sock" // the unix socket of the FastCGI server running PHP, "" to always fork php-cgi
+#endif
+
+#ifndef SERVER_FCGIPOOL
+#define SERVER_FCGIPOOL 8 // FastCGI connections kept open per process
+#endif
+
+#ifndef SERVER_METRICS
+#define SERVER_METRICS "" // the route serving the metrics to any client, such as "/_metrics", "" to leave them unserved
+#endif
+
+#ifndef SERVER_METRICSROUTES
+#define SERVER_METRICSROUTES 32 // routes with their own metrics, the others are counted as unrouted
+#endif
+
+#ifndef SERVER_METRICSSERIES
+#define SERVER_METRICSSERIES 1024 // combinations of route, method and status counted
+#endif
+
+#ifndef SERVER_LOGFORMAT
+#define SERVER_LOGFORMAT "%a [%t] \"%m %U\" %s %b %D" // %a client, %t time, %m method, %U url, %s status, %b bytes, %D microseconds
+#endif
+
+#ifndef SERVER_LOGRING
+#define SERVER_LOGRING 8192 // access log records waiting for the logger, more are dropped
+#endif
+
+#ifndef SERVER_LOGINTERVAL
+#define SERVER_LOGINTERVAL 20 // milliseconds between batches of the access log
+#endif
+
+#ifndef SERVER_LOGBUF
+#define SERVER_LOGBUF 65536 // bytes of the access log written at once
+#endif
+
 #ifndef SERVER_ERR
 #define SERVER_ERR "errdocs/%d.html"
 #endif
@@ -39,4 +159,56 @@
 #define SERVER_INDEX "index.html"
 #endif
 
+#ifndef SERVER_CACHESIZE
+#define SERVER_CACHESIZE 16777216 // bytes of static responses kept in memory, 0 to disable the cache
+#endif
+
+#ifndef SERVER_CACHEENTRIES
+#define SERVER_CACHEENTRIES 1024
+#endif
+
+#ifndef SERVER_CACHEMAXFILE
+#define SERVER_CACHEMAXFILE 1048576 // bytes, larger files are always sent from disk
+#endif
+
+#ifndef SERVER_CACHEREVALIDATE
+#define SERVER_CACHEREVALIDATE 1 // seconds between checks of cached files for changes
+#endif
+
+#ifndef SERVER_COMPRESSTYPES
+#define SERVER_COMPRESSTYPES "text/*, application/json, application/javascript, application/xml, image/svg+xml"
+#endif
+
+#ifndef SERVER_COMPRESSMIN
+#define SERVER_COMPRESSMIN 128 // bytes, smaller bodies are sent as they are
+#endif
+
+#ifndef SERVER_COMPRESSLEVEL
+#define SERVER_COMPRESSLEVEL 6
+#endif
+
+#ifndef SERVER_COMPRESSMEMO
+#define SERVER_COMPRESSMEMO 4194304 // bytes of bodies and of their compressed forms remembered by each worker
+#endif
+
+#ifndef SERVER_COMPRESSMEMOENTRIES
+#define SERVER_COMPRESSMEMOENTRIES 256
+#endif
+
+#ifndef SERVER_MIMEDEFAULT
+#define SERVER_MIMEDEFAULT "application/octet-stream"
+#endif
+
+#ifndef SERVER_MIMECACHE
+#define SERVER_MIMECACHE 1024 // files whose type is remembered
+#endif
+
+#ifndef SERVER_MIMEOVERRIDES
+#define SERVER_MIMEOVERRIDES 16
+#endif
+
+#ifndef SERVER_MIMESNIFF
+#define SERVER_MIMESNIFF 512 // bytes read to guess the type of files without a known extension
+#endif
+
 #endif
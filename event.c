@@ -0,0 +1,352 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+
+#include "event.h"
+#include "http.h"
+#include "metrics.h"
+#include "parser.h"
+#include "arena.h"
+#include "config.h"
+
+/**
+ * represents the state of a connection
+ */
+typedef enum {
+	CONN_READ, CONN_HANDLE, CONN_WRITE
+} connstate_t;
+
+typedef struct conn_t conn_t;
+
+/**
+ * represents a list of connections, least recently active first
+ */
+typedef struct {
+	conn_t* first;
+	conn_t* last;
+	time_t timeout; // seconds after which idle connections are closed
+} connlist_t;
+
+/**
+ * represents a client connection
+ * only one fd of a connection is registered at a time, so that it gets at most one event per wait
+ */
+typedef struct conn_t {
+	int fd;
+	connstate_t state;
+	int waitfd; // the registered fd: the socket, or the body fd of the response, -1 if none is
+	uint32_t events;
+	int eof;
+	int served;
+	res_t* res;
+	arena_t* arena;
+	parser_t parser;
+	time_t lastActive;
+	connlist_t* list; // the activity list the connection is in, or NULL
+	conn_t* prev;
+	conn_t* next;
+	struct sockaddr_storage peer; // the address of the client, captured at accept
+	size_t inlen;
+	char in[SERVER_MAXHEAD+1]; // one more byte than the longest head, so that too long heads are detected by the parser
+} conn_t;
+
+/**
+ * the epoll instance of the loop
+ */
+static int epfd;
+
+/**
+ * the connections waiting for their clients, and those waiting for the body of their response
+ */
+static connlist_t clients={NULL, NULL, SERVER_KEEPALIVE_TIMEOUT};
+static connlist_t bodies={NULL, NULL, SERVER_PIPETIMEOUT};
+
+/**
+ * returns the current time of a monotonic clock
+ * @returns a time in seconds
+ */
+static time_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/**
+ * removes a connection from its activity list
+ * @param conn
+ */
+static void connUnlink(conn_t* conn) {
+	connlist_t* list=conn->list;
+	if(!list) return;
+	if(conn->prev) conn->prev->next=conn->next;
+	else list->first=conn->next;
+	if(conn->next) conn->next->prev=conn->prev;
+	else list->last=conn->prev;
+	conn->prev=conn->next=NULL;
+	conn->list=NULL;
+}
+
+/**
+ * marks a connection as active, moving it to the end of the activity list of what it waits for
+ * @param conn
+ */
+static void connTouch(conn_t* conn) {
+	connlist_t* list=conn->waitfd==conn->fd?&clients:&bodies;
+	if(list->last!=conn) {
+		connUnlink(conn);
+		conn->prev=list->last;
+		if(list->last) list->last->next=conn;
+		else list->first=conn;
+		list->last=conn;
+		conn->list=list;
+	}
+	conn->lastActive=now();
+}
+
+/**
+ * registers a newly accepted client
+ * @param fd, a non-blocking client socket
+ * @param peer, the address of the client
+ * @param peerlen
+ * @returns 0 on success, -1 on error
+ */
+static int connOpen(int fd, const struct sockaddr_storage* peer, socklen_t peerlen) {
+	conn_t* conn=malloc(sizeof(conn_t));
+	if(!conn) return -1;
+	conn->arena=arena_create(SERVER_ARENA);
+	if(!conn->arena) {
+		free(conn);
+		return -1;
+	}
+	conn->fd=fd;
+	memset(&conn->peer, 0, sizeof(conn->peer));
+	memcpy(&conn->peer, peer, peerlen<sizeof(conn->peer)?peerlen:sizeof(conn->peer));
+	conn->state=CONN_READ;
+	conn->waitfd=fd;
+	conn->events=EPOLLIN;
+	conn->eof=0;
+	conn->served=0;
+	conn->res=NULL;
+	parser_init(&conn->parser, NULL);
+	conn->list=NULL;
+	conn->prev=conn->next=NULL;
+	conn->inlen=0;
+
+	struct epoll_event ev={.events=conn->events, .data.ptr=conn};
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) {
+		arena_destroy(conn->arena);
+		free(conn);
+		return -1;
+	}
+	connTouch(conn);
+	metrics_connection(1);
+	return 0;
+}
+
+/**
+ * closes a connection and frees everything it owns
+ * @param conn
+ */
+static void connClose(conn_t* conn) {
+	connUnlink(conn);
+	// the body fd may outlive the response, as pooled FastCGI connections do, so it is unregistered before it is released
+	if(conn->waitfd>=0) epoll_ctl(epfd, EPOLL_CTL_DEL, conn->waitfd, NULL);
+	close(conn->fd);
+	http_destroyResponse(conn->res);
+	arena_destroy(conn->arena);
+	free(conn);
+	metrics_connection(-1);
+}
+
+/**
+ * closes the connections of a list which were idle for too long
+ * @param list
+ * @param t, the current time
+ */
+static void connExpire(connlist_t* list, time_t t) {
+	while(list->first && t-list->first->lastActive>=list->timeout) connClose(list->first);
+}
+
+/**
+ * sets the fd a connection waits for, and the events it waits for
+ * @param conn
+ * @param fd, the socket, or the body fd of the response
+ * @param events
+ * @returns 0 on success, -1 on error
+ */
+static int connWait(conn_t* conn, int fd, uint32_t events) {
+	if(conn->waitfd==fd && conn->events==events) return 0;
+	struct epoll_event ev={.events=events, .data.ptr=conn};
+	if(conn->waitfd==fd) {
+		if(epoll_ctl(epfd, EPOLL_CTL_MOD, fd, &ev)) return -1;
+	} else {
+		if(conn->waitfd>=0) epoll_ctl(epfd, EPOLL_CTL_DEL, conn->waitfd, NULL);
+		conn->waitfd=-1;
+		if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev)) return -1;
+		conn->waitfd=fd;
+	}
+	conn->events=events;
+	return 0;
+}
+
+/**
+ * makes a connection wait for the body fd of its response if it isn't ready, or for its socket otherwise
+ * @param conn, with a response
+ * @param events, what is waited for on the socket
+ * @returns 0 on success, -1 on error
+ */
+static int connSuspend(conn_t* conn, uint32_t events) {
+	if(conn->res->state&HTTP_RES_BODYWAIT) return connWait(conn, conn->res->bodyfd, conn->res->bodyevents); // poll events are epoll events
+	return connWait(conn, conn->fd, events);
+}
+
+/**
+ * reads what is available from the client
+ * @param conn
+ * @returns 0 on success, -1 on error
+ * @remark `eof` is set when the client has stopped sending
+ */
+static int connRead(conn_t* conn) {
+	while(conn->inlen<sizeof(conn->in)) {
+		ssize_t a=read(conn->fd, conn->in+conn->inlen, sizeof(conn->in)-conn->inlen);
+		if(a<0 && errno==EINTR) continue;
+		if(a<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) break;
+		if(a<0) return -1;
+		if(a==0) {
+			conn->eof=1;
+			break;
+		}
+		conn->inlen+=a;
+	}
+	return 0;
+}
+
+/**
+ * makes as much progress as possible on a connection without blocking
+ * requests are handled one at a time, in order, so pipelined requests are answered in order
+ * @param conn
+ * @returns 0 if the connection is waiting for its socket or the body fd of its response, -1 if it is to be closed
+ */
+static int connProcess(conn_t* conn) {
+	// the body fd may be released as the response goes on, so it is unregistered first
+	if(conn->waitfd>=0 && conn->waitfd!=conn->fd) {
+		epoll_ctl(epfd, EPOLL_CTL_DEL, conn->waitfd, NULL);
+		conn->waitfd=-1;
+	}
+
+	for(;;) {
+		if(conn->state==CONN_READ) {
+			if(parser_feed(&conn->parser, conn->in, conn->inlen)==PARSER_AGAIN) {
+				if(conn->eof || connRead(conn)) return -1;
+				if(parser_feed(&conn->parser, conn->in, conn->inlen)==PARSER_AGAIN) {
+					if(conn->eof) return -1;
+					return connWait(conn, conn->fd, EPOLLIN);
+				}
+			}
+
+			conn->res=http_begin(conn->fd, (struct sockaddr*) &conn->peer, conn->in, conn->inlen, &conn->parser, conn->arena, ++conn->served<SERVER_KEEPALIVE_MAX);
+			if(!conn->res) return -1;
+			conn->res->state|=HTTP_RES_NONBLOCK;
+			conn->state=CONN_HANDLE;
+		}
+
+		if(conn->state==CONN_HANDLE) {
+			int rst=http_continue(conn->res, &conn->parser);
+			if(rst<0) return -1;
+			if(rst==0) return connSuspend(conn, EPOLLIN);
+			conn->state=CONN_WRITE;
+		}
+
+		int rst=http_res_write(conn->res);
+		if(rst<0) return -1;
+		if(rst==0) return connSuspend(conn, EPOLLOUT);
+
+		int keep=conn->res->state&HTTP_RES_KEEPALIVE;
+		http_destroyResponse(conn->res);
+		conn->res=NULL;
+		arena_reset(conn->arena);
+		if(!keep) return -1;
+
+		// keep whatever the client pipelined after this request
+		memmove(conn->in, conn->in+conn->parser.pos, conn->inlen-conn->parser.pos);
+		conn->inlen-=conn->parser.pos;
+		parser_init(&conn->parser, NULL);
+		conn->state=CONN_READ;
+	}
+}
+
+/**
+ * accepts every pending client of the server socket
+ * @param fd, a non-blocking server socket
+ */
+static void acceptAll(int fd) {
+	for(;;) {
+		struct sockaddr_storage peer;
+		socklen_t peerlen=sizeof(peer);
+		int sock=accept4(fd, (struct sockaddr*) &peer, &peerlen, SOCK_NONBLOCK|SOCK_CLOEXEC);
+		if(sock<0) {
+			if(errno==EINTR || errno==ECONNABORTED) continue;
+			if(errno!=EAGAIN && errno!=EWOULDBLOCK) perror("accept4()");
+			return;
+		}
+		if(connOpen(sock, &peer, peerlen)) close(sock);
+	}
+}
+
+void event_loop(int fd) {
+	int flags=fcntl(fd, F_GETFL);
+	if(flags<0 || fcntl(fd, F_SETFL, flags|O_NONBLOCK)) {
+		perror("fcntl()");
+		exit(1);
+	}
+
+	epfd=epoll_create1(EPOLL_CLOEXEC);
+	if(epfd<0) {
+		perror("epoll_create1()");
+		exit(1);
+	}
+
+	// only wake one of the workers sharing the socket
+	struct epoll_event lev={.events=EPOLLIN|EPOLLEXCLUSIVE, .data.ptr=NULL};
+	if(epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &lev)) {
+		perror("epoll_ctl()");
+		exit(1);
+	}
+
+	struct epoll_event events[SERVER_MAXEVENTS];
+	for(;;) {
+		int n=epoll_wait(epfd, events, SERVER_MAXEVENTS, clients.first || bodies.first?1000:-1);
+		if(n<0 && errno==EINTR) continue;
+		if(n<0) {
+			perror("epoll_wait()");
+			exit(1);
+		}
+
+		for(int i=0; i<n; i++) {
+			conn_t* conn=events[i].data.ptr;
+			if(!conn) {
+				acceptAll(fd);
+				continue;
+			}
+
+			if(connProcess(conn)) connClose(conn);
+			else connTouch(conn);
+		}
+
+		// close idle connections, and those whose response stays silent
+		time_t t=now();
+		connExpire(&clients, t);
+		connExpire(&bodies, t);
+	}
+}
@@ -0,0 +1,13 @@
+#ifndef _EVENT_H
+#define _EVENT_H
+
+/**
+ * runs an epoll-based event loop serving every client of a server socket from a single thread
+ * @param fd, a server socket fd, which is made non-blocking
+ * @remark this never returns, and exits the process on fatal errors
+ * @remark several processes may run this loop on the same server socket
+ * @remark route handlers are ran synchronously, and their output is buffered and then written without blocking
+ */
+void event_loop(int fd);
+
+#endif
@@ -0,0 +1,471 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "fcgi.h"
+#include "cgi.h"
+#include "config.h"
+
+/**
+ * the parts of the FastCGI protocol the client uses
+ */
+#define FCGI_VERSION 1
+#define FCGI_BEGIN_REQUEST 1
+#define FCGI_END_REQUEST 3
+#define FCGI_PARAMS 4
+#define FCGI_STDIN 5
+#define FCGI_STDOUT 6
+#define FCGI_STDERR 7
+#define FCGI_RESPONDER 1
+#define FCGI_KEEP_CONN 1
+#define FCGI_MAXCONTENT 65535
+
+/**
+ * represents a pooled connection to the FastCGI server
+ */
+typedef struct {
+	int fd; // -1 if the slot is free
+	int busy; // 1 while a request uses it
+	uint16_t nextid; // the id of the next request on this connection
+} fcgiconn_t;
+
+/**
+ * represents a growable buffer of records
+ */
+typedef struct {
+	char* data;
+	size_t len;
+	size_t cap;
+} fcgibuf_t;
+
+/**
+ * represents a request being answered by the FastCGI server
+ * it is sent and its output read as the server takes and gives them, so that nothing waits for the server
+ */
+typedef struct {
+	fcgiconn_t* conn; // NULL if the connection isn't pooled
+	int fd; // non-blocking
+	uint16_t id;
+	fcgibuf_t start; // the records which begin the request, kept until the server answers, so that they can be sent again
+	size_t startoff; // how much of them was sent
+	fcgibuf_t out; // the stdin record being sent
+	size_t outoff;
+	int body; // the body of the request, sent as stdin a record at a time, or -1
+	off_t bodyoff; // how much of it was put in records
+	int bodysent; // 1 once the last stdin record was put
+	unsigned char header[8]; // the header of the record being read
+	size_t headerlen;
+	int type; // the type of the record being read, 0 if it belongs to an earlier request
+	size_t remaining; // content left in the current record
+	size_t padding; // padding after it
+	int ended; // 1 once the end of the request was read
+	int broken; // 1 if the connection is in an unknown state
+	int reused; // 1 if the connection served earlier requests
+	int answered; // 1 once the server sent something for the request
+} fcgireq_t;
+
+/**
+ * the connections of this process, opened lazily so that forked workers don't share them
+ */
+static fcgiconn_t pool[SERVER_FCGIPOOL];
+static int poolReady;
+
+/**
+ * makes room in a buffer
+ * @param buf
+ * @param len, the number of bytes to append
+ * @returns 0 on success, -1 on error
+ */
+static int reserve(fcgibuf_t* buf, size_t len) {
+	if(buf->len+len<=buf->cap) return 0;
+	size_t cap=buf->cap?buf->cap:4096;
+	while(cap<buf->len+len) cap*=2;
+	char* data=realloc(buf->data, cap);
+	if(!data) return -1;
+	buf->data=data;
+	buf->cap=cap;
+	return 0;
+}
+
+/**
+ * appends a record to a buffer
+ * @param buf
+ * @param type
+ * @param id
+ * @param content
+ * @param len, at most `FCGI_MAXCONTENT`
+ * @returns 0 on success, -1 on error
+ */
+static int putRecord(fcgibuf_t* buf, int type, uint16_t id, const char* content, size_t len) {
+	if(reserve(buf, 8+len)) return -1;
+	unsigned char* h=(unsigned char*) buf->data+buf->len;
+	h[0]=FCGI_VERSION;
+	h[1]=type;
+	h[2]=id>>8;
+	h[3]=id&255;
+	h[4]=len>>8;
+	h[5]=len&255;
+	h[6]=0;
+	h[7]=0;
+	if(len) memcpy(h+8, content, len);
+	buf->len+=8+len;
+	return 0;
+}
+
+/**
+ * appends a stream to a buffer, split in as many records as needed, and terminated by an empty record
+ * @param buf
+ * @param type
+ * @param id
+ * @param content
+ * @param len
+ * @returns 0 on success, -1 on error
+ */
+static int putStream(fcgibuf_t* buf, int type, uint16_t id, const char* content, size_t len) {
+	while(len) {
+		size_t n=len>FCGI_MAXCONTENT?FCGI_MAXCONTENT:len;
+		if(putRecord(buf, type, id, content, n)) return -1;
+		content+=n;
+		len-=n;
+	}
+	return putRecord(buf, type, id, NULL, 0);
+}
+
+/**
+ * appends the length of a name or value of a parameter, on 1 or 4 bytes
+ * @param buf, with room for 4 bytes
+ * @param len
+ */
+static void putLength(fcgibuf_t* buf, size_t len) {
+	unsigned char* p=(unsigned char*) buf->data+buf->len;
+	if(len<128) {
+		*p=len;
+		buf->len++;
+		return;
+	}
+	p[0]=(len>>24)|0x80;
+	p[1]=len>>16;
+	p[2]=len>>8;
+	p[3]=len;
+	buf->len+=4;
+}
+
+/**
+ * appends a parameter to a buffer of name-value pairs
+ * @param buf
+ * @param name
+ * @param namelen
+ * @param value
+ * @returns 0 on success, -1 on error
+ */
+static int putParam(fcgibuf_t* buf, const char* name, size_t namelen, const char* value) {
+	size_t valuelen=strlen(value);
+	if(reserve(buf, 8+namelen+valuelen)) return -1;
+	putLength(buf, namelen);
+	putLength(buf, valuelen);
+	memcpy(buf->data+buf->len, name, namelen);
+	buf->len+=namelen;
+	memcpy(buf->data+buf->len, value, valuelen);
+	buf->len+=valuelen;
+	return 0;
+}
+
+/**
+ * appends a CGI meta-variable to a buffer of name-value pairs
+ * @param udata, the buffer
+ * @param name
+ * @param value
+ * @returns 0 on success, -1 on error
+ */
+static int putVariable(void* udata, const char* name, const char* value) {
+	return putParam(udata, name, strlen(name), value);
+}
+
+/**
+ * opens a connection to the FastCGI server
+ * @returns the connected non-blocking fd, or -1 on error
+ * @remark a server whose backlog is full counts as unreachable, rather than being waited for
+ */
+static int fcgiConnect(void) {
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family=AF_UNIX;
+	if(strlen(SERVER_FCGI)>=sizeof(addr.sun_path)) return -1;
+	strcpy(addr.sun_path, SERVER_FCGI);
+
+	int fd=socket(AF_UNIX, SOCK_STREAM|SOCK_NONBLOCK|SOCK_CLOEXEC, 0);
+	if(fd<0) return -1;
+	if(connect(fd, (struct sockaddr*) &addr, sizeof(addr))) {
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+/**
+ * tells whether an idle pooled connection is still open, as the server may close those it doesn't keep
+ * @param fd
+ * @returns 1 if it is, 0 if it was closed or has something unexpected to read
+ */
+static int fcgiAlive(int fd) {
+	char c;
+	return recv(fd, &c, 1, MSG_PEEK|MSG_DONTWAIT)<0 && (errno==EAGAIN || errno==EWOULDBLOCK);
+}
+
+/**
+ * sends the request again on a new connection, if the pooled one it was sent on was closed by the server before it answered
+ * the new connection takes the fd of the old one, which the response and the pool refer to
+ * @param r
+ * @returns 0 if it was sent again, -1 otherwise
+ */
+static int fcgiRetry(fcgireq_t* r) {
+	if(!r->reused || r->answered) return -1;
+	r->reused=0;
+	int fd=fcgiConnect();
+	if(fd<0) return -1;
+	int rst=dup3(fd, r->fd, O_CLOEXEC);
+	close(fd);
+	if(rst<0) return -1;
+	r->startoff=0;
+	r->out.len=0;
+	r->outoff=0;
+	r->bodyoff=0;
+	r->bodysent=0;
+	return 0;
+}
+
+/**
+ * sends what the server can take of the rest of a request
+ * @param r
+ * @returns 0 once the whole request is sent, -1 on error, with errno set to EAGAIN if the server can't take more yet
+ */
+static int fcgiSend(fcgireq_t* r) {
+	for(;;) {
+		fcgibuf_t* buf=&r->start;
+		size_t* off=&r->startoff;
+		if(*off==buf->len) {
+			buf=&r->out;
+			off=&r->outoff;
+		}
+		if(*off==buf->len) {
+			if(r->body<0 || r->bodysent) return 0;
+			// the body is read a record at a time, so that it isn't held in memory
+			char data[FCGI_MAXCONTENT];
+			ssize_t a=pread(r->body, data, sizeof(data), r->bodyoff);
+			if(a<0 && errno==EINTR) continue;
+			r->out.len=0;
+			r->outoff=0;
+			if(a<0 || putRecord(&r->out, FCGI_STDIN, r->id, data, a)) return -1;
+			r->bodyoff+=a;
+			r->bodysent=!a;
+			continue;
+		}
+		ssize_t a=send(r->fd, buf->data+*off, buf->len-*off, MSG_NOSIGNAL);
+		if(a<0 && errno==EINTR) continue;
+		if(a<0) return -1;
+		*off+=a;
+	}
+}
+
+/**
+ * reads from the FastCGI server without waiting
+ * @param r
+ * @param buf
+ * @param len
+ * @returns the number of bytes read, -1 on error or if the connection was closed, with errno set to EAGAIN if there is nothing to read
+ */
+static ssize_t fcgiRecv(fcgireq_t* r, void* buf, size_t len) {
+	for(;;) {
+		ssize_t a=read(r->fd, buf, len);
+		if(a<0 && errno==EINTR) continue;
+		if(a>0) r->answered=1;
+		if(!a) errno=ECONNRESET;
+		return a>0?a:-1;
+	}
+}
+
+/**
+ * sends the rest of a request, and reads its stdout, skipping the other records
+ * @param udata, the request
+ * @param buf
+ * @param len
+ * @returns the number of bytes read, 0 once the request ended, -1 on error, with errno set to EAGAIN if the server has nothing to give yet
+ * @remark it resumes where it stopped, a record header being read in several times if needed
+ */
+static ssize_t fcgiRead(void* udata, char* buf, size_t len) {
+	fcgireq_t* r=udata;
+	if(r->broken) goto broken;
+again:
+	// the server may wait for the whole request before answering, so it is sent first
+	if(fcgiSend(r) && errno!=EAGAIN && errno!=EWOULDBLOCK) goto failed;
+	for(;;) {
+		ssize_t a;
+		if(r->remaining && r->type==FCGI_STDOUT) {
+			a=fcgiRecv(r, buf, len<r->remaining?len:r->remaining);
+			if(a<0) break;
+			r->remaining-=a;
+			return a;
+		} else if(r->remaining || r->padding) {
+			char skip[4096];
+			size_t n=r->remaining?r->remaining:r->padding;
+			a=fcgiRecv(r, skip, n<sizeof(skip)?n:sizeof(skip));
+			if(a<0) break;
+			if(!r->remaining) {
+				r->padding-=a;
+			} else {
+				if(r->type==FCGI_STDERR) fwrite(skip, 1, a, stderr); // the errors of the script go to our log
+				r->remaining-=a;
+			}
+		} else if(r->ended) {
+			return 0;
+		} else {
+			a=fcgiRecv(r, r->header+r->headerlen, sizeof(r->header)-r->headerlen);
+			if(a<0) break;
+			if((r->headerlen+=a)<sizeof(r->header)) continue;
+			unsigned char* h=r->header;
+			uint16_t id=(h[2]<<8)|h[3];
+			r->headerlen=0;
+			r->type=id==r->id?h[1]:0; // records of earlier requests on this connection are skipped
+			r->remaining=(h[4]<<8)|h[5];
+			r->padding=h[6];
+			if(r->type==FCGI_END_REQUEST) r->ended=1;
+		}
+	}
+	if(errno==EAGAIN || errno==EWOULDBLOCK) {
+		errno=EAGAIN;
+		return -1;
+	}
+
+failed:
+	if(!fcgiRetry(r)) goto again;
+	if(!r->answered) fprintf(stderr, "fcgi: the server closed the connection without answering\n");
+	r->broken=1;
+broken:
+	errno=EIO;
+	return -1;
+}
+
+/**
+ * tells whether some of a request is left to send
+ * @param r
+ * @returns 1 if it is, 0 otherwise
+ */
+static int fcgiSending(fcgireq_t* r) {
+	return r->startoff<r->start.len || r->outoff<r->out.len || (r->body>=0 && !r->bodysent);
+}
+
+/**
+ * tells what a request waits for on its connection
+ * @param udata, the request
+ * @returns POLLIN, with POLLOUT while some of the request is left to send, or 0 once it ended or broke, as the idle connection won't get readable
+ */
+static short fcgiEvents(void* udata) {
+	fcgireq_t* r=udata;
+	if(r->ended || r->broken) return 0;
+	return POLLIN|(fcgiSending(r)?POLLOUT:0);
+}
+
+/**
+ * gives the connection of a request back to the pool, or closes it if it can't be reused
+ * @param udata, the request
+ */
+static void fcgiClose(void* udata) {
+	fcgireq_t* r=udata;
+	free(r->start.data);
+	free(r->out.data);
+	if(r->body>=0) close(r->body);
+	if(r->conn && r->ended && !r->broken && !r->remaining && !r->padding && !r->headerlen && !fcgiSending(r)) {
+		r->conn->busy=0;
+		return;
+	}
+	close(r->fd);
+	if(r->conn) {
+		r->conn->fd=-1;
+		r->conn->busy=0;
+	}
+}
+
+static const bodysource_t fcgiSource={fcgiRead, fcgiClose, fcgiEvents};
+
+/**
+ * takes a connection for a request, reusing an idle one if there is any
+ * @param r, whose `conn`, `fd` and `id` are set
+ * @returns 0 on success, -1 if the FastCGI server can't be reached
+ */
+static int acquire(fcgireq_t* r) {
+	if(!poolReady) {
+		for(int i=0; i<SERVER_FCGIPOOL; i++) pool[i].fd=-1;
+		poolReady=1;
+	}
+	fcgiconn_t* slot=NULL;
+	for(int i=0; i<SERVER_FCGIPOOL; i++) {
+		if(pool[i].busy) continue;
+		if(pool[i].fd>=0 && !fcgiAlive(pool[i].fd)) {
+			close(pool[i].fd);
+			pool[i].fd=-1;
+		}
+		if(pool[i].fd>=0) {
+			slot=pool+i;
+			break;
+		}
+		if(!slot) slot=pool+i;
+	}
+
+	r->conn=slot;
+	r->reused=slot && slot->fd>=0;
+	if(!r->reused) {
+		r->fd=fcgiConnect();
+		if(r->fd<0) return -1;
+		if(slot) slot->fd=r->fd;
+	} else {
+		r->fd=slot->fd;
+	}
+	if(slot) {
+		slot->busy=1;
+		if(!++slot->nextid) slot->nextid=1;
+		r->id=slot->nextid;
+	} else { // every pooled connection is streaming a response, so this one is closed after the request
+		r->id=1;
+	}
+	return 0;
+}
+
+int fcgi_handle(req_t* req, res_t* res, const char* script, const char* qs, int body, size_t bodylen) {
+	if(!*SERVER_FCGI) return -1;
+	fcgireq_t* r=arena_alloc(res->arena, sizeof(fcgireq_t));
+	if(!r) return -1;
+	memset(r, 0, sizeof(*r));
+	r->body=-1;
+	if(acquire(r)) return -1;
+	r->body=body;
+
+	char length[24];
+	if(body>=0) snprintf(length, sizeof(length), "%zu", bodylen);
+	fcgibuf_t params={NULL, 0, 0};
+	unsigned char begin[8]={0, FCGI_RESPONDER, r->conn?FCGI_KEEP_CONN:0, 0, 0, 0, 0, 0};
+	int err=putRecord(&r->start, FCGI_BEGIN_REQUEST, r->id, (char*) begin, sizeof(begin));
+	err=err || cgi_variables(req, script, qs, body>=0?length:NULL, putVariable, &params);
+	err=err || putStream(&r->start, FCGI_PARAMS, r->id, params.data, params.len);
+	if(body<0) err=err || putStream(&r->start, FCGI_STDIN, r->id, NULL, 0);
+	free(params.data);
+	if(err) {
+		r->broken=1;
+		fcgiClose(r);
+		http_res_error(res, 500);
+		return 0;
+	}
+
+	// the request is sent and the CGI headers of its output read when the response is framed, as the server takes and gives them
+	http_res_streamHead(res, r->fd, &fcgiSource, r, cgi_parseHeaders);
+	return 0;
+}
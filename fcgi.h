@@ -0,0 +1,21 @@
+#ifndef _FCGI_H
+#define _FCGI_H
+
+#include "http.h"
+
+/**
+ * handles a request and response by a FastCGI server, such as php-fpm, listening on the unix socket `SERVER_FCGI`
+ * connections are kept open and reused by later requests, up to `SERVER_FCGIPOOL` per process
+ * requests aren't multiplexed: a pooled connection carries one request at a time, as php-fpm doesn't take more, and records left of earlier requests are skipped
+ * @param req
+ * @param res, buffered
+ * @param script, the absolute path of the script to run
+ * @param qs, the query string, or NULL
+ * @param body, a seekable fd holding the body of the request, or -1 if it has none, which is closed once sent if the request is handled, and stays owned by the caller otherwise
+ * @param bodylen, the length of the body
+ * @returns 0 if the request was handled, -1 if the FastCGI server can't be reached and nothing was done
+ * @remark nothing waits for the server: the request is sent, and the output of the script read, CGI headers first, as the response is framed and written, and the server may stay silent for `SERVER_PIPETIMEOUT` seconds
+ */
+int fcgi_handle(req_t* req, res_t* res, const char* script, const char* qs, int body, size_t bodylen);
+
+#endif
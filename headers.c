@@ -0,0 +1,248 @@
+#include <string.h>
+#include <stdint.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "headers.h"
+
+/**
+ * the canonical names of the well-known headers
+ */
+static const struct {
+	const char* name;
+	uint32_t len;
+} knownHeaders[HDR_COUNT]={
+	[HDR_HOST]={"Host", 4},
+	[HDR_CONNECTION]={"Connection", 10},
+	[HDR_CONTENT_LENGTH]={"Content-Length", 14},
+	[HDR_CONTENT_TYPE]={"Content-Type", 12},
+	[HDR_CONTENT_ENCODING]={"Content-Encoding", 16},
+	[HDR_TRANSFER_ENCODING]={"Transfer-Encoding", 17},
+	[HDR_ACCEPT_ENCODING]={"Accept-Encoding", 15},
+	[HDR_IF_NONE_MATCH]={"If-None-Match", 13},
+	[HDR_IF_MODIFIED_SINCE]={"If-Modified-Since", 17},
+	[HDR_RANGE]={"Range", 5},
+	[HDR_IF_RANGE]={"If-Range", 8},
+	[HDR_ETAG]={"ETag", 4},
+	[HDR_LAST_MODIFIED]={"Last-Modified", 13},
+	[HDR_CACHE_CONTROL]={"Cache-Control", 13},
+	[HDR_VARY]={"Vary", 4},
+	[HDR_SERVER]={"Server", 6},
+	[HDR_STATUS]={"Status", 6}
+};
+
+/**
+ * the well-known headers for each name length, as ids+1 and terminated by 0
+ */
+#define MAXKNOWNLEN 17
+static const unsigned char knownByLength[MAXKNOWNLEN+1][4]={
+	[4]={HDR_HOST+1, HDR_ETAG+1, HDR_VARY+1},
+	[5]={HDR_RANGE+1},
+	[6]={HDR_SERVER+1, HDR_STATUS+1},
+	[8]={HDR_IF_RANGE+1},
+	[10]={HDR_CONNECTION+1},
+	[12]={HDR_CONTENT_TYPE+1},
+	[13]={HDR_IF_NONE_MATCH+1, HDR_LAST_MODIFIED+1, HDR_CACHE_CONTROL+1},
+	[14]={HDR_CONTENT_LENGTH+1},
+	[15]={HDR_ACCEPT_ENCODING+1},
+	[16]={HDR_CONTENT_ENCODING+1},
+	[17]={HDR_TRANSFER_ENCODING+1, HDR_IF_MODIFIED_SINCE+1}
+};
+
+/**
+ * folds the ASCII uppercase letters of 8 packed bytes to lowercase
+ * @param x
+ * @returns the folded bytes
+ */
+static inline uint64_t fold8(uint64_t x) {
+	const uint64_t high=0x8080808080808080ull;
+	const uint64_t ones=0x0101010101010101ull;
+	uint64_t low=x&~high;
+	uint64_t geA=low+ones*(0x80-'A'); // high bit set where the byte is >= 'A'
+	uint64_t gtZ=low+ones*(0x80-'Z'-1); // high bit set where the byte is > 'Z'
+	uint64_t upper=geA&~gtZ&~x&high;
+	return x|(upper>>2);
+}
+
+#ifdef __SSE2__
+/**
+ * folds the ASCII uppercase letters of 16 packed bytes to lowercase
+ * @param x
+ * @returns the folded bytes
+ */
+static inline __m128i fold16(__m128i x) {
+	__m128i upper=_mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('A'-1)), _mm_cmplt_epi8(x, _mm_set1_epi8('Z'+1)));
+	return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+#endif
+
+/**
+ * checks if two strings of the same length are equal, ignoring ASCII case
+ * @param a
+ * @param b
+ * @param len
+ * @returns 1 if they are equal, 0 otherwise
+ */
+static int caseEq(const char* a, const char* b, size_t len) {
+	size_t i=0;
+#ifdef __SSE2__
+	for(; i+16<=len; i+=16) {
+		__m128i va=fold16(_mm_loadu_si128((const __m128i*) (a+i)));
+		__m128i vb=fold16(_mm_loadu_si128((const __m128i*) (b+i)));
+		if(_mm_movemask_epi8(_mm_cmpeq_epi8(va, vb))!=0xffff) return 0;
+	}
+#endif
+	if(len>=8) {
+		uint64_t va, vb;
+		for(; i+8<=len; i+=8) {
+			memcpy(&va, a+i, 8);
+			memcpy(&vb, b+i, 8);
+			if(fold8(va)!=fold8(vb)) return 0;
+		}
+		if(i==len) return 1;
+
+		// compare the tail as 8 bytes overlapping what was already compared
+		memcpy(&va, a+len-8, 8);
+		memcpy(&vb, b+len-8, 8);
+		return fold8(va)==fold8(vb);
+	}
+	for(; i<len; i++) {
+		char ca=a[i];
+		char cb=b[i];
+		if(ca>='A' && ca<='Z') ca+='a'-'A';
+		if(cb>='A' && cb<='Z') cb+='a'-'A';
+		if(ca!=cb) return 0;
+	}
+	return 1;
+}
+
+/**
+ * rebuilds the index of the well-known headers
+ * @param headers
+ */
+static void reindex(headers_t* headers) {
+	memset(headers->known, 0, sizeof(headers->known));
+	for(int i=headers->count-1; i>=0; i--) {
+		if(headers->table[i].id!=HDR_OTHER) headers->known[headers->table[i].id]=i+1;
+	}
+}
+
+/**
+ * finds a header in the dict
+ * @param headers
+ * @param name
+ * @param len
+ * @returns the index of the header, or -1 if it is absent
+ */
+static int find(headers_t* headers, const char* name, size_t len) {
+	headerid_t id=http_headerId(name, len);
+	if(id!=HDR_OTHER) return headers->known[id]-1;
+	for(int i=0; i<headers->count; i++) {
+		header_t* header=headers->table+i;
+		if(header->namelen==len && header->id==HDR_OTHER && caseEq(header->name, name, len)) return i;
+	}
+	return -1;
+}
+
+int http_initHeaders(headers_t* headers, arena_t* arena, int cap) {
+	if(cap<1) cap=1;
+	headers->table=arena_alloc(arena, cap*sizeof(header_t));
+	if(!headers->table) return -1;
+	headers->count=0;
+	headers->cap=cap;
+	headers->arena=arena;
+	memset(headers->known, 0, sizeof(headers->known));
+	return 0;
+}
+
+headerid_t http_headerId(const char* name, size_t len) {
+	if(len>MAXKNOWNLEN) return HDR_OTHER;
+	for(const unsigned char* id=knownByLength[len]; *id; id++) {
+		if(caseEq(knownHeaders[*id-1].name, name, len)) return *id-1;
+	}
+	return HDR_OTHER;
+}
+
+int http_appendHeader(headers_t* headers, char* name, size_t namelen, char* value) {
+	if(!headers) return -1;
+
+	if(headers->count==headers->cap) {
+		header_t* table=arena_alloc(headers->arena, 2*headers->cap*sizeof(header_t));
+		if(!table) return -1;
+		memcpy(table, headers->table, headers->count*sizeof(header_t));
+		headers->table=table;
+		headers->cap*=2;
+	}
+
+	header_t* header=headers->table+headers->count;
+	header->name=name;
+	header->value=value;
+	header->namelen=namelen;
+	header->id=http_headerId(name, namelen);
+	headers->count++;
+	if(header->id!=HDR_OTHER && !headers->known[header->id]) headers->known[header->id]=headers->count;
+	return 0;
+}
+
+char* http_getHeader(headers_t* headers, char* name) {
+	if(!headers) return NULL;
+
+	int i=find(headers, name, strlen(name));
+	return i<0?NULL:headers->table[i].value;
+}
+
+char* http_getHeaderId(headers_t* headers, headerid_t id) {
+	if(!headers || id>=HDR_COUNT || !headers->known[id]) return NULL;
+	return headers->table[headers->known[id]-1].value;
+}
+
+int http_setHeader(headers_t* headers, char* name, char* value) {
+	if(!headers) return -1;
+
+	char* dup=arena_strdup(headers->arena, value);
+	if(!dup) return -1;
+
+	size_t len=strlen(name);
+	int i=find(headers, name, len);
+	if(i>=0) {
+		headers->table[i].value=dup;
+		return 0;
+	}
+
+	char* dupName=arena_strndup(headers->arena, name, len);
+	if(!dupName) return -1;
+	return http_appendHeader(headers, dupName, len, dup);
+}
+
+int http_setHeaderId(headers_t* headers, headerid_t id, char* value) {
+	if(!headers || id>=HDR_COUNT) return -1;
+
+	char* dup=arena_strdup(headers->arena, value);
+	if(!dup) return -1;
+
+	if(headers->known[id]) {
+		headers->table[headers->known[id]-1].value=dup;
+		return 0;
+	}
+	return http_appendHeader(headers, (char*) knownHeaders[id].name, knownHeaders[id].len, dup);
+}
+
+int http_removeHeader(headers_t* headers, char* name) {
+	if(!headers) return -1;
+
+	int i=find(headers, name, strlen(name));
+	if(i<0) return 0;
+	memmove(headers->table+i, headers->table+i+1, (headers->count-i-1)*sizeof(header_t));
+	headers->count--;
+	reindex(headers);
+	return 0;
+}
+
+int http_clearHeaders(headers_t* headers) {
+	if(!headers) return -1;
+	headers->count=0;
+	memset(headers->known, 0, sizeof(headers->known));
+	return 0;
+}
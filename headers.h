@@ -0,0 +1,140 @@
+#ifndef _HEADERS_H
+#define _HEADERS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "arena.h"
+
+/**
+ * represents the well-known headers, which are indexed for constant time lookups
+ */
+typedef enum {
+	HDR_HOST,
+	HDR_CONNECTION,
+	HDR_CONTENT_LENGTH,
+	HDR_CONTENT_TYPE,
+	HDR_CONTENT_ENCODING,
+	HDR_TRANSFER_ENCODING,
+	HDR_ACCEPT_ENCODING,
+	HDR_IF_NONE_MATCH,
+	HDR_IF_MODIFIED_SINCE,
+	HDR_RANGE,
+	HDR_IF_RANGE,
+	HDR_ETAG,
+	HDR_LAST_MODIFIED,
+	HDR_CACHE_CONTROL,
+	HDR_VARY,
+	HDR_SERVER,
+	HDR_STATUS,
+	HDR_COUNT,
+	HDR_OTHER=HDR_COUNT
+} headerid_t;
+
+/**
+ * represents a HTTP header
+ */
+typedef struct {
+	char* name;
+	char* value;
+	uint32_t namelen;
+	uint32_t id; // a `headerid_t`
+} header_t;
+
+/**
+ * represents a dictionnary of HTTP headers
+ * this dictionnary uses case-insensitive keys, keeps the insertion order, and is backed by a contiguous table allocated in an arena
+ */
+typedef struct {
+	header_t* table;
+	int count;
+	int cap;
+	uint16_t known[HDR_COUNT]; // index+1 in the table of each well-known header, 0 if absent
+	arena_t* arena;
+} headers_t;
+
+/**
+ * initializes an empty header dict
+ * @param headers
+ * @param arena, where the table and copied strings are allocated
+ * @param cap, the initial capacity of the table
+ * @returns 0 on success, -1 on error
+ */
+int http_initHeaders(headers_t* headers, arena_t* arena, int cap);
+
+/**
+ * finds which well-known header a name refers to
+ * @param name
+ * @param len, the length of the name
+ * @returns the id of the header, or `HDR_OTHER`
+ */
+headerid_t http_headerId(const char* name, size_t len);
+
+/**
+ * appends a header without checking if it is already in the dict, nor copying anything
+ * @param headers
+ * @param name, which must outlive the dict
+ * @param namelen
+ * @param value, which must outlive the dict
+ * @returns 0 on success, -1 on error
+ * @remark this is meant for parsers, which may see the same header more than once
+ */
+int http_appendHeader(headers_t* headers, char* name, size_t namelen, char* value);
+
+/**
+ * gets the value of a header
+ * @param headers
+ * @param name, not NULL
+ * @returns the value of the header if it is found, NULL otherwise
+ * @remark the returned value is not a copy and altering it is undefined behavior
+ * @remark if the value associated with the given key is removed or changed, this reference becomes invalid; it is your responsability to ensure that this doesn't cause problems
+ */
+char* http_getHeader(headers_t* headers, char* name);
+
+/**
+ * gets the value of a well-known header in constant time
+ * @param headers
+ * @param id, not `HDR_OTHER`
+ * @returns the value of the header if it is found, NULL otherwise
+ * @remark the same remarks as `http_getHeader` apply
+ */
+char* http_getHeaderId(headers_t* headers, headerid_t id);
+
+/**
+ * sets the value of a header
+ * @param headers
+ * @param name, not NULL
+ * @param value, not NULL
+ * @returns 0 on success, -1 on error
+ * @remark this sets the value to a copy of the value argument, not to the argument itself. This copy lives in the arena of the dict
+ */
+int http_setHeader(headers_t* headers, char* name, char* value);
+
+/**
+ * sets the value of a well-known header, using its canonical name
+ * @param headers
+ * @param id, not `HDR_OTHER`
+ * @param value, not NULL
+ * @returns 0 on success, -1 on error
+ * @remark the same remarks as `http_setHeader` apply
+ */
+int http_setHeaderId(headers_t* headers, headerid_t id, char* value);
+
+/**
+ * removes a header from the dict
+ * @param headers
+ * @param name, not NULL
+ * @returns 0 on success, -1 on error
+ * @remark the only way this can fail is if the header dict is NULL
+ */
+int http_removeHeader(headers_t* headers, char* name);
+
+/**
+ * clears the header dict
+ * @param headers
+ * @returns 0 on success, -1 on error
+ * @remark the only way this can fail is if the header dict is NULL
+ */
+int http_clearHeaders(headers_t* headers);
+
+#endif
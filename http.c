@@ -1,37 +1,66 @@
+#define _GNU_SOURCE
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+#include <stdint.h>
+
+#ifdef __AVX2__
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #include <sys/types.h>
 #include <sys/stat.h>
-#include <sys/wait.h>
 #include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/uio.h>
+#include <sys/ioctl.h>
 
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <arpa/inet.h>
 
 #include "http.h"
+#include "parser.h"
+#include "arena.h"
+#include "router.h"
+#include "mime.h"
+#include "cache.h"
+#include "compress.h"
+#include "metrics.h"
 #include "config.h"
 
-extern char** environ;
 
 /**
  * represents a route
  */
-typedef struct route_t route_t;
-typedef struct route_t {
-	char* route;
+typedef struct {
 	routehandler_t handler;
 	void* udata;
-	route_t* next;
+	int metrics; // the metrics slot of the route
 } route_t;
 
 /**
- * the first route of the linked list
+ * the routes of the server
+ */
+static router_t* router;
+
+/**
+ * the policies of the routes
  */
-static route_t* firstRoute;
+static router_t* policies;
+
+/**
+ * the cache of static responses, shared by all workers
+ */
+static cache_t* staticCache;
 
 /**
  * checks if both `a` and `b` are equal, ignoring case
@@ -53,52 +82,271 @@ static int loEq(char* a, char* b) {
 }
 
 /**
- * checks if `str` starts with `src`, ignoring case
- * @param str
- * @param src
- * @returns 1 if `str` starts with `src` without regard to case, 0 otherwise
- */
-static int loSw(char* str, char* src) {
-	char cr=*str;
-	char cc=*src;
-	while(cc) {
-		if(cr>='a' && cr<='z') cr-='a'-'A';
-		if(cc>='a' && cc<='z') cc-='a'-'A';
-		if(cr!=cc) return 0;
-		cr=*(str++);
-		cc=*(src++);
+ * checks if the comma-separated list `list` contains `token`, ignoring case
+ * @param list
+ * @param token
+ * @returns 1 if the token is in the list, 0 otherwise
+ */
+static int loHas(char* list, char* token) {
+	size_t len=strlen(token);
+	while(*list) {
+		while(*list==' ' || *list=='\t' || *list==',') list++;
+		char* end=list;
+		while(*end && *end!=',') end++;
+		char* tend=end;
+		while(tend>list && (tend[-1]==' ' || tend[-1]=='\t')) tend--;
+		if((size_t) (tend-list)==len && !strncasecmp(list, token, len)) return 1;
+		list=end;
 	}
-	return 1;
+	return 0;
+}
+
+/**
+ * the content codings of precompressed files, in order of preference
+ */
+#define NENCODINGS 3
+static const struct {
+	const char* name;
+	const char* ext;
+} encodings[NENCODINGS]={
+	{"br", ".br"},
+	{"zstd", ".zst"},
+	{"gzip", ".gz"}
+};
+
+/**
+ * parses a quality value
+ * @param q, the value of a `q` parameter
+ * @returns the quality, in thousandths
+ */
+static int parseQ(const char* q) {
+	int value=(*q=='1')?1000:0;
+	if(*q!='0' && *q!='1') return 1000;
+	if(*++q!='.') return value;
+	int scale=100;
+	for(q++; *q>='0' && *q<='9' && scale; q++, scale/=10) value+=(*q-'0')*scale;
+	return value>1000?1000:value;
+}
+
+/**
+ * finds how much a client accepts a content coding
+ * @param accept, the value of its Accept-Encoding header, or NULL
+ * @param name, the name of the coding
+ * @returns the quality of the coding, in thousandths, 0 if it isn't accepted
+ */
+static int codingQuality(const char* accept, const char* name) {
+	size_t nlen=strlen(name);
+	int any=0;
+	while(accept && *accept) {
+		while(*accept==' ' || *accept=='\t' || *accept==',') accept++;
+		const char* end=accept;
+		while(*end && *end!=',' && *end!=';' && *end!=' ' && *end!='\t') end++;
+		size_t len=end-accept;
+
+		// find the quality among the parameters
+		int quality=1000;
+		const char* p=end;
+		while(*p && *p!=',') {
+			if(*p==';') {
+				p++;
+				while(*p==' ' || *p=='\t') p++;
+				if((*p=='q' || *p=='Q') && p[1]=='=') quality=parseQ(p+2);
+				continue;
+			}
+			p++;
+		}
+
+		if(len==nlen && !strncasecmp(accept, name, len)) return quality;
+		if(len==6 && nlen==4 && !strncasecmp(accept, "x-gzip", 6) && !strcmp(name, "gzip")) return quality;
+		if(len==1 && *accept=='*') any=quality;
+		accept=p;
+	}
+	return any;
+}
+
+/**
+ * lists the precompressed encodings accepted by a client
+ * @param accept, the value of its Accept-Encoding header, or NULL
+ * @param order, filled with indexes in `encodings`, from the most to the least preferred
+ * @returns the number of accepted encodings
+ */
+static int acceptedEncodings(const char* accept, int* order) {
+	int q[NENCODINGS];
+	int n=0;
+	for(int i=0; i<NENCODINGS; i++) {
+		q[i]=codingQuality(accept, encodings[i].name);
+		if(q[i]) order[n++]=i;
+	}
+
+	// sort by quality, keeping the server preference between equals
+	for(int i=1; i<n; i++) {
+		for(int j=i; j>0 && q[order[j]]>q[order[j-1]]; j--) {
+			int t=order[j];
+			order[j]=order[j-1];
+			order[j-1]=t;
+		}
+	}
+	return n;
+}
+
+/**
+ * formats the weak entity tag of a file
+ * @param st
+ * @param buf, at least 64 bytes long
+ * @returns buf
+ */
+static char* fileETag(const struct stat* st, char* buf) {
+	sprintf(buf, "W/\"%llx-%llx-%llx.%lx\"", (unsigned long long) st->st_ino, (unsigned long long) st->st_size, (unsigned long long) st->st_mtim.tv_sec, (unsigned long) st->st_mtim.tv_nsec);
+	return buf;
 }
 
 /**
- * returns the value of a hex character, or 0 if it is invalid
- * @param h, a hex digit
- * @returns the value of the hex character
+ * formats a time as a HTTP date
+ * @param t
+ * @param buf, at least 32 bytes long
+ * @returns buf
  */
-static int hexval(char h) {
-	if(h>='0' && h<='9') return h-'0';
-	if(h>='a' && h<='f') return 10+h-'a';
-	if(h>='A' && h<='F') return 10+h-'A';
+static char* httpDate(time_t t, char* buf) {
+	struct tm tm;
+	gmtime_r(&t, &tm);
+	strftime(buf, 32, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	return buf;
+}
+
+/**
+ * checks if an entity tag is in a If-None-Match list, using the weak comparison
+ * @param list
+ * @param etag
+ * @returns 1 if it is, 0 otherwise
+ */
+static int etagMatches(const char* list, const char* etag) {
+	if(!strncmp(etag, "W/", 2)) etag+=2;
+	size_t len=strlen(etag);
+	while(*list) {
+		while(*list==' ' || *list=='\t' || *list==',') list++;
+		if(*list=='*') return 1;
+		if(!strncmp(list, "W/", 2)) list+=2;
+		const char* end=list;
+		if(*end=='"') end=strchr(end+1, '"');
+		if(!end) return 0;
+		end+=strcspn(end, ",");
+		const char* tend=end;
+		while(tend>list && (tend[-1]==' ' || tend[-1]=='\t')) tend--;
+		if((size_t) (tend-list)==len && !strncmp(list, etag, len)) return 1;
+		list=end;
+	}
 	return 0;
 }
 
 /**
- * returns the hex digit corresponding to a number
- * @param v, an int between 0 and 15 inclusive
- * @returns a hex represntation of the number
+ * checks if the copy a client has of a response is still valid
+ * @param req
+ * @param etag, the current entity tag of the response
+ * @param modified, its current modification time
+ * @returns 1 if the client can be answered with a 304, 0 otherwise
+ */
+static int notModified(req_t* req, const char* etag, time_t modified) {
+	if(req->method!=GET && req->method!=HEAD) return 0;
+
+	// If-Modified-Since is only a fallback for clients without entity tags
+	char* inm=http_getHeaderId(req->headers, HDR_IF_NONE_MATCH);
+	if(inm) return etagMatches(inm, etag);
+	char* ims=http_getHeaderId(req->headers, HDR_IF_MODIFIED_SINCE);
+	if(!ims) return 0;
+	struct tm tm;
+	memset(&tm, 0, sizeof(tm));
+	char* end=strptime(ims, "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	if(!end || *end) return 0;
+	return modified<=timegm(&tm);
+}
+
+/**
+ * ends a response with a 304, keeping only the headers a 200 would have had which still make sense
+ * @param res
+ */
+static void resNotModified(res_t* res) {
+	http_removeHeader(res->headers, "Content-Type");
+	http_removeHeader(res->headers, "Content-Encoding");
+	res->status=304;
+	http_res_endv(res);
+}
+
+/**
+ * parses a Range header against the size of a file
+ * @param header, such as `bytes=0-99,200-,-50`
+ * @param size
+ * @param ranges, filled with the satisfiable ranges, clamped to the size
+ * @param max, the capacity of ranges
+ * @returns the number of satisfiable ranges, 0 if there is none, -1 if the header is to be ignored
+ * @remark a header with more than `max` ranges, or with overlapping ranges, is ignored rather than served piecemeal
+ */
+static int parseRange(const char* header, off_t size, byterange_t* ranges, int max) {
+	if(strncasecmp(header, "bytes=", 6)) return -1;
+	const char* p=header+6;
+	int n=0;
+	int total=0;
+	for(;;) {
+		while(*p==' ' || *p=='\t') p++;
+		long long first=-1;
+		long long last=-1;
+		char* end;
+		if(*p>='0' && *p<='9') {
+			first=strtoll(p, &end, 10);
+			p=end;
+		}
+		if(*p++!='-') return -1;
+		if(*p>='0' && *p<='9') {
+			last=strtoll(p, &end, 10);
+			p=end;
+		}
+		if(first<0 && last<0) return -1;
+		if(first>=0 && last>=0 && last<first) return -1;
+		if(++total>max) return -1;
+
+		byterange_t r;
+		if(first<0) { // a suffix
+			r.off=last<size?size-last:0;
+			r.end=size;
+		} else {
+			r.off=first;
+			r.end=last<0 || last>=size?size:last+1;
+		}
+		if(r.off<r.end) {
+			for(int i=0; i<n; i++) if(r.off<ranges[i].end && ranges[i].off<r.end) return -1;
+			ranges[n++]=r;
+		}
+
+		while(*p==' ' || *p=='\t') p++;
+		if(!*p) return n;
+		if(*p++!=',') return -1;
+	}
+}
+
+/**
+ * checks if the ranges a client asked for may be served, from its If-Range header
+ * @param req
+ * @param etag, the current entity tag of the response
+ * @param modified, the current Last-Modified header of the response
+ * @returns 1 if they may, 0 if the whole response is to be sent instead
+ * @remark entity tags must match strongly, so weak ones like ours never do
  */
-static char hexdigit(int v) {
-	if(v<10) return '0'+v;
-	return 'a'+v-10;
+static int rangeValid(req_t* req, const char* etag, const char* modified) {
+	char* ir=http_getHeaderId(req->headers, HDR_IF_RANGE);
+	if(!ir) return 1;
+	if(*ir=='"' || !strncmp(ir, "W/", 2)) return strncmp(etag, "W/", 2) && !strcmp(ir, etag);
+	return !strcmp(ir, modified);
 }
 
 /**
- * returns the string name of a HTTP method
- * @param m
- * @returns a string representation of the method
+ * the values of hex digits plus one, 0 for the other characters
  */
-static char* methStr(method_t m) {
+static const unsigned char hexvals[256]={
+	['0']=1, 2, 3, 4, 5, 6, 7, 8, 9, 10,
+	['a']=11, 12, 13, 14, 15, 16,
+	['A']=11, 12, 13, 14, 15, 16
+};
+
+char* http_methodName(method_t m) {
 	switch(m) {
 		case GET:
 			return "GET";
@@ -122,312 +370,672 @@ static char* methStr(method_t m) {
 	return "[invalid]";
 }
 
+/**
+ * the status lines of the statuses the server knows, ready to be copied into heads
+ */
+#define STATUS(code, name) [code-100]={name, "HTTP/1.1 " #code " " name "\r\n", sizeof("HTTP/1.1 " #code " " name "\r\n")-1}
+static const struct {
+	char* name;
+	const char* line;
+	size_t len;
+} statuses[500]={
+	STATUS(200, "OK"),
+	STATUS(201, "CREATED"),
+	STATUS(204, "NO CONTENT"),
+	STATUS(206, "PARTIAL CONTENT"),
+	STATUS(301, "MOVED PERMANENTLY"),
+	STATUS(302, "FOUND"),
+	STATUS(303, "SEE OTHER"),
+	STATUS(304, "NOT MODIFIED"),
+	STATUS(307, "TEMPORARY REDIRECT"),
+	STATUS(308, "PERMANENT REDIRECT"),
+	STATUS(400, "BAD REQUEST"),
+	STATUS(401, "UNAUTHORIZED"),
+	STATUS(403, "FORBIDDEN"),
+	STATUS(404, "NOT FOUND"),
+	STATUS(405, "METHOD NOT ALLOWED"),
+	STATUS(408, "REQUEST TIMEOUT"),
+	STATUS(411, "LENGTH REQUIRED"),
+	STATUS(413, "CONTENT TOO LARGE"),
+	STATUS(414, "URI TOO LONG"),
+	STATUS(416, "RANGE NOT SATISFIABLE"),
+	STATUS(431, "REQUEST HEADER FIELDS TOO LARGE"),
+	STATUS(500, "INTERNAL SERVER ERROR"),
+	STATUS(501, "NOT IMPLEMENTED"),
+	STATUS(502, "BAD GATEWAY"),
+	STATUS(503, "SERVICE UNAVAILABLE"),
+	STATUS(504, "GATEWAY TIMEOUT"),
+	STATUS(505, "HTTP VERSION NOT SUPPORTED")
+};
+#undef STATUS
+
+/**
+ * represents a prerendered error page, with the part of its head which never changes
+ */
+struct errdoc_t {
+	char* head; // the status line and the headers of the body, without the terminating empty line
+	size_t headlen;
+	char* body;
+	size_t bodylen;
+};
+
+/**
+ * the error pages, indexed by status-400, rendered by `http_initErrors`
+ */
+static struct errdoc_t errdocs[200];
+
 /**
  * returns the name of the numeric status
  * @param status
- * @returns the name of the numeric status*
+ * @returns the name of the numeric status
  */
 static char* statusName(int status) {
-	switch(status) {
-		case 200:
-			return "OK";
-		case 400:
-			return "BAD REQUEST";
-		case 403:
-			return "FORBIDDEN";
-		case 404:
-			return "NOT FOUND";
-		case 500:
-			return "INTERNAL SERVER ERROR";
-	}
+	if(status>=100 && status<600 && statuses[status-100].name) return statuses[status-100].name;
 	return "ERROR";
 }
 
-char* http_getHeader(headers_t* headers, char* name) {
-	if(!headers) return NULL;
+/**
+ * formats an unsigned number in decimal, without the overhead of `sprintf`
+ * @param v
+ * @param buf, at least 21 bytes long
+ * @returns the number of digits written, not counting the terminating null byte
+ */
+static size_t formatUint(unsigned long long v, char* buf) {
+	char digits[20];
+	size_t n=0;
+	do {
+		digits[n++]='0'+v%10;
+		v/=10;
+	} while(v);
+	for(size_t i=0; i<n; i++) buf[i]=digits[n-1-i];
+	buf[n]='\0';
+	return n;
+}
 
-	header_t* header=headers->first;
-	while(header) {
-		if(loEq(header->name, name)) return header->value;
+/**
+ * appends the status line of a response to a head
+ * @param ptr, where to write it, with room for at least 64 bytes
+ * @param status
+ * @returns the end of the status line
+ */
+static char* putStatusLine(char* ptr, int status) {
+	if(status>=100 && status<600 && statuses[status-100].line) {
+		memcpy(ptr, statuses[status-100].line, statuses[status-100].len);
+		return ptr+statuses[status-100].len;
 	}
-	return NULL;
+	memcpy(ptr, "HTTP/1.1 ", 9);
+	ptr+=9;
+	ptr+=formatUint(status<0?0:status, ptr);
+	memcpy(ptr, " ERROR\r\n", 8);
+	return ptr+8;
 }
 
-int http_setHeader(headers_t* headers, char* name, char* value) {
-	if(!headers) return -1;
+/**
+ * tells the characters left as they are by `http_urlencode`: the unreserved set of RFC 3986, letters, digits and `-._~`
+ */
+static const unsigned char unreserved[256]={
+	['a' ... 'z']=1, ['A' ... 'Z']=1, ['0' ... '9']=1, ['-']=1, ['.']=1, ['_']=1, ['~']=1
+};
 
-	char* dup=strdup(value);
-	if(!dup) return -1;
+/**
+ * URLs are scanned a block of bytes at a time where vector instructions are available
+ * the masks of a block have a bit set for each byte that a scan stops at
+ */
+#if defined(__AVX2__)
+#define BLOCK 32
+typedef __m256i block_t;
 
-	header_t* header=headers->first;
-	while(header) {
-		if(loEq(header->name, name)) {
-			free(header->value);
-			header->value=dup;
-			return 0;
-		}
-		header=header->next;
-	}
+static inline block_t loadBlock(const char* s) {
+	return _mm256_loadu_si256((const __m256i*) s);
+}
 
-	header=headers->first;
-	while(header && header->next) header=header->next;
+static inline void storeBlock(char* d, block_t x) {
+	_mm256_storeu_si256((__m256i*) d, x);
+}
 
-	header_t* newHeader=malloc(sizeof(header_t));
-	if(!newHeader) {
-		free(dup);
-		return -1;
-	}
-	char* dupName=strdup(name);
-	if(!dupName) {
-		free(dup);
-		free(newHeader);
-		return -1;
-	}
-	newHeader->name=dupName;
-	newHeader->value=dup;
-	newHeader->next=NULL;
-	if(header) header->next=newHeader;
-	else headers->first=newHeader;
-	return 0;
+/**
+ * finds the bytes of a block that `http_urlencode` encodes
+ * @param x
+ * @returns the mask of the reserved bytes
+ */
+static inline uint32_t reservedMask(block_t x) {
+	__m256i lower=_mm256_or_si256(x, _mm256_set1_epi8(0x20)); // folds the letters, and no other byte into them
+	__m256i alpha=_mm256_and_si256(_mm256_cmpgt_epi8(lower, _mm256_set1_epi8('a'-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('z'+1), lower));
+	__m256i digit=_mm256_and_si256(_mm256_cmpgt_epi8(x, _mm256_set1_epi8('0'-1)), _mm256_cmpgt_epi8(_mm256_set1_epi8('9'+1), x));
+	__m256i mark=_mm256_or_si256(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('-')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('.'))),
+		_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('_')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8('~'))));
+	return ~(uint32_t) _mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(alpha, digit), mark));
 }
 
-int http_removeHeader(headers_t* headers, char* name) {
-	if(!headers) return -1;
+/**
+ * finds the escapes of a block
+ * @param x
+ * @param plus, `+` if it stands for a space, `%` otherwise
+ * @returns the mask of the escapes
+ */
+static inline uint32_t escapeMask(block_t x, char plus) {
+	return (uint32_t) _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(x, _mm256_set1_epi8('%')), _mm256_cmpeq_epi8(x, _mm256_set1_epi8(plus))));
+}
+#elif defined(__SSE2__)
+#define BLOCK 16
+typedef __m128i block_t;
 
-	header_t* header=headers->first;
-	while(header) {
-		if(loEq(header->name, name)) {
-			if(headers->first==header) {
-				headers->first=header->next;
-			} else {
-				header_t* prev=headers->first;
-				while(prev->next!=header) prev=prev->next;
-			}
-			free(header->name);
-			free(header->value);
-			free(header);
-			return 0;
-		}
-		header=header->next;
-	}
-	return 0;
+static inline block_t loadBlock(const char* s) {
+	return _mm_loadu_si128((const __m128i*) s);
 }
 
-int http_clearHeaders(headers_t* headers) {
-	if(!headers) return -1;
+static inline void storeBlock(char* d, block_t x) {
+	_mm_storeu_si128((__m128i*) d, x);
+}
 
-	header_t* header=headers->first;
-	while(header) {
-		free(header->name);
-		free(header->value);
-		header_t* next=header->next;
-		free(header);
-		header=next;
-	}
-	headers->first=NULL;
+static inline uint32_t reservedMask(block_t x) {
+	__m128i lower=_mm_or_si128(x, _mm_set1_epi8(0x20));
+	__m128i alpha=_mm_and_si128(_mm_cmpgt_epi8(lower, _mm_set1_epi8('a'-1)), _mm_cmplt_epi8(lower, _mm_set1_epi8('z'+1)));
+	__m128i digit=_mm_and_si128(_mm_cmpgt_epi8(x, _mm_set1_epi8('0'-1)), _mm_cmplt_epi8(x, _mm_set1_epi8('9'+1)));
+	__m128i mark=_mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('-')), _mm_cmpeq_epi8(x, _mm_set1_epi8('.'))),
+		_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('_')), _mm_cmpeq_epi8(x, _mm_set1_epi8('~'))));
+	return ~_mm_movemask_epi8(_mm_or_si128(_mm_or_si128(alpha, digit), mark))&0xffff;
+}
 
-	return 0;
+static inline uint32_t escapeMask(block_t x, char plus) {
+	return _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(x, _mm_set1_epi8('%')), _mm_cmpeq_epi8(x, _mm_set1_epi8(plus))));
+}
+#endif
+
+/**
+ * percent-encodes a byte
+ * @param ptr, where to write it
+ * @param c
+ * @returns the end of the escape
+ */
+static char* escape(char* ptr, unsigned char c) {
+	static const char digits[16]="0123456789ABCDEF"; // uppercase, as RFC 3986 recommends
+	ptr[0]='%';
+	ptr[1]=digits[c>>4];
+	ptr[2]=digits[c&0xf];
+	return ptr+3;
 }
 
-char* http_urlencode(char* url) {
-	char* buf=malloc(strlen(url)*3+1);
+char* http_urlencode(char* url, arena_t* arena) {
+	size_t len=strlen(url);
+	char* buf=arena?arena_alloc(arena, len*3+1):malloc(len*3+1);
 	if(!buf) return NULL;
 	char* ptr=buf;
-	char c;
-	while((c=*(url++))) {
-		if((c>='a' && c<='z') || (c>='A' || c<='Z')) {
-			*(ptr++)=c;
+	size_t i=0;
+#ifdef BLOCK
+	// whole blocks are stored, which the output has room for, and the pointer moves past what needn't be encoded
+	while(i+BLOCK<=len) {
+		// short runs are copied a byte at a time, as query strings are mostly made of them
+		size_t end=i+8;
+		while(i<end && unreserved[(unsigned char) url[i]]) *(ptr++)=url[i++];
+		if(i<end) {
+			ptr=escape(ptr, url[i++]);
+			continue;
+		}
+		// the run moved past the block checked above, so the one it ends at may not fit anymore
+		if(i+BLOCK>len) break;
+		block_t x=loadBlock(url+i);
+		uint32_t m=reservedMask(x);
+		storeBlock(ptr, x);
+		size_t n=m?(size_t) __builtin_ctz(m):BLOCK;
+		ptr+=n;
+		i+=n;
+	}
+#endif
+	for(; i<len; i++) {
+		if(unreserved[(unsigned char) url[i]]) *(ptr++)=url[i];
+		else ptr=escape(ptr, url[i]);
+	}
+	*ptr='\0';
+	return buf;
+}
+
+/**
+ * decodes the escape at the start of a string
+ * @param s, a string starting with `%`
+ * @param left, the length of the string
+ * @returns the byte escaped, or -1 if the escape is malformed
+ */
+static int unescape(const char* s, size_t left) {
+	if(left<3) return -1;
+	int hi=hexvals[(unsigned char) s[1]]-1;
+	int lo=hexvals[(unsigned char) s[2]]-1;
+	if((hi|lo)<0) return -1;
+	return hi<<4|lo;
+}
+
+/**
+ * decodes a URL component
+ * @param dst, where to write it, with room for `len+1` bytes, which may be the string itself
+ * @param src
+ * @param len, the length of the string
+ * @param form, 1 to decode `+` as a space
+ * @returns the length of the decoded string, or -1 if an escape is malformed
+ */
+static ssize_t urldecode(char* dst, const char* src, size_t len, int form) {
+	char plus=form?'+':'%';
+	size_t i=0;
+	size_t out=0;
+#ifdef BLOCK
+	// the text between escapes is copied by whole blocks, unless decoding in place and that would overwrite bytes yet to be read
+	while(i+BLOCK<=len) {
+		if(src[i]=='%') { // escapes often follow each other, as in encoded UTF-8
+			int c=unescape(src+i, len-i);
+			if(c<0) return -1;
+			dst[out++]=(char) c;
+			i+=3;
+			continue;
+		}
+		if(src[i]==plus) {
+			dst[out++]=' ';
+			i++;
+			continue;
+		}
+		block_t x=loadBlock(src+i);
+		uint32_t m=escapeMask(x, plus);
+		size_t n=m?(size_t) __builtin_ctz(m):BLOCK;
+		if(dst!=src || out+BLOCK<=i+n) storeBlock(dst+out, x);
+		else if(out!=i) for(size_t k=0; k<n; k++) dst[out+k]=src[i+k];
+		out+=n;
+		i+=n;
+	}
+#endif
+	while(i<len) {
+		if(src[i]=='%') {
+			int c=unescape(src+i, len-i);
+			if(c<0) return -1;
+			dst[out++]=(char) c;
+			i+=3;
 		} else {
-			*(ptr++)='%';
-			*(ptr++)=hexdigit((c>>4)&0xf);
-			*(ptr++)=hexdigit(c&0xf);
+			dst[out++]=src[i]==plus?' ':src[i];
+			i++;
 		}
 	}
-	*(ptr++)=0;
+	dst[out]='\0';
+	return out;
+}
 
-	return buf;
+ssize_t http_urldecodeInPlace(char* str, size_t len, int form) {
+	return urldecode(str, str, len, form);
 }
 
-char* http_urldecode(char* url) {
-	char* buf=malloc(strlen(url)+1);
+char* http_urldecode(char* url, arena_t* arena) {
+	size_t len=strlen(url);
+	char* buf=arena?arena_alloc(arena, len+1):malloc(len+1);
 	if(!buf) return NULL;
-	char* ptr=buf;
-	char c;
-	while((c=*(url++))) {
-		if(c=='%') {
-			if(!(*url && *(url+1))) {
-				free(buf);
-				return NULL;
+	if(urldecode(buf, url, len, 0)<0) {
+		if(!arena) free(buf);
+		return NULL;
+	}
+	return buf;
+}
+
+int http_parseQuery(req_t* req) {
+	if(req->nqueries>=0) return req->nqueries;
+	req->nqueries=0;
+	char* qs=req->query;
+	if(!qs || !*qs) return 0;
+
+	// one slice per field, so the fields are counted first
+	size_t len=strlen(qs);
+	int n=1;
+	for(const char* p=qs; (p=memchr(p, '&', qs+len-p)); p++) n++;
+	req->queries=arena_alloc(req->arena, n*sizeof(qparam_t));
+	if(!req->queries) return -1;
+
+	// the fields are split and decoded in place, each ends up terminated where its separator was
+	char* end=qs+len;
+	for(char* field=qs; field<=end;) {
+		char* amp=memchr(field, '&', end-field);
+		if(!amp) amp=end;
+		char* eq=memchr(field, '=', amp-field);
+		if(amp>field) {
+			qparam_t* q=req->queries+req->nqueries;
+			char* value=eq?eq+1:amp;
+			ssize_t vlen=http_urldecodeInPlace(value, amp-value, 1);
+			ssize_t nlen=http_urldecodeInPlace(field, (eq?eq:amp)-field, 1);
+			if(vlen>=0 && nlen>=0) { // malformed fields are left out
+				q->name=field;
+				q->value=value;
+				q->len=vlen;
+				req->nqueries++;
 			}
-			int val=hexval(*(url++))<<4;
-			val|=hexval(*(url++));
-			*(ptr++)=(char) val;
-		} else {
-			*(ptr++)=c;
 		}
+		field=amp+1;
 	}
-	*(ptr++)=0;
+	return req->nqueries;
+}
 
-	return buf;
+char* http_getQuery(req_t* req, const char* name, size_t* len) {
+	if(http_parseQuery(req)<0) return NULL;
+	for(int i=0; i<req->nqueries; i++) {
+		if(!strcmp(req->queries[i].name, name)) {
+			if(len) *len=req->queries[i].len;
+			return req->queries[i].value;
+		}
+	}
+	return NULL;
 }
 
-res_t* http_createResponse(int fd) {
-	res_t* res=malloc(sizeof(res_t));
+res_t* http_createResponse(int fd, arena_t* arena) {
+	res_t* res=arena_alloc(arena, sizeof(res_t));
 	if(!res) return NULL;
-	headers_t* headers=malloc(sizeof(headers_t));
-	if(!headers) {
-		free(res);
-		return NULL;
-	}
+	headers_t* headers=arena_alloc(arena, sizeof(headers_t));
+	if(!headers || http_initHeaders(headers, arena, 16)) return NULL;
 	res->status=200;
 	res->fd=fd;
 	res->headers=headers;
+	res->arena=arena;
 	res->state=0;
+	res->req=NULL;
+	res->out=NULL;
+	res->outlen=0;
+	res->outcap=0;
+	res->bodyfd=-1;
+	res->bodyoff=0;
+	res->bodyend=BODY_PIPE;
+	res->bodyevents=POLLIN;
+	res->cached.cache=NULL;
+	res->errdoc=NULL;
+	res->policy=NULL;
+	res->compress=COMPRESS_NONE;
+	res->multipart=NULL;
+	res->compressor=NULL;
+	res->source=NULL;
+	res->sourcedata=NULL;
+	res->prelude=NULL;
+	res->trailers=NULL;
+	res->chunklen=0;
+	res->chunkleft=0;
+	res->chunkcrlf=0;
+	res->tail=NULL;
+	res->taillen=0;
+	res->head=NULL;
+	res->headlen=0;
+	res->sent=0;
+	res->route=0;
+	res->series=-1;
+	res->started=metrics_now();
+	res->parsed=0;
+	res->framed=0;
+	res->written=0;
+	res->log=NULL;
 	return res;
 }
 
-req_t* http_parseRequest(int fd) {
-	req_t* req=malloc(sizeof(req_t));
-	if(!req) return NULL;
-	headers_t* headers=malloc(sizeof(headers_t));
-	if(!headers) {
-		free(req);
-		return NULL;
-	}
+res_t* http_createBufferedResponse(int fd, arena_t* arena) {
+	res_t* res=http_createResponse(fd, arena);
+	if(!res) return NULL;
+	res->state|=HTTP_RES_BUFFERED;
+	return res;
+}
 
-	req->fd=fd;
-	req->headers=headers;
+/**
+ * releases the body fd of a response
+ * @param res, with a body fd
+ */
+static void resCloseBody(res_t* res) {
+	if(res->source) res->source->close(res->sourcedata);
+	else close(res->bodyfd);
+	res->bodyfd=-1;
+	res->source=NULL;
+}
 
-	char buf[1024];
-	int a=read(fd, buf, sizeof(buf));
-	if(a<0) {
-		free(req);
-		free(headers);
-		return NULL;
+void http_destroyResponse(res_t* res) {
+	if(!res) return;
+	if(res->framed) {
+		metrics_observe(res->route, METRICS_WRITE, metrics_now()-res->framed);
+		metrics_bytes(res->series, res->written);
+		res->framed=0;
 	}
-
-	if(loSw(buf, "GET")) req->method=GET;
-	else if(loSw(buf, "HEAD")) req->method=HEAD;
-	else if(loSw(buf, "POST")) req->method=POST;
-	else if(loSw(buf, "PUT")) req->method=PUT;
-	else if(loSw(buf, "OPTIONS")) req->method=OPTIONS;
-	else if(loSw(buf, "DELETE")) req->method=DELETE;
-	else if(loSw(buf, "CONNECT")) req->method=CONNECT;
-	else if(loSw(buf, "TRACE")) req->method=TRACE;
-	else if(loSw(buf, "PATCH")) req->method=PATCH;
-	else {
-		free(req);
-		free(headers);
-		return NULL;
+	if(res->log) {
+		res->log->status=res->status;
+		res->log->bytes=res->written;
+		res->log->latency=metrics_now()-res->started;
+		accesslog_push(res->log);
+		res->log=NULL;
 	}
+	free(res->out);
+	res->out=NULL;
+	if(res->bodyfd>=0) resCloseBody(res);
+	if(res->req && res->req->body) http_closeBody(res->req->body);
+	if(res->compressor) compress_end(res->compressor);
+	res->compressor=NULL;
+	cache_release(&res->cached);
+}
 
-	int urlpos=0;
-	while(buf[urlpos]!=' ' && urlpos<a) urlpos++;
-	if(urlpos==a) {
-		free(req);
-		free(headers);
-		return NULL;
-	}
-	urlpos++;
-	int urlendpos=urlpos+1;
-	while(buf[urlendpos]!=' ' && urlendpos<a) urlendpos++;
-	if(urlendpos==a) {
-		free(req);
-		free(headers);
-		return NULL;
+req_t* http_parseRequest(int fd, arena_t* arena) {
+	char* buf=arena_alloc(arena, SERVER_MAXHEAD+1);
+	if(!buf) return NULL;
+
+	parser_t parser;
+	parser_init(&parser, NULL);
+	size_t len=0;
+	int rst=PARSER_AGAIN;
+	while(rst==PARSER_AGAIN && len<SERVER_MAXHEAD+1) {
+		ssize_t a=read(fd, buf+len, SERVER_MAXHEAD+1-len);
+		if(a<0 && errno==EINTR) continue;
+		if(a<=0) break;
+		len+=a;
+		rst=parser_feed(&parser, buf, len);
 	}
-	buf[urlendpos]=0;
-	req->url=strdup(buf+urlpos);
+
+	return rst==PARSER_DONE?http_createRequest(fd, buf, &parser, arena):NULL;
+}
+
+req_t* http_parseRequestBuf(int fd, char* buf, size_t len, arena_t* arena) {
+	parser_t parser;
+	parser_init(&parser, NULL);
+	if(parser_feed(&parser, buf, len)!=PARSER_DONE) return NULL;
+	return http_createRequest(fd, buf, &parser, arena);
+}
+
+req_t* http_createRequest(int fd, char* buf, parser_t* parser, arena_t* arena) {
+	int n=parser->nheaders;
+
+	// the request and its header dict are a single block
+	req_t* req=arena_alloc(arena, sizeof(req_t)+sizeof(headers_t));
+	if(!req) return NULL;
+	headers_t* headers=(headers_t*) (req+1);
+	if(http_initHeaders(headers, arena, n)) return NULL;
+
+	// every slice is terminated in place, its end is always a separator
+	char* method=buf+parser->method.off;
+	method[parser->method.len]=0;
+	if(loEq(method, "GET")) req->method=GET;
+	else if(loEq(method, "HEAD")) req->method=HEAD;
+	else if(loEq(method, "POST")) req->method=POST;
+	else if(loEq(method, "PUT")) req->method=PUT;
+	else if(loEq(method, "OPTIONS")) req->method=OPTIONS;
+	else if(loEq(method, "DELETE")) req->method=DELETE;
+	else if(loEq(method, "CONNECT")) req->method=CONNECT;
+	else if(loEq(method, "TRACE")) req->method=TRACE;
+	else if(loEq(method, "PATCH")) req->method=PATCH;
+	else return NULL;
+
+	req->fd=fd;
+	req->peer=NULL;
+	req->arena=arena;
+	req->version=10+buf[parser->version.off+7]-'0';
+	req->url=buf+parser->url.off;
+	req->url[parser->url.len]=0;
 	req->realurl=req->url;
-	if(!req->url) {
-		free(req);
-		free(headers);
-		return NULL;
+	req->query=memchr(req->url, '?', parser->url.len);
+	if(req->query) *(req->query++)=0; // the path and the query string are split in place
+	req->queries=NULL;
+	req->nqueries=-1;
+	req->params=NULL;
+	req->nparams=0;
+	req->body=NULL;
+
+	for(int i=0; i<n; i++) {
+		hslice_t* h=parser->headers+i;
+		char* name=buf+h->name.off;
+		char* value=buf+h->value.off;
+		name[h->name.len]=0;
+		value[h->value.len]=0;
+		http_appendHeader(headers, name, h->name.len, value);
 	}
-
-	//TODO parse headers
+	req->headers=headers;
 
 	return req;
 }
 
-int http_addroute(char* route, routehandler_t handler, void* udata) {
-	route=strdup(route);
-	if(!route) return -1;
+int http_keepAlive(req_t* req) {
+	char* connection=http_getHeaderId(req->headers, HDR_CONNECTION);
+	if(req->version>=11) return !(connection && loHas(connection, "close"));
+	return connection && loHas(connection, "keep-alive");
+}
 
-	route_t* r=malloc(sizeof(route_t));
-	if(!r) {
-		free(route);
-		return -1;
-	}
+int http_addmethodroute(method_t method, char* route, routehandler_t handler, void* udata) {
+	if(!router) router=router_create();
+	if(!router) return -1;
 
+	route_t* r=malloc(sizeof(route_t));
+	if(!r) return -1;
 	r->handler=handler;
 	r->udata=udata;
-	r->route=strdup(route);
-	if(!r->route) {
-		free(route);
+	r->metrics=metrics_route(route);
+	if(router_add(router, (int) method, route, r)) {
 		free(r);
 		return -1;
 	}
+	return 0;
+}
 
-	if(!firstRoute) {
-		firstRoute=r;
-		return 0;
-	}
+int http_addpolicy(char* route, const routepolicy_t* policy) {
+	if(!policies) policies=router_create();
+	if(!policies) return -1;
 
-	if(strcmp(firstRoute->route, route)<0) {
-		r->next=firstRoute;
-		firstRoute=r;
-		return 0;
+	routepolicy_t* p=malloc(sizeof(routepolicy_t));
+	if(!p) return -1;
+	*p=*policy;
+	if(router_add(policies, ROUTER_ANY, route, p)) {
+		free(p);
+		return -1;
 	}
+	return 0;
+}
 
-	route_t* prev=firstRoute;
-	while(1) {
-		if(!prev->next) {
-			prev->next=r;
-			break;
-		} else if(strcmp(prev->next->route, route)<0) {
-			r->next=prev->next;
-			prev->next=r;
-			break;
-		} else {
-			prev=prev->next;
+int http_addroute(char* route, routehandler_t handler, void* udata) {
+	return http_addmethodroute(ROUTER_ANY, route, handler, udata);
+}
+
+int http_initStaticCache(size_t size) {
+	if(!size) return 0;
+	staticCache=cache_create(size, SERVER_CACHEENTRIES);
+	return staticCache?0:-1;
+}
+
+/**
+ * reads a whole error page
+ * @param path
+ * @param len, set to the length of the page
+ * @returns the page, to be freed, or NULL if it can't be read
+ */
+static char* readErrdoc(const char* path, size_t* len) {
+	int fd=open(path, O_RDONLY|O_CLOEXEC);
+	if(fd<0) return NULL;
+	struct stat st;
+	char* data=NULL;
+	if(!fstat(fd, &st) && S_ISREG(st.st_mode) && (data=malloc(st.st_size+1))) {
+		*len=0;
+		ssize_t a;
+		while(*len<(size_t) st.st_size && ((a=read(fd, data+*len, st.st_size-*len))>0 || (a<0 && errno==EINTR))) {
+			if(a>0) *len+=a;
 		}
 	}
-
-	return 0;
+	close(fd);
+	return data;
 }
 
-#define HTTP_RES_HEADERSSENT 0x1
-#define HTTP_RES_ENDED 0x2
+int http_initErrors(void) {
+	for(int status=400; status<600; status++) {
+		if(!statuses[status-100].line) continue;
 
-void http_server(int fd) {
+		char path[1024];
+		snprintf(path, sizeof(path), SERVER_ERR, status);
+		size_t bodylen;
+		char* body=readErrdoc(path, &bodylen);
+		if(!body) {
+			body=malloc(sizeof(SERVER_ERRMSG)+64);
+			if(!body) return -1;
+			bodylen=sprintf(body, SERVER_ERRMSG, status, statusName(status));
+		}
 
-	// create the default response
-	res_t* res=http_createResponse(fd);
-	if(!res) {
-		fprintf(stderr, "Failed to create response");
-		close(fd);
-		exit(1);
+		char length[32];
+		size_t lengthlen=formatUint(bodylen, length);
+		static const char type[]="Content-Type: text/html; charset=UTF-8\r\nContent-Length: ";
+		char* head=malloc(statuses[status-100].len+sizeof(type)-1+lengthlen+2);
+		if(!head) {
+			free(body);
+			return -1;
+		}
+		char* ptr=putStatusLine(head, status);
+		memcpy(ptr, type, sizeof(type)-1);
+		ptr+=sizeof(type)-1;
+		memcpy(ptr, length, lengthlen);
+		ptr+=lengthlen;
+		*ptr++='\r';
+		*ptr++='\n';
+
+		struct errdoc_t* doc=errdocs+status-400;
+		doc->head=head;
+		doc->headlen=ptr-head;
+		doc->body=body;
+		doc->bodylen=bodylen;
+	}
+	return 0;
+}
+
+char* http_getParam(req_t* req, char* name) {
+	for(int i=0; i<req->nparams; i++) {
+		if(!strcmp(req->params[i].name, name)) return req->params[i].value;
 	}
-	http_setHeader(res->headers, "Server", "Custom HTTP");
-	http_setHeader(res->headers, "Connection", "close");
+	return NULL;
+}
 
-	// parse the request
-	req_t* req=http_parseRequest(fd);
-	if(!req) {
-		http_res_error(res, 400);
-		return;
+void http_route(req_t* req, res_t* res) {
+	routematch_t matches[SERVER_MAXMATCHES];
+	int other;
+
+	// the policy of the longest route applies
+	if(router_match(policies, req->method, req->realurl, matches, 1, &other)) res->policy=matches[0].data;
+	if(res->policy && res->policy->compress) {
+		const char* accept=http_getHeaderId(req->headers, HDR_ACCEPT_ENCODING);
+		int gzip=codingQuality(accept, "gzip");
+		int deflate=codingQuality(accept, "deflate");
+		if(gzip && gzip>=deflate) res->compress=COMPRESS_GZIP;
+		else if(deflate) res->compress=COMPRESS_DEFLATE;
 	}
 
-	// handle routing
-	for(route_t* route=firstRoute; route; route=route->next) {
-		if(strstr(req->url, route->route)==req->url) {
-			if(strcmp(route->route, "/")) {
-				req->url=req->realurl+strlen(route->route);
-			}
-			int err=route->handler(req, res, route->udata);
-			if(!err) break;
+	int n=router_match(router, req->method, req->realurl, matches, SERVER_MAXMATCHES, &other);
+
+	// try the longest route first, and fall back to shorter ones if handlers refuse the request
+	for(int i=0; i<n; i++) {
+		routematch_t* match=matches+i;
+		size_t len=match->len;
+		if(len && req->realurl[len-1]=='/') len--;
+		req->url=req->realurl+len;
+
+		req->nparams=0;
+		req->params=match->nparams?arena_alloc(req->arena, match->nparams*sizeof(param_t)):NULL;
+		for(int j=0; j<match->nparams && req->params; j++) {
+			req->params[j].name=(char*) match->params[j].name;
+			req->params[j].value=arena_strndup(req->arena, match->params[j].value, match->params[j].len);
+			if(req->params[j].value) req->nparams++;
 		}
+
+		route_t* route=match->data;
+		int err=route->handler(req, res, route->udata);
+		if(!err) {
+			res->route=route->metrics;
+			break;
+		}
+	}
+
+	if(!(res->state&HTTP_RES_ENDED) && other) {
+		http_res_error(res, 405);
 	}
 
 	// make sure everything is routed
@@ -435,54 +1043,234 @@ void http_server(int fd) {
 		http_res_error(res, 404);
 		fprintf(stderr, "not handled\n");
 	}
+}
 
-	// log some stuff
-	{
-		char addrBuf[1024];
-		socklen_t addrLen=sizeof(addrBuf);
-		struct sockaddr* addr=(struct sockaddr*) addrBuf;
-		char strBuf[1024]="";
-
-		if(!getpeername(fd, addr, &addrLen)) {
-			const void* rst=(addr->sa_family==AF_INET6)?
-				inet_ntop(AF_INET6, &((struct sockaddr_in6*) addr)->sin6_addr, strBuf, addrLen)
-			:
-				inet_ntop(AF_INET, &((struct sockaddr_in*) addr)->sin_addr, strBuf, addrLen);
-			if(!rst) {
-				strcpy(strBuf, "<can't decode>");
-			}
-		} else {
-			strcpy(strBuf, "<can't read>");
+void http_log(req_t* req, res_t* res) {
+	logrecord_t* rec=arena_alloc(res->arena, sizeof(logrecord_t));
+	if(!rec) return;
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	rec->time=ts.tv_sec*1000000000ULL+ts.tv_nsec;
+	rec->method=req->method;
+	accesslog_setAddr(rec, req->peer);
+	snprintf(rec->url, sizeof(rec->url), req->query?"%s?%s":"%s", req->realurl, req->query);
+	res->log=rec;
+}
+
+/**
+ * sets up the reader of the body of a request, if it has one
+ * @param req
+ * @param in, the bytes read after the head of the request
+ * @param inlen
+ * @returns 0 on success, or the status of the error to answer the request with
+ */
+static int reqBody(req_t* req, const char* in, size_t inlen) {
+	char* coding=http_getHeaderId(req->headers, HDR_TRANSFER_ENCODING);
+	char* length=http_getHeaderId(req->headers, HDR_CONTENT_LENGTH);
+	size_t len=0;
+	if(coding) {
+		// no other coding is understood, and a length next to it would be ambiguous
+		if(!loEq(coding, "chunked")) return 501;
+		if(length) return 400;
+	} else if(length) {
+		if(*length<'0' || *length>'9') return 400;
+		char* end;
+		errno=0;
+		unsigned long long l=strtoull(length, &end, 10);
+		if(*end || errno) return 400;
+		if(l>SERVER_MAXBODY) return 413;
+		len=l;
+
+		// a proxy in front may go by another of differing lengths, and see another request in the body
+		headers_t* headers=req->headers;
+		for(int i=headers->known[HDR_CONTENT_LENGTH]; i<headers->count; i++) {
+			header_t* h=headers->table+i;
+			if(h->id==HDR_CONTENT_LENGTH && strcmp(h->value, length)) return 400;
 		}
-		printf("%s [%d] %s %s\n", methStr(req->method), res->status, req->realurl, strBuf);
 	}
+	if(!coding && !len) return 0;
 
+	char* expect=http_getHeader(req->headers, "Expect");
+	req->body=arena_alloc(req->arena, sizeof(reqbody_t));
+	if(!req->body) return 500;
+	http_initBody(req->body, req->fd, in, inlen, coding!=NULL, len, req->version>=11 && expect && loEq(expect, "100-continue"));
+	return 0;
 }
 
-int http_static(req_t* req, res_t* res, void* fdp) {
-	int dfd=(int) (ptrdiff_t) fdp;
+res_t* http_begin(int fd, const struct sockaddr* peer, char* buf, size_t len, parser_t* parser, arena_t* arena, int keepalive) {
+	// create the default response
+	res_t* res=http_createBufferedResponse(fd, arena);
+	if(!res) {
+		fprintf(stderr, "Failed to create response\n");
+		return NULL;
+	}
+	http_setHeaderId(res->headers, HDR_SERVER, "Custom HTTP");
 
-	char* path=req->url;
-	{ // sanitize path
-		if(*path=='/') path++;
-		if(strstr(path, "..")) {
-			res->status=400;
-			http_res_end(res, "<code>..</code> found in URL");
-			return 0;
-		}
+	// parse the request
+	req_t* req=parser->status?NULL:http_createRequest(fd, buf, parser, arena);
+	if(req) req->peer=peer;
+	int status=req?reqBody(req, buf+parser->pos, len-parser->pos):0;
+	res->parsed=metrics_now();
+	res->req=req;
+	if(!req) {
+		http_res_error(res, parser->status?parser->status:501);
+		return res;
 	}
-	if(!*path) path=".";
+	if(keepalive && http_keepAlive(req)) res->state|=HTTP_RES_KEEPALIVE;
+	if(req->version>=11) res->state|=HTTP_RES_CHUNKABLE;
+	if(req->method==HEAD) res->state|=HTTP_RES_HEADONLY;
 
-	int fd=openat(dfd, path, O_RDONLY);
+	// log some stuff, before handlers may decode the query string in place
+	http_log(req, res);
 
-	if(fd>=0) { // handle directories
-		struct stat statbuf;
-		if(!fstat(fd, &statbuf)) {
-			if(statbuf.st_mode&S_IFDIR) {
-				int fd2=openat(fd, SERVER_INDEX, O_RDONLY);
-				close(fd);
-				fd=fd2;
-			}
+	if(status) {
+		// the end of the request is unknown, so the connection can't be reused
+		http_res_error(res, status);
+		res->state&=~HTTP_RES_KEEPALIVE;
+	}
+	return res;
+}
+
+int http_continue(res_t* res, parser_t* parser) {
+	req_t* req=res->req;
+	if(!(res->state&HTTP_RES_ROUTED)) {
+		// event loops read the body as it comes, before routing, so that handlers don't wait for it
+		if(req && req->body && (res->state&HTTP_RES_NONBLOCK) && !(res->state&HTTP_RES_ENDED) && http_spoolBody(req->body)) {
+			if(errno==EAGAIN) return 0;
+			if(errno!=EFBIG && errno!=EPROTO && errno!=ETIMEDOUT) perror("http_spoolBody()");
+			http_res_error(res, http_bodyStatus(errno));
+			res->state&=~HTTP_RES_KEEPALIVE;
+		}
+		res->state|=HTTP_RES_ROUTED;
+		// handle routing, unless the request was answered already
+		if(req && !(res->state&HTTP_RES_ENDED)) http_route(req, res);
+
+		// skip what the handler left of the body, to get to the next request
+		if(req && req->body) {
+			if((res->state&HTTP_RES_KEEPALIVE) && http_skipBody(req->body, SERVER_BODYSKIP)) res->state&=~HTTP_RES_KEEPALIVE;
+			parser->pos+=req->body->inpos;
+		}
+	}
+
+	if(http_res_frame(res, (res->state&HTTP_RES_KEEPALIVE)!=0)) return errno==EAGAIN && (res->state&HTTP_RES_BODYWAIT)?0:-1;
+
+	// the write phase is measured once the response is destroyed
+	res->framed=metrics_now();
+	res->series=metrics_request(res->route, req?(int) req->method:-1, res->status);
+	metrics_observe(res->route, METRICS_PARSE, res->parsed-res->started);
+	metrics_observe(res->route, METRICS_HANDLER, res->framed-res->parsed);
+	return 1;
+}
+
+res_t* http_handle(int fd, const struct sockaddr* peer, char* buf, size_t len, parser_t* parser, arena_t* arena, int keepalive) {
+	res_t* res=http_begin(fd, peer, buf, len, parser, arena, keepalive);
+	if(res && http_continue(res, parser)<=0) {
+		http_destroyResponse(res);
+		return NULL;
+	}
+	return res;
+}
+
+void http_server(int fd, const struct sockaddr* peer) {
+	// one more byte than the longest head, so that too long heads are detected by the parser
+	char* in=malloc(SERVER_MAXHEAD+1);
+	if(!in) return;
+	arena_t* arena=arena_create(SERVER_ARENA);
+	if(!arena) {
+		free(in);
+		return;
+	}
+	size_t inlen=0;
+	int served=0;
+	parser_t parser;
+	metrics_connection(1);
+
+	for(;;) {
+		// wait for a whole request head, or give up on idle clients
+		parser_init(&parser, NULL);
+		int rst;
+		while((rst=parser_feed(&parser, in, inlen))==PARSER_AGAIN) {
+			struct pollfd pfd={.fd=fd, .events=POLLIN};
+			int p=poll(&pfd, 1, SERVER_KEEPALIVE_TIMEOUT*1000);
+			if(p<0 && errno==EINTR) continue;
+			if(p<=0) break;
+			ssize_t a=read(fd, in+inlen, SERVER_MAXHEAD+1-inlen);
+			if(a<0 && errno==EINTR) continue;
+			if(a<=0) break;
+			inlen+=a;
+		}
+		if(rst==PARSER_AGAIN) break;
+
+		res_t* res=http_handle(fd, peer, in, inlen, &parser, arena, ++served<SERVER_KEEPALIVE_MAX);
+		if(!res) break;
+		int keep=http_res_write(res)==1 && (res->state&HTTP_RES_KEEPALIVE);
+		http_destroyResponse(res);
+		arena_reset(arena);
+		if(!keep) break;
+
+		// keep whatever the client pipelined after this request
+		memmove(in, in+parser.pos, inlen-parser.pos);
+		inlen-=parser.pos;
+	}
+
+	metrics_connection(-1);
+	arena_destroy(arena);
+	free(in);
+}
+
+int http_static(req_t* req, res_t* res, void* fdp) {
+	int dfd=(int) (ptrdiff_t) fdp;
+
+	char* path=req->url;
+	{ // sanitize path
+		if(*path=='/') path++;
+		if(strstr(path, "..")) {
+			res->status=400;
+			http_res_end(res, "<code>..</code> found in URL");
+			return 0;
+		}
+	}
+	if(!*path) path=".";
+
+	// the response depends on the encodings the client accepts
+	int order[NENCODINGS];
+	int nenc=acceptedEncodings(http_getHeaderId(req->headers, HDR_ACCEPT_ENCODING), order);
+	int variant=0;
+	for(int i=0; i<nenc; i++) variant=variant*4+order[i]+1;
+
+	// hot files are sent straight from the shared cache, as they were last framed
+	char* range=req->method==GET?http_getHeaderId(req->headers, HDR_RANGE):NULL;
+	if((res->state&HTTP_RES_BUFFERED) && !range && cache_lookup(staticCache, dfd, path, variant, &res->cached)) {
+		if(notModified(req, res->cached.etag, res->cached.modified)) {
+			char date[32];
+			http_setHeaderId(res->headers, HDR_VARY, "Accept-Encoding");
+			http_setHeaderId(res->headers, HDR_ETAG, (char*) res->cached.etag);
+			http_setHeaderId(res->headers, HDR_LAST_MODIFIED, httpDate(res->cached.modified, date));
+			cache_release(&res->cached);
+			resNotModified(res);
+			return 0;
+		}
+		res->status=200;
+		res->state|=HTTP_RES_HEADERSSENT|HTTP_RES_ENDED;
+		return 0;
+	}
+
+	int fd=openat(dfd, path, O_RDONLY);
+	const char* name=path;
+
+	struct stat statbuf;
+	if(fd>=0 && fstat(fd, &statbuf)) {
+		close(fd);
+		fd=-1;
+	}
+	if(fd>=0 && S_ISDIR(statbuf.st_mode)) { // handle directories
+		int fd2=openat(fd, SERVER_INDEX, O_RDONLY);
+		close(fd);
+		fd=fd2;
+		name=SERVER_INDEX;
+		if(fd>=0 && fstat(fd, &statbuf)) {
+			close(fd);
+			fd=-1;
 		}
 	}
 
@@ -501,138 +1289,915 @@ int http_static(req_t* req, res_t* res, void* fdp) {
 		return 0;
 	}
 
-	do { // detect mime type
-		char buf[1024];
-		char path[1024];
-		sprintf(buf, "/proc/%d/fd/%d", getpid(), fd);
-		ssize_t t;
-		if((t=readlink(buf, path, sizeof(path)-1))<0) break;
-		path[t]=0;
-		int pipefd[2];
-		if(pipe(pipefd)) break;
-		pid_t pid=fork();
-		while(pid<0 && errno==EAGAIN) pid=fork();
-		if(pid<0) break;
-
-		if(pid==0) { // invoke `file` in the pipe
-			close(pipefd[0]);
-			dup2(pipefd[1], 1);
-			char* argv[]={
-				"env",
-				"--",
-				"file",
-				"-b",
-				"--mime-type",
-				path,
-				NULL
-			};
-			execve("/usr/bin/env", argv, environ);
-			close(pipefd[1]);
-			exit(1);
-		} else { // read the results of `file`
-			close(pipefd[1]);
-			wait(NULL);
-			int a=read(pipefd[0], buf, sizeof(buf)-1);
-			if(a<=0) break;
-			buf[a]=0;
-			char* p=buf;
-			while(*p) {
-				if(*p=='\n' || *p=='\r') {
-					*p=0;
-					break;
-				}
-				p++;
-			}
-			http_setHeader(res->headers, "Content-Type", buf);
+	char file[SERVER_MAXURL+sizeof(SERVER_INDEX)+1];
+	snprintf(file, sizeof(file), name==path?"%s":"%s/" SERVER_INDEX, path);
+	const char* type=mime_type(fd, name, &statbuf);
+	http_setHeaderId(res->headers, HDR_CONTENT_TYPE, (char*) type);
+	http_setHeaderId(res->headers, HDR_VARY, "Accept-Encoding");
+
+	// send a precompressed sibling instead, if the client accepts it and it is not older than the file
+	cachedep_t deps[CACHE_MAXDEPS];
+	int ndeps=0;
+	deps[ndeps++]=(cachedep_t) {file, &statbuf};
+	struct stat sibstats[NENCODINGS];
+	struct stat* bodyst=&statbuf;
+	const char* encoding=NULL;
+	for(int i=0; i<nenc && !encoding && S_ISREG(statbuf.st_mode); i++) {
+		const char* ext=encodings[order[i]].ext;
+		char* sibling=arena_alloc(req->arena, strlen(file)+strlen(ext)+1);
+		if(!sibling) break;
+		strcat(strcpy(sibling, file), ext);
+
+		struct stat* st=sibstats+i;
+		int sfd=openat(dfd, sibling, O_RDONLY);
+		if(sfd>=0 && fstat(sfd, st)) {
+			close(sfd);
+			sfd=-1;
+		}
+		deps[ndeps++]=(cachedep_t) {sibling, sfd>=0?st:NULL};
+		if(sfd<0) continue;
+		if(!S_ISREG(st->st_mode) || st->st_mtim.tv_sec<statbuf.st_mtim.tv_sec || (st->st_mtim.tv_sec==statbuf.st_mtim.tv_sec && st->st_mtim.tv_nsec<statbuf.st_mtim.tv_nsec)) {
+			close(sfd);
+			continue;
 		}
-	} while(0);
+		close(fd);
+		fd=sfd;
+		bodyst=st;
+		encoding=encodings[order[i]].name;
+		http_setHeaderId(res->headers, HDR_CONTENT_ENCODING, (char*) encoding);
+	}
+
+	// validators come from the metadata of the file, so revalidations never read it
+	char etag[64];
+	char date[32];
+	fileETag(bodyst, etag);
+	httpDate(bodyst->st_mtim.tv_sec, date);
+	http_setHeaderId(res->headers, HDR_ETAG, etag);
+	http_setHeaderId(res->headers, HDR_LAST_MODIFIED, date);
+	if(notModified(req, etag, bodyst->st_mtim.tv_sec)) {
+		close(fd);
+		resNotModified(res);
+		return 0;
+	}
+
+	if(S_ISREG(bodyst->st_mode)) http_setHeader(res->headers, "Accept-Ranges", "bytes");
+	if(range && S_ISREG(bodyst->st_mode) && rangeValid(req, etag, date)) {
+		byterange_t ranges[SERVER_MAXRANGES];
+		int n=parseRange(range, bodyst->st_size, ranges, SERVER_MAXRANGES);
+		if(!n) {
+			char buf[64];
+			close(fd);
+			sprintf(buf, "bytes */%lld", (long long) bodyst->st_size);
+			http_removeHeader(res->headers, "Content-Type");
+			http_removeHeader(res->headers, "Content-Encoding");
+			http_setHeader(res->headers, "Content-Range", buf);
+			http_res_error(res, 416);
+			return 0;
+		}
+		if(n>0) {
+			http_res_pipeRanges(res, fd, ranges, n);
+			return 0;
+		}
+	}
+
+	if(staticCache && (res->state&HTTP_RES_BUFFERED) && S_ISREG(bodyst->st_mode) && bodyst->st_size<=SERVER_CACHEMAXFILE) {
+		char head[1024];
+		int len=snprintf(head, sizeof(head), "HTTP/1.1 200 %s\r\nContent-Type: %s\r\nVary: Accept-Encoding\r\n%s%s%sETag: %s\r\nLast-Modified: %s\r\nAccept-Ranges: bytes\r\nContent-Length: %lld\r\n", statusName(200), type, encoding?"Content-Encoding: ":"", encoding?encoding:"", encoding?"\r\n":"", etag, date, (long long) bodyst->st_size);
+		if(len>0 && (size_t) len<sizeof(head)) cache_insert(staticCache, dfd, path, variant, deps, ndeps, fd, bodyst, etag, bodyst->st_mtim.tv_sec, head, len);
+	}
 
 	res->status=200;
 	http_res_pipe(res, fd);
 	return 0;
 }
 
+/**
+ * writes raw bytes to the response, either to its buffer or to its fd
+ * @param res
+ * @param data
+ * @param len
+ * @returns 0 on success, -1 on error
+ */
+static int resWrite(res_t* res, const char* data, size_t len) {
+	if(res->state&HTTP_RES_BUFFERED) {
+		if(res->outlen+len>res->outcap) {
+			size_t cap=res->outcap?res->outcap:1024;
+			while(cap<res->outlen+len) cap*=2;
+			char* out=realloc(res->out, cap);
+			if(!out) return -1;
+			res->out=out;
+			res->outcap=cap;
+		}
+		memcpy(res->out+res->outlen, data, len);
+		res->outlen+=len;
+		return 0;
+	}
+
+	while(len) {
+		ssize_t a=write(res->fd, data, len);
+		if(a<0 && errno==EINTR) continue;
+		if(a<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) {
+			struct pollfd pfd={res->fd, POLLOUT, 0};
+			poll(&pfd, 1, -1);
+			continue;
+		}
+		if(a<=0) return -1;
+		data+=a;
+		len-=a;
+	}
+	return 0;
+}
+
+int http_res_trailer(res_t* res, char* name, char* value) {
+	if(!res->trailers) {
+		headers_t* trailers=arena_alloc(res->arena, sizeof(headers_t));
+		if(!trailers || http_initHeaders(trailers, res->arena, 4)) return -1;
+		res->trailers=trailers;
+	}
+	return http_setHeader(res->trailers, name, value);
+}
+
 void http_res_endv(res_t* res) {
 	if(res->state&HTTP_RES_ENDED) return;
 	http_res_sendHeaders(res);
 	res->state|=HTTP_RES_ENDED;
 }
 
+/**
+ * makes a fd the body of a response, noting how it can be sent
+ * @param res
+ * @param fd
+ */
+static void resSetBody(res_t* res, int fd) {
+	struct stat statbuf;
+	res->bodyfd=fd;
+	res->bodyoff=0;
+	res->bodyend=BODY_PIPE;
+	if(!fstat(fd, &statbuf) && S_ISREG(statbuf.st_mode)) {
+		off_t pos=lseek(fd, 0, SEEK_CUR);
+		res->bodyoff=pos<0?0:pos;
+		res->bodyend=statbuf.st_size;
+	}
+}
+
+/**
+ * waits for the body fd of a response to have something to read, or to end
+ * `HTTP_RES_NONBLOCK` responses don't wait, and get `HTTP_RES_BODYWAIT` set instead
+ * @param res, with a body fd
+ * @returns the events of the body fd, or -1 on error, with errno set to EAGAIN if the response doesn't wait, or to ETIMEDOUT if its producer stayed silent for `SERVER_PIPETIMEOUT`
+ * @remark sources may wait for other events than POLLIN, such as having room to send their request, or for none
+ */
+static int resBodyReady(res_t* res) {
+	res->bodyevents=res->source && res->source->events?res->source->events(res->sourcedata):POLLIN;
+	if(!res->bodyevents) return POLLIN; // the source can be read without waiting, such as once its fd is idle after its end
+	struct pollfd pfd={res->bodyfd, res->bodyevents, 0};
+	for(;;) {
+		int p=poll(&pfd, 1, res->state&HTTP_RES_NONBLOCK?0:SERVER_PIPETIMEOUT*1000);
+		if(p<0 && errno==EINTR) continue;
+		if(p<0) return -1;
+		if(p) return pfd.revents;
+		if(res->state&HTTP_RES_NONBLOCK) {
+			res->state|=HTTP_RES_BODYWAIT;
+			errno=EAGAIN;
+		} else {
+			errno=ETIMEDOUT;
+		}
+		return -1;
+	}
+}
+
+/**
+ * sends a part of the body fd of a response without copying it to userspace
+ * regular files are sent with `sendfile`, and pipes are spliced to the socket
+ * @param res, with a `bodyfd` which is not a `BODY_STREAM`
+ * @returns the number of bytes sent, 0 once the body is fully sent, -1 on error
+ * @remark the body fd is closed once it is fully sent
+ */
+static ssize_t resSendBody(res_t* res) {
+	ssize_t a;
+	if(res->bodyend>=0) {
+		if(res->bodyoff>=res->bodyend) {
+			a=0;
+		} else {
+			a=sendfile(res->fd, res->bodyfd, &res->bodyoff, res->bodyend-res->bodyoff);
+			if(!a) { // the file was truncated, and the announced length can't be honored anymore
+				errno=EIO;
+				return -1;
+			}
+		}
+	} else {
+		// once the pipe has something, this only blocks on the socket
+		if(resBodyReady(res)<0) return -1;
+		a=splice(res->bodyfd, NULL, res->fd, NULL, SERVER_PIPEBUF, SPLICE_F_MOVE|SPLICE_F_MORE);
+	}
+	if(!a) resCloseBody(res);
+	if(a>0) res->written+=a;
+	return a;
+}
+
+/**
+ * sends the body fd of an unbuffered response, whose headers are already written
+ * @param res
+ */
+static void resPump(res_t* res) {
+	int rst;
+	while(!(rst=http_res_write(res))) {
+		struct pollfd pfd={res->fd, POLLOUT, 0};
+		poll(&pfd, 1, -1);
+	}
+	if(res->bodyfd>=0) resCloseBody(res);
+}
+
 void http_res_pipe(res_t* res, int fd) {
-	if(res->state&HTTP_RES_ENDED) return;
+	if(res->state&HTTP_RES_ENDED) {
+		close(fd);
+		return;
+	}
+	http_res_sendHeaders(res);
+	res->state|=HTTP_RES_ENDED;
+	resSetBody(res, fd);
+	if(!(res->state&HTTP_RES_BUFFERED)) resPump(res);
+}
+
+void http_res_pipeHead(res_t* res, int fd, headparser_t parse) {
+	if((res->state&HTTP_RES_ENDED) || !(res->state&HTTP_RES_BUFFERED)) {
+		close(fd);
+		http_res_error(res, 500);
+		return;
+	}
+	http_res_pipe(res, fd);
+	res->prelude=parse;
+}
+
+void http_res_stream(res_t* res, int fd, const bodysource_t* source, void* udata) {
+	if(res->state&HTTP_RES_ENDED) {
+		source->close(udata);
+		return;
+	}
 	http_res_sendHeaders(res);
-	char buf[1024];
-	int a;
-	while((a=read(fd, buf, sizeof(buf)))>0) write(res->fd, buf, a);
-	close(fd);
 	res->state|=HTTP_RES_ENDED;
+	res->bodyfd=fd;
+	res->bodyoff=0;
+	res->bodyend=BODY_STREAM;
+	res->source=source;
+	res->sourcedata=udata;
+	if(!(res->state&HTTP_RES_BUFFERED)) resPump(res);
+}
+
+void http_res_streamHead(res_t* res, int fd, const bodysource_t* source, void* udata, headparser_t parse) {
+	if((res->state&HTTP_RES_ENDED) || !(res->state&HTTP_RES_BUFFERED)) {
+		source->close(udata);
+		http_res_error(res, 500);
+		return;
+	}
+	http_res_stream(res, fd, source, udata);
+	res->prelude=parse;
+}
+
+/**
+ * represents the parts of a multipart/byteranges body
+ */
+struct multipart_t {
+	byterange_t* ranges;
+	int n;
+	int next; // the next part to send, `n` for the closing delimiter
+	char* type; // the Content-Type of the parts
+	off_t size; // the size of the whole file
+	char boundary[24];
+};
+
+/**
+ * formats the delimiter and headers preceding a part, or the closing delimiter
+ * @param mp
+ * @param i, the index of the part, or `n` for the closing delimiter
+ * @param buf, NULL to only measure it
+ * @returns the length of the formatted text
+ */
+static size_t partHead(struct multipart_t* mp, int i, char* buf) {
+	const char* crlf=i?"\r\n":"";
+	if(i==mp->n) return snprintf(buf, buf?64:0, "\r\n--%s--\r\n", mp->boundary);
+	byterange_t* r=mp->ranges+i;
+	return snprintf(buf, buf?strlen(mp->type)+160:0, "%s--%s\r\nContent-Type: %s\r\nContent-Range: bytes %lld-%lld/%lld\r\n\r\n", crlf, mp->boundary, mp->type, (long long) r->off, (long long) r->end-1, (long long) mp->size);
+}
+
+/**
+ * queues the next part of a multipart/byteranges body in `out`
+ * @param res, whose previous part is fully sent
+ * @returns 0 on success, -1 on error
+ */
+static int resNextPart(res_t* res) {
+	struct multipart_t* mp=res->multipart;
+	int i=mp->next++;
+	size_t len=partHead(mp, i, NULL);
+	if(res->outcap<len+1) {
+		char* out=realloc(res->out, len+1);
+		if(!out) return -1;
+		res->out=out;
+		res->outcap=len+1;
+	}
+	partHead(mp, i, res->out);
+	res->outlen=len;
+	res->sent=res->headlen;
+	if(i<mp->n) {
+		res->bodyoff=mp->ranges[i].off;
+		res->bodyend=mp->ranges[i].end;
+	}
+	return 0;
 }
+
+void http_res_pipeRanges(res_t* res, int fd, const byterange_t* ranges, int n) {
+	struct stat st;
+	if(res->state&HTTP_RES_ENDED || n<1 || fstat(fd, &st) || !S_ISREG(st.st_mode)) {
+		close(fd);
+		return;
+	}
+	res->status=206;
+
+	char buf[128];
+	struct multipart_t* mp=NULL;
+	if(n==1) {
+		sprintf(buf, "bytes %lld-%lld/%lld", (long long) ranges[0].off, (long long) ranges[0].end-1, (long long) st.st_size);
+		http_setHeader(res->headers, "Content-Range", buf);
+	} else {
+		static unsigned long long counter;
+		mp=arena_alloc(res->arena, sizeof(struct multipart_t));
+		byterange_t* copy=arena_alloc(res->arena, n*sizeof(byterange_t));
+		char* type=http_getHeaderId(res->headers, HDR_CONTENT_TYPE);
+		type=arena_strdup(res->arena, type?type:SERVER_MIMEDEFAULT);
+		if(!mp || !copy || !type) {
+			close(fd);
+			http_res_error(res, 500);
+			return;
+		}
+		memcpy(copy, ranges, n*sizeof(byterange_t));
+		mp->ranges=copy;
+		mp->n=n;
+		mp->next=0;
+		mp->type=type;
+		mp->size=st.st_size;
+		sprintf(mp->boundary, "%016llx", ((unsigned long long) time(NULL)<<24)^((unsigned long long) getpid()<<8)^(++counter*0x9e3779b97f4a7c15ull));
+		sprintf(buf, "multipart/byteranges; boundary=%s", mp->boundary);
+		http_setHeaderId(res->headers, HDR_CONTENT_TYPE, buf);
+	}
+
+	http_res_sendHeaders(res);
+	res->state|=HTTP_RES_ENDED;
+	resSetBody(res, fd);
+	res->bodyoff=ranges[0].off;
+	res->bodyend=ranges[0].end;
+	if(mp) {
+		// the first part head is sent as the start of the body
+		char* head=arena_alloc(res->arena, partHead(mp, 0, NULL)+1);
+		if(head) resWrite(res, head, partHead(mp, mp->next++, head));
+		res->multipart=mp;
+	}
+	if(!(res->state&HTTP_RES_BUFFERED)) resPump(res);
+}
+
 void http_res_end(res_t* res, char* data) {
 	if(res->state&HTTP_RES_ENDED) return;
 	http_res_sendHeaders(res);
-	size_t len=strlen(data);
-	while(len) {
-		int a=write(res->fd, data, len);
-		if(a<=0) break;
-		data+=a;
-		len-=a;
-	}
+	resWrite(res, data, strlen(data));
 	res->state|=HTTP_RES_ENDED;
 }
 void http_res_endl(res_t* res, char* data, size_t len) {
 	if(res->state&HTTP_RES_ENDED) return;
 	http_res_sendHeaders(res);
-	while(len) {
-		int a=write(res->fd, data, len);
-		if(a<=0) break;
-		data+=a;
-		len-=a;
-	}
+	resWrite(res, data, len);
 	res->state|=HTTP_RES_ENDED;
 }
 
 void http_res_send(res_t* res, char* data) {
 	if(res->state&HTTP_RES_ENDED) return;
 	http_res_sendHeaders(res);
-	size_t len=strlen(data);
-	while(len) {
-		int a=write(res->fd, data, len);
-		if(a<=0) break;
-		data+=a;
-		len-=a;
-	}
+	resWrite(res, data, strlen(data));
 }
 void http_res_sendl(res_t* res, char* data, size_t len) {
 	if(res->state&HTTP_RES_ENDED) return;
 	http_res_sendHeaders(res);
-	while(len) {
-		int a=write(res->fd, data, len);
-		if(a<=0) break;
-		data+=a;
-		len-=a;
+	resWrite(res, data, len);
+}
+
+/**
+ * serializes the status line and headers of a response
+ * @param res
+ * @param status, 0 to leave the status line out
+ * @param len, set to the length of the serialized head
+ * @returns the serialized head, allocated in the arena of the response, or NULL on error
+ */
+static char* resHead(res_t* res, int status, size_t* len) {
+	headers_t* headers=res->headers;
+	size_t cap=64;
+	for(int i=0; i<headers->count; i++) {
+		cap+=headers->table[i].namelen+strlen(headers->table[i].value)+4;
 	}
+	char* buf=arena_alloc(res->arena, cap);
+	if(!buf) return NULL;
+
+	char* ptr=buf;
+	if(status) ptr=putStatusLine(ptr, res->status);
+	for(int i=0; i<headers->count; i++) {
+		header_t* h=headers->table+i;
+		size_t vlen=strlen(h->value);
+		memcpy(ptr, h->name, h->namelen);
+		ptr+=h->namelen;
+		*ptr++=':';
+		*ptr++=' ';
+		memcpy(ptr, h->value, vlen);
+		ptr+=vlen;
+		*ptr++='\r';
+		*ptr++='\n';
+	}
+	*ptr++='\r';
+	*ptr++='\n';
+	*len=ptr-buf;
+	return buf;
 }
 
 void http_res_sendHeaders(res_t* res) {
 	if(res->state&HTTP_RES_HEADERSSENT) return;
 	res->state|=HTTP_RES_HEADERSSENT;
+	if(res->state&HTTP_RES_BUFFERED) return; // serialized by `http_res_frame` once the body is known
 
-	char buf[10240];
-	sprintf(buf, "HTTP/1.1 %d %s\r\n", res->status, statusName(res->status));
-	write(res->fd, buf, strlen(buf));
+	size_t len;
+	char* head=resHead(res, 1, &len);
+	if(!head) return;
+	resWrite(res, head, len);
+}
 
-	for(header_t* header=res->headers->first; header; header=header->next) {
-		sprintf(buf, "%s: %s\r\n", header->name, header->value);
-		write(res->fd, buf, strlen(buf));
+/**
+ * checks if the body of a response is to be compressed, as its route asks for it
+ * @param res
+ * @returns 1 if it is, 0 otherwise
+ * @remark this notes in Vary that the response depends on Accept-Encoding, as soon as it could be compressed
+ */
+static int resCompressible(res_t* res) {
+	if(!res->policy || !res->policy->compress) return 0;
+	if(!compress_eligible(http_getHeaderId(res->headers, HDR_CONTENT_TYPE))) return 0;
+
+	// the response depends on Accept-Encoding even when it isn't compressed
+	char* vary=http_getHeaderId(res->headers, HDR_VARY);
+	if(!vary) {
+		http_setHeaderId(res->headers, HDR_VARY, "Accept-Encoding");
+	} else if(!loHas(vary, "Accept-Encoding")) {
+		char* buf=arena_alloc(res->arena, strlen(vary)+sizeof(", Accept-Encoding"));
+		if(buf) http_setHeaderId(res->headers, HDR_VARY, strcat(strcpy(buf, vary), ", Accept-Encoding"));
 	}
 
-	sprintf(buf, "\r\n");
-	write(res->fd, buf, strlen(buf));
+	if(!res->compress || res->status==204 || res->status==304) return 0;
+	return !http_getHeaderId(res->headers, HDR_CONTENT_ENCODING);
+}
+
+/**
+ * compresses the body of a response built in memory, if its route asks for it and it is worth it
+ * @param res, with its whole body in `out`
+ */
+static void resCompress(res_t* res) {
+	if(!resCompressible(res) || res->outlen<SERVER_COMPRESSMIN) return;
+
+	// only identical bodies of cacheable responses are worth remembering
+	char* cacheControl=http_getHeaderId(res->headers, HDR_CACHE_CONTROL);
+	int memoize=res->status==200 && !(cacheControl && (loHas(cacheControl, "no-store") || loHas(cacheControl, "private")));
+
+	char* out;
+	size_t outlen;
+	if(compress_buffer(res->compress, res->out, res->outlen, memoize, &out, &outlen)) return;
+	free(res->out);
+	res->out=out;
+	res->outlen=outlen;
+	res->outcap=outlen;
+	http_setHeaderId(res->headers, HDR_CONTENT_ENCODING, (char*) compress_name(res->compress));
+}
+
+/**
+ * reads from the streamed body of a response, appending to `out`, until enough is read, the body ends, or the body would block
+ * small writes of the producer are coalesced, so that they aren't sent as as many tiny chunks
+ * @param res
+ * @param max, how many bytes to read at most
+ * @param wait, 1 to read until `max` bytes are read or the body ends, even if that blocks
+ * @returns 1 once the body ended, 0 if it didn't, -1 on error, with errno set to EAGAIN if a `HTTP_RES_NONBLOCK` response would block, what was read being kept in `out`
+ */
+static int resFill(res_t* res, size_t max, int wait) {
+	char raw[SERVER_PIPEBUF];
+	size_t len=0;
+	size_t pending=0; // read into raw, but not compressed yet
+	int eof=0;
+	while(len<max) {
+		char* buf;
+		size_t room;
+		if(res->compressor) {
+			buf=raw+pending;
+			room=sizeof(raw)-pending;
+		} else {
+			size_t want=res->outlen+(max-len<SERVER_PIPEBUF?max-len:SERVER_PIPEBUF);
+			if(res->outcap<want) {
+				char* out=realloc(res->out, want);
+				if(!out) return -1;
+				res->out=out;
+				res->outcap=want;
+			}
+			buf=res->out+res->outlen;
+			room=want-res->outlen;
+		}
+		if(room>max-len) room=max-len;
+
+		// don't wait for more once something was read, unless asked to
+		if(len && !wait) {
+			struct pollfd pfd={res->bodyfd, POLLIN, 0};
+			if(poll(&pfd, 1, 0)<=0) break;
+		} else if(resBodyReady(res)<0) {
+			return -1;
+		}
+		ssize_t a=res->source?res->source->read(res->sourcedata, buf, room):read(res->bodyfd, buf, room);
+		if(a<0 && (errno==EINTR || errno==EAGAIN)) continue; // a source may have been ready for something else than giving data
+		if(a<0) return -1;
+		if(!a) {
+			eof=1;
+			break;
+		}
+		len+=a;
+		if(!res->compressor) {
+			res->outlen+=a;
+		} else if((pending+=a)==sizeof(raw)) {
+			if(compress_update(res->compressor, raw, pending, COMPRESS_MORE, &res->out, &res->outlen, &res->outcap)) return -1;
+			pending=0;
+		}
+	}
+	if(res->compressor && compress_update(res->compressor, raw, pending, eof?COMPRESS_FINISH:COMPRESS_SYNC, &res->out, &res->outlen, &res->outcap)) return -1;
+	return eof;
+}
+
+/**
+ * sets the size line of the next chunk of a chunked response, and the last chunk once its body ended
+ * @param res, chunked
+ * @param len, the size of the chunk, which is either in `out` or spliced after the size line
+ * @param eof, 1 if the body ended
+ * @returns 0 on success, -1 on error
+ */
+static int resChunk(res_t* res, size_t len, int eof) {
+	res->chunklen=0;
+	if(len) {
+		static const char hex[]="0123456789abcdef";
+		char digits[16];
+		int n=0;
+		if(res->chunkcrlf) { // the end of the previous spliced chunk
+			res->chunk[res->chunklen++]='\r';
+			res->chunk[res->chunklen++]='\n';
+			res->chunkcrlf=0;
+		}
+		for(size_t v=len; v; v>>=4) digits[n++]=hex[v&15];
+		while(n) res->chunk[res->chunklen++]=digits[--n];
+		res->chunk[res->chunklen++]='\r';
+		res->chunk[res->chunklen++]='\n';
+	}
+	if(!eof) return 0;
+
+	// the last chunk carries the trailers
+	size_t cap=10;
+	for(int i=0; res->trailers && i<res->trailers->count; i++) {
+		cap+=res->trailers->table[i].namelen+strlen(res->trailers->table[i].value)+4;
+	}
+	char* ptr=res->tail=arena_alloc(res->arena, cap);
+	if(!ptr) return -1;
+	if(res->chunkcrlf) {
+		memcpy(ptr, "\r\n", 2);
+		ptr+=2;
+		res->chunkcrlf=0;
+	}
+	memcpy(ptr, "0\r\n", 3);
+	ptr+=3;
+	for(int i=0; res->trailers && i<res->trailers->count; i++) {
+		header_t* h=res->trailers->table+i;
+		size_t vlen=strlen(h->value);
+		memcpy(ptr, h->name, h->namelen);
+		ptr+=h->namelen;
+		*ptr++=':';
+		*ptr++=' ';
+		memcpy(ptr, h->value, vlen);
+		ptr+=vlen;
+		*ptr++='\r';
+		*ptr++='\n';
+	}
+	memcpy(ptr, "\r\n", 2);
+	res->taillen=ptr+2-res->tail;
+	return 0;
+}
+
+/**
+ * streams the rest of a body of unknown length, chunked if the client understands it, until the connection is closed otherwise
+ * @param res, whose `out` holds the start of the body
+ * @param keepalive, set to 0 if the connection has to be closed to delimit the body
+ * @returns 0 on success, -1 on error
+ */
+static int resStream(res_t* res, int* keepalive) {
+	// pipes which aren't transformed are spliced, other bodies are copied through `out`
+	struct stat st;
+	if(res->source || fstat(res->bodyfd, &st) || !S_ISFIFO(st.st_mode)) res->bodyend=BODY_STREAM;
+	if(resCompressible(res)) {
+		res->bodyend=BODY_STREAM;
+		res->compressor=arena_alloc(res->arena, sizeof(compressor_t));
+		if(!res->compressor || compress_init(res->compressor, res->compress)) {
+			res->compressor=NULL;
+		} else {
+			char* in=res->out;
+			size_t inlen=res->outlen;
+			res->out=NULL;
+			res->outlen=0;
+			res->outcap=0;
+			int rst=compress_update(res->compressor, in, inlen, COMPRESS_SYNC, &res->out, &res->outlen, &res->outcap);
+			free(in);
+			if(rst) return -1;
+			http_setHeaderId(res->headers, HDR_CONTENT_ENCODING, (char*) compress_name(res->compress));
+		}
+	}
+
+	if(!(res->state&HTTP_RES_CHUNKABLE)) {
+		*keepalive=0;
+		return 0;
+	}
+	res->state|=HTTP_RES_CHUNKED;
+	if(http_setHeaderId(res->headers, HDR_TRANSFER_ENCODING, "chunked")) return -1;
+
+	// announce the trailers, which are only known once the body ended
+	if(res->trailers && res->trailers->count) {
+		size_t len=0;
+		for(int i=0; i<res->trailers->count; i++) len+=res->trailers->table[i].namelen+2;
+		char* names=arena_alloc(res->arena, len+1);
+		if(!names) return -1;
+		*names='\0';
+		for(int i=0; i<res->trailers->count; i++) {
+			if(i) strcat(names, ", ");
+			strcat(names, res->trailers->table[i].name);
+		}
+		if(http_setHeader(res->headers, "Trailer", names)) return -1;
+	}
+	return resChunk(res, res->outlen, 0);
+}
+
+/**
+ * reads and parses the head the body fd of a response starts with, leaving the rest of what was read in `out`
+ * @param res, with a `prelude`, and nothing in `out` but the start of its body
+ * @returns 0 once the head is parsed, or the response is replaced by a 502 if it can't be, -1 on error, with errno set to EAGAIN if it would block
+ */
+static int resPrelude(res_t* res) {
+	while(res->prelude) {
+		int eof=resFill(res, SERVER_MAXHEAD-res->outlen, 0);
+		if(eof<0 && errno==EAGAIN) return -1;
+		ssize_t hlen=eof<0?0:res->prelude(res, res->out, res->outlen);
+		if(hlen>0) {
+			res->outlen-=hlen;
+			memmove(res->out, res->out+hlen, res->outlen);
+			res->prelude=NULL;
+		} else if(eof || res->outlen>=SERVER_MAXHEAD) {
+			if(eof<0) perror("read()");
+			fprintf(stderr, "invalid head at the start of a body\n");
+			resCloseBody(res);
+			res->prelude=NULL;
+			res->outlen=0;
+			res->state&=~(HTTP_RES_HEADERSSENT|HTTP_RES_ENDED);
+			http_res_error(res, 502);
+		}
+	}
+	return 0;
+}
+
+int http_res_frame(res_t* res, int keepalive) {
+	if(!(res->state&HTTP_RES_BUFFERED)) return -1;
+	res->state&=~HTTP_RES_BODYWAIT;
+	if(res->bodyfd>=0 && res->prelude && resPrelude(res)) return -1;
+
+	// a body of unknown length is read now, so that it can be measured, unless it is too long to be kept in memory
+	int streamed=0;
+	if(res->bodyfd>=0 && res->bodyend<0) {
+		// what was read before waiting for the body is kept, so reading carries on from there
+		int eof=resFill(res, res->outlen<SERVER_STREAMBUF?SERVER_STREAMBUF-res->outlen:0, 1);
+		if(eof<0 && errno==EAGAIN) return -1;
+		if(eof<0) perror("read()");
+		if(eof) {
+			resCloseBody(res);
+		} else {
+			streamed=1;
+			if(resStream(res, &keepalive)) return -1;
+		}
+	}
+
+	// trailers which can't be sent after the body are sent as headers
+	for(int i=0; !(res->state&HTTP_RES_CHUNKED) && res->trailers && i<res->trailers->count; i++) {
+		if(http_setHeader(res->headers, res->trailers->table[i].name, res->trailers->table[i].value)) return -1;
+	}
+
+	if(res->bodyfd<0 && !res->cached.cache && !res->errdoc) resCompress(res);
+
+	// successful responses get the caching policy of their route
+	int success=res->status==200 || res->status==206 || res->status==304;
+	if(success && res->policy && res->policy->cacheControl && !http_getHeaderId(res->headers, HDR_CACHE_CONTROL)) {
+		if(http_setHeaderId(res->headers, HDR_CACHE_CONTROL, (char*) res->policy->cacheControl)) return -1;
+	}
+
+	// cached and prerendered responses already have their length in their head, and bodiless and streamed ones have none
+	if(!res->cached.cache && !res->errdoc && !streamed && res->status!=204 && res->status!=304) {
+		size_t length=res->outlen;
+		if(res->bodyfd>=0 && res->bodyend>res->bodyoff) length+=res->bodyend-res->bodyoff;
+		struct multipart_t* mp=res->multipart;
+		for(int i=mp?mp->next:0; mp && i<=mp->n; i++) {
+			length+=partHead(mp, i, NULL);
+			if(i<mp->n) length+=mp->ranges[i].end-mp->ranges[i].off;
+		}
+
+		char buf[32];
+		formatUint(length, buf);
+		if(http_setHeaderId(res->headers, HDR_CONTENT_LENGTH, buf)) return -1;
+	}
+	if(http_setHeaderId(res->headers, HDR_CONNECTION, keepalive?"keep-alive":"close")) return -1;
+	if(keepalive) res->state|=HTTP_RES_KEEPALIVE;
+	else res->state&=~HTTP_RES_KEEPALIVE;
+
+	// a HEAD gets the head a GET would get, but none of the body it describes
+	if(res->state&HTTP_RES_HEADONLY) {
+		if(res->bodyfd>=0) resCloseBody(res);
+		res->outlen=0;
+		res->chunklen=0;
+		res->taillen=0;
+		res->multipart=NULL;
+		res->state&=~HTTP_RES_CHUNKED;
+	}
+
+	res->head=resHead(res, !res->cached.cache && !res->errdoc, &res->headlen);
+	res->sent=0;
+	return res->head?0:-1;
+}
+
+/**
+ * splices the chunks of a chunked pipe body to the socket, each chunk being what the pipe holds when it starts
+ * @param res, whose parts in memory are sent
+ * @returns 0 on success, -1 on error, with errno set to EAGAIN if the socket or the body fd would block
+ */
+static int resSpliceChunk(res_t* res) {
+	if(res->chunkleft) {
+		// the pipe holds at least that much, so this only blocks on the socket
+		ssize_t a=splice(res->bodyfd, NULL, res->fd, NULL, res->chunkleft, SPLICE_F_MOVE|SPLICE_F_MORE);
+		if(a<0) return -1;
+		if(!a) { // the chunk was announced, and can't be cut short
+			errno=EIO;
+			return -1;
+		}
+		res->chunkleft-=a;
+		res->written+=a;
+		res->chunkcrlf=!res->chunkleft;
+		return 0;
+	}
+
+	// size the next chunk after what the producer wrote so far, waiting for it to write something
+	int n=0;
+	while(!ioctl(res->bodyfd, FIONREAD, &n) && !n) {
+		int events=resBodyReady(res);
+		if(events<0) return -1;
+		if(!(events&POLLIN)) break; // the end of the body
+		if(!ioctl(res->bodyfd, FIONREAD, &n) && !n) break;
+	}
+	if(n) res->chunkleft=n;
+	else resCloseBody(res);
+	res->outlen=0;
+	res->sent=res->headlen;
+	return resChunk(res, n, !n);
+}
+
+/**
+ * lists the parts of a framed response which are sent from memory, in order
+ * @param res
+ * @param iov, at least 5 long
+ * @returns the number of parts
+ */
+static int resParts(res_t* res, struct iovec* iov) {
+	if(res->cached.cache) {
+		iov[0]=(struct iovec) {(void*) res->cached.head, res->cached.headlen};
+		iov[1]=(struct iovec) {res->head, res->headlen};
+		iov[2]=(struct iovec) {(void*) res->cached.body, res->cached.bodylen};
+		return res->state&HTTP_RES_HEADONLY?2:3;
+	}
+	if(res->errdoc) {
+		iov[0]=(struct iovec) {res->errdoc->head, res->errdoc->headlen};
+		iov[1]=(struct iovec) {res->head, res->headlen};
+		iov[2]=(struct iovec) {res->errdoc->body, res->errdoc->bodylen};
+		return res->state&HTTP_RES_HEADONLY?2:3;
+	}
+	iov[0]=(struct iovec) {res->head, res->headlen};
+	iov[1]=(struct iovec) {res->chunk, res->chunklen};
+	iov[2]=(struct iovec) {res->out, res->outlen};
+	iov[3]=(struct iovec) {"\r\n", res->chunklen && res->outlen?2:0};
+	iov[4]=(struct iovec) {res->tail, res->taillen};
+	return 5;
+}
+
+/**
+ * corks or uncorks the socket of a response, so that what is written in several syscalls leaves in full segments
+ * uncorking is the flush point: whatever is pending is sent at once
+ * @param res
+ * @param on
+ */
+static void resCork(res_t* res, int on) {
+	if(!(res->state&HTTP_RES_CORKED)==!on) return;
+	// fails harmlessly on sockets which aren't TCP
+	setsockopt(res->fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+	if(on) res->state|=HTTP_RES_CORKED;
+	else res->state&=~HTTP_RES_CORKED;
+}
+
+int http_res_pending(res_t* res, struct iovec* iov) {
+	// a head sent apart from its body would leave in a segment of its own
+	if(res->bodyfd>=0) resCork(res, 1);
+	int n=resParts(res, iov);
+	size_t skip=res->sent;
+	int first=0;
+	while(first<n && skip>=iov[first].iov_len) skip-=iov[first++].iov_len;
+	if(first==n) return 0;
+	iov[first].iov_base=(char*) iov[first].iov_base+skip;
+	iov[first].iov_len-=skip;
+
+	// the parts left are moved first, leaving out the empty ones
+	int count=0;
+	for(int i=first; i<n; i++) {
+		if(iov[i].iov_len) iov[count++]=iov[i];
+	}
+	return count;
+}
+
+void http_res_sent(res_t* res, size_t n) {
+	res->sent+=n;
+	res->written+=n;
+}
+
+/**
+ * tells that writing a response has to wait, flushing what was sent if it waits for its body fd rather than its socket
+ * @param res
+ * @returns 0
+ */
+static int resBlocked(res_t* res) {
+	if(res->state&HTTP_RES_BODYWAIT) resCork(res, 0);
+	return 0;
+}
+
+int http_res_write(res_t* res) {
+	res->state&=~HTTP_RES_BODYWAIT;
+	for(;;) {
+		// send what is in memory with a single syscall
+		struct iovec iov[5];
+		int n=http_res_pending(res, iov);
+		if(n) {
+			ssize_t a=writev(res->fd, iov, n);
+			if(a<0 && errno==EINTR) continue;
+			if(a<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return 0;
+			if(a<=0) return -1;
+			http_res_sent(res, a);
+			continue;
+		}
+
+		if(res->bodyfd>=0 && res->bodyoff>=res->bodyend && res->multipart && res->multipart->next<=res->multipart->n) {
+			if(resNextPart(res)) return -1;
+		} else if(res->bodyfd>=0 && res->bodyend==BODY_PIPE && (res->state&HTTP_RES_CHUNKED)) {
+			int rst=resSpliceChunk(res);
+			if(rst<0 && errno==EINTR) continue;
+			if(rst<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return resBlocked(res);
+			if(rst<0) return -1;
+		} else if(res->bodyfd>=0 && res->bodyend!=BODY_STREAM) {
+			ssize_t a=resSendBody(res);
+			if(a<0 && errno==EINTR) continue;
+			if(a<0 && (errno==EAGAIN || errno==EWOULDBLOCK)) return resBlocked(res);
+			if(a<0 && errno==EINVAL && res->bodyend==BODY_PIPE) { // not a pipe, so it has to be copied
+				res->bodyend=BODY_STREAM;
+				continue;
+			}
+			if(a<0) return -1;
+		} else if(res->bodyfd>=0) {
+			// refill the buffer from the streamed body, as one chunk if it is chunked
+			res->outlen=0;
+			res->chunklen=0;
+			res->sent=res->headlen;
+			int eof=resFill(res, SERVER_PIPEBUF, 0);
+			if(eof<0 && errno==EAGAIN) return resBlocked(res);
+			if(eof<0) return -1;
+			if(eof) resCloseBody(res);
+			if((res->state&HTTP_RES_CHUNKED) && resChunk(res, res->outlen, eof)) return -1;
+		} else {
+			resCork(res, 0);
+			return 1;
+		}
+	}
 }
 
 void http_res_error(res_t* res, int status) {
 	if(res->state&HTTP_RES_ENDED) return;
 	res->status=status;
+
+	// the page is sent from memory, after the headers of the response but those describing its body
+	struct errdoc_t* doc=status>=400 && status<600?errdocs+status-400:NULL;
+	if(doc && doc->head && (res->state&HTTP_RES_BUFFERED) && !(res->state&HTTP_RES_HEADERSSENT)) {
+		http_removeHeader(res->headers, "Content-Type");
+		http_removeHeader(res->headers, "Content-Length");
+		res->errdoc=doc;
+		res->state|=HTTP_RES_HEADERSSENT|HTTP_RES_ENDED;
+		return;
+	}
 	http_res_sendHeaders(res);
 
 	char buf[1024];
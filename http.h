@@ -3,6 +3,18 @@
 
 #include <stddef.h>
 
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "parser.h"
+#include "arena.h"
+#include "headers.h"
+#include "cache.h"
+#include "compress.h"
+#include "body.h"
+#include "accesslog.h"
+
 /**
  * represents the recognized HTTP verbs
  */
@@ -11,94 +23,215 @@ typedef enum {
 } method_t;
 
 /**
- * represents a HTTP header
+ * represents a parameter of a route
  */
-typedef struct header_t header_t;
-typedef struct header_t {
+typedef struct {
 	char* name;
 	char* value;
-	header_t* next;
-} header_t;
+} param_t;
 
 /**
- * represents a dictionnary of HTTP headers
- * this dictionnary uses case-insensitive keys, and is backed by a linked list
+ * represents a field of the query string of a request, decoded in place
  */
 typedef struct {
-	header_t* first;
-} headers_t;
+	char* name;
+	char* value;
+	size_t len; // the length of the value, which may hold null bytes
+} qparam_t;
 
 /**
- * gets the value of a header
- * @param headers
- * @param name, not NULL
- * @returns the value of the header if it is found, NULL otherwise
- * @remark the returned value is not a copy and altering it is undefined behavior
- * @remark if the value associated with the given key is removed or changed, this reference becomes invalid; it is your responsability to ensure that this doesn't cause problems
+ * represents a HTTP request as seen by the server
+ * its strings point into the buffer it was parsed from, so its headers are read-only
+ * the request lives in an arena, which handlers may use for anything that lives as long as the request
  */
-char* http_getHeader(headers_t* headers, char* name);
+typedef struct {
+	method_t method;
+	int version; // 10 for HTTP/1.0, 11 for HTTP/1.1
+	int fd;
+	const struct sockaddr* peer; // the address of the client, captured at accept, or NULL
+	char* url;
+	char* realurl; // the path of the request, without its query string
+	char* query; // the raw query string, without its `?`, or NULL if there is none
+	qparam_t* queries; // the fields of the query string, once parsed
+	int nqueries; // -1 until the query string is parsed
+	headers_t* headers;
+	param_t* params; // the parameters of the route handling the request
+	int nparams;
+	arena_t* arena;
+	reqbody_t* body; // read by handlers as they need it, NULL if the request has no body
+} req_t;
 
 /**
- * sets the value of a header
- * @param headers
- * @param name, not NULL
- * @param value, not NULL
- * @returns 0 on success, -1 on error
- * @remark this sets the value to a copy of the value argument, not to the argument itself. This copy is managed internally
+ * reads and parses a HTTP request from the given file descriptor
+ * @param fd, a file descriptor open for reading
+ * @param arena, where the request and its buffer are allocated
+ * @returns a request object if the request could be parsed, NULL otherwise
+ * @remark bytes read past the request head are lost
  */
-int http_setHeader(headers_t* headers, char* name, char* value);
+req_t* http_parseRequest(int fd, arena_t* arena);
 
 /**
- * removes a header from the dict
- * @param headers
- * @param name, not NULL
- * @returns 0 on success, -1 on error
- * @remark the only way this can fail is if the header dict is NULL
+ * parses a HTTP request from a buffer holding its whole head
+ * @param fd, the file descriptor the request was read from
+ * @param buf, the raw request, modified in place
+ * @param len, the length of the raw request
+ * @param arena, where the request is allocated
+ * @returns a request object if the request could be parsed, NULL otherwise
+ * @remark the request points into the buffer, which must outlive it
  */
-int http_removeHeader(headers_t* headers, char* name);
+req_t* http_parseRequestBuf(int fd, char* buf, size_t len, arena_t* arena);
 
 /**
- * clears the header dict
- * @param headers
- * @returns 0 on success, -1 on error
- * @remark the only way this can fail is if the header dict is NULL
+ * creates a request object from the slices recorded by a parser
+ * @param fd, the file descriptor the request was read from
+ * @param buf, the buffer the parser was fed, modified in place
+ * @param parser, done
+ * @param arena, where the request is allocated
+ * @returns a request object, or NULL if the method is unknown or on error
+ * @remark the request points into the buffer, which must outlive it
  */
-int http_clearHeaders(headers_t* headers);
+req_t* http_createRequest(int fd, char* buf, parser_t* parser, arena_t* arena);
 
 /**
- * represents a HTTP request as seen by the server
+ * returns the name of a HTTP method
+ * @param m
+ * @returns the name of the method, as in a request line
+ */
+char* http_methodName(method_t m);
+
+/**
+ * checks if the client wants the connection to be kept open after a request
+ * @param req
+ * @returns 1 if the connection may be kept open, 0 otherwise
+ */
+int http_keepAlive(req_t* req);
+
+/**
+ * the flags of the `state` of a response
+ */
+#define HTTP_RES_HEADERSSENT 0x1
+#define HTTP_RES_ENDED 0x2
+#define HTTP_RES_BUFFERED 0x4
+#define HTTP_RES_KEEPALIVE 0x8
+#define HTTP_RES_CORKED 0x10
+#define HTTP_RES_CHUNKABLE 0x20 // the client understands chunked bodies
+#define HTTP_RES_CHUNKED 0x40
+#define HTTP_RES_HEADONLY 0x80 // the request was a HEAD, so the body is described but not sent
+#define HTTP_RES_NONBLOCK 0x100 // set by event loops: neither the body fd nor the client are waited for, and handling, framing and writing return when they have nothing to read
+#define HTTP_RES_BODYWAIT 0x200 // set when framing or writing returned because the body fd wasn't ready for the poll events in `bodyevents`
+#define HTTP_RES_ROUTED 0x400 // the request was handed to its handler, or answered without one
+
+/**
+ * represents how the responses of a route are handled, whatever their handler
  */
 typedef struct {
-	method_t method;
-	int fd;
-	char* url;
-	char* realurl;
-	headers_t* headers;
-} req_t;
+	int compress; // 1 to compress bodies built in memory on the fly, if their type is one of `SERVER_COMPRESSTYPES`
+	const char* cacheControl; // the Cache-Control header of successful responses, unless their handler sets one, or NULL
+} routepolicy_t;
 
 /**
- * reads and parses a HTTP request from the given file descriptor
- * @param fd, a file descriptor open for reading
- * @returns a request object if the request could be parsed, NULL otherwise
+ * the kinds of non-regular body fds of a response
  */
-req_t* http_parseRequest(int fd);
+#define BODY_PIPE -1 // spliced to the socket
+#define BODY_STREAM -2 // which can't be spliced, and is copied through `out`
 
 /**
- * represents a HTTP response as seen by the server
+ * represents a body which is read from a fd through something else than `read`, such as a demultiplexer
+ */
+typedef struct {
+	ssize_t (*read)(void* udata, char* buf, size_t len); // reads like `read`, returning 0 at the end of the body, or -1 with errno set to EAGAIN if it has nothing yet
+	void (*close)(void* udata); // releases the body once it is done with, whether it was fully read or not
+	short (*events)(void* udata); // the poll events the fd is waited for before reading, such as POLLOUT while the source has something to send, 0 if it is read without waiting, or NULL for POLLIN
+} bodysource_t;
+
+struct res_t;
+
+/**
+ * represents a parser of a head which precedes the body in the body fd of a response, such as the CGI headers of a script
+ * it is given what was read of the body so far, and sets the status and headers of the response once the head is complete
+ * it returns the length of the head, or 0 if it isn't complete yet
+ */
+typedef ssize_t (*headparser_t)(struct res_t*, char*, size_t);
+
+/**
+ * represents a range of bytes of a file
  */
 typedef struct {
+	off_t off;
+	off_t end; // exclusive
+} byterange_t;
+
+/**
+ * represents a HTTP response as seen by the server
+ * buffered responses (`HTTP_RES_BUFFERED`) never write to their fd while handled: their body is kept in `out`, the fd given to `http_res_pipe` is kept in `bodyfd`, and everything is sent by `http_res_frame` and `http_res_write`
+ */
+typedef struct res_t {
 	int status;
 	int fd;
 	int state;
+	req_t* req; // the request being answered, or NULL if it couldn't be parsed
 	headers_t* headers;
+	arena_t* arena;
+	char* out;
+	size_t outlen;
+	size_t outcap;
+	int bodyfd;
+	off_t bodyoff; // where the rest of `bodyfd` starts, for regular files
+	off_t bodyend; // where `bodyfd` ends for regular files, `BODY_PIPE` or `BODY_STREAM` otherwise
+	short bodyevents; // the poll events `bodyfd` is waited for, while `HTTP_RES_BODYWAIT` is set
+	cacheref_t cached; // the cached response this one is sent from, if any
+	const struct errdoc_t* errdoc; // the prerendered error page this one is sent from, or NULL
+	const routepolicy_t* policy; // the policy of the route, or NULL
+	int compress; // the encoding the body is to be compressed with, if the policy allows it
+	struct multipart_t* multipart; // the parts of a multipart/byteranges body, or NULL
+	compressor_t* compressor; // compresses a streamed body, or NULL
+	const bodysource_t* source; // how `bodyfd` is read and released, or NULL if it is read and closed as is
+	void* sourcedata;
+	headparser_t prelude; // parses the head `bodyfd` starts with before the response is framed, or NULL
+	headers_t* trailers; // sent after a chunked body, or as headers if the body isn't chunked, NULL if there is none
+	char chunk[24]; // the size line of the chunk in `out` or spliced after it
+	size_t chunklen;
+	size_t chunkleft; // what is left to splice of the current chunk
+	int chunkcrlf; // 1 if a spliced chunk still has to be ended
+
+	char* tail; // the last chunk and the trailers
+	size_t taillen;
+	char* head;
+	size_t headlen;
+	size_t sent;
+
+	int route; // the metrics slot of the route which handled the response
+	int series; // the metrics series of the response, or -1
+	unsigned long long started; // when the request was read, in nanoseconds
+	unsigned long long parsed; // when the request was parsed, in nanoseconds
+	unsigned long long framed; // when the response was framed, in nanoseconds, or 0
+	unsigned long long written; // the bytes written
+	logrecord_t* log; // the access log record of the response, pushed once it is destroyed, or NULL
 } res_t;
 
 /**
  * creates a HTTP response for the given file descriptor
  * @param fd, a file descriptor open for writing
+ * @param arena, where the response and its headers are allocated
+ * @returns a response object
+ */
+res_t* http_createResponse(int fd, arena_t* arena);
+
+/**
+ * creates a buffered HTTP response for the given file descriptor
+ * @param fd, a file descriptor the response will eventually be written to
+ * @param arena, where the response and its headers are allocated
  * @returns a response object
  */
-res_t* http_createResponse(int fd);
+res_t* http_createBufferedResponse(int fd, arena_t* arena);
+
+/**
+ * releases what a response owns outside of its arena
+ * @param res, or NULL
+ * @remark this doesn't close the file descriptor of the response, but closes its `bodyfd`
+ * @remark the response itself is freed with its arena
+ */
+void http_destroyResponse(res_t* res);
 
 /**
  * represents a HTTP route handler
@@ -107,38 +240,168 @@ typedef int(*routehandler_t)(req_t*, res_t*, void*);
 
 /**
  * adds a route handler to the HTTP server, giving it a user value
- * @param route, the base URI of the route
+ * @param route, the base URI of the route, which matches whole path segments and may contain `:name` parameters
  * @param handler, not NULL
  * @param udata
  * @returns 0 on success, -1 on failure
+ * @remark the handler gets the rest of the URL in `req->url`, and if it returns non-zero the next longest matching route is tried
  */
 int http_addroute(char* route, routehandler_t handler, void* udata);
 
 /**
- * encodes a URL component
+ * sets the policy of the responses to the requests matching a route
+ * @param route, the base URI of the route, as for `http_addroute`
+ * @param policy, which is copied
+ * @returns 0 on success, -1 on failure
+ * @remark the policy of the longest matching route applies, regardless of which handler handles the request
+ */
+int http_addpolicy(char* route, const routepolicy_t* policy);
+
+/**
+ * adds a route handler for a single method to the HTTP server, giving it a user value
+ * @param method
+ * @param route, the base URI of the route, as for `http_addroute`
+ * @param handler, not NULL
+ * @param udata
+ * @returns 0 on success, -1 on failure
+ * @remark on a given route, method-specific handlers take precedence over those added by `http_addroute`
+ */
+int http_addmethodroute(method_t method, char* route, routehandler_t handler, void* udata);
+
+/**
+ * gets the value of a parameter of the route handling a request
+ * @param req
+ * @param name, the name of the parameter, without its `:`
+ * @returns the raw value of the parameter, or NULL if there is none
+ */
+char* http_getParam(req_t* req, char* name);
+
+/**
+ * splits the query string of a request into fields, decoding their names and values in place
+ * @param req
+ * @returns the number of fields, or -1 on error
+ * @remark `req->query` isn't the raw query string anymore afterwards, so handlers passing it on read it before
+ * @remark the query string is parsed once, and malformed fields are left out
+ */
+int http_parseQuery(req_t* req);
+
+/**
+ * gets the value of a field of the query string of a request, parsing it if it isn't yet
+ * @param req
+ * @param name, the decoded name of the field
+ * @param len, where the length of the value is stored, or NULL
+ * @returns the decoded value of the first field with this name, or NULL if there is none
+ */
+char* http_getQuery(req_t* req, const char* name, size_t* len);
+
+/**
+ * hands a request to the first matching route handler that accepts it
+ * @param req
+ * @param res
+ * @remark the response is always ended when this returns, with a 404 if no handler accepted it
+ */
+void http_route(req_t* req, res_t* res);
+
+/**
+ * parses a request whose head is at the start of a buffer, and creates its response
+ * @param fd, the client socket
+ * @param peer, the address of the client, or NULL
+ * @param buf, modified in place
+ * @param len, the number of bytes in the buffer, which may include the start of the body
+ * @param parser, done or failed on that buffer
+ * @param arena, where the request and response are allocated, to be reset once the response is written
+ * @param keepalive, 0 if the connection must be closed after this request
+ * @returns a buffered response, whose request is in `req`, to be handled by `http_continue`, or NULL on error
+ * @remark requests which can't be parsed are answered at once
+ */
+res_t* http_begin(int fd, const struct sockaddr* peer, char* buf, size_t len, parser_t* parser, arena_t* arena, int keepalive);
+
+/**
+ * routes a request begun by `http_begin`, discards what the handler left of its body, and frames its response
+ * @param res, from `http_begin`
+ * @param parser, whose `pos` is moved past the body of the request
+ * @returns 1 once the response is framed, 0 if it has to wait for the body fd of the response, as `HTTP_RES_BODYWAIT` tells, or for the client to send more of the body of the request otherwise, -1 on error
+ * @remark it is called again once the awaited fd is readable, and only returns 0 when the response is `HTTP_RES_NONBLOCK`
+ * @remark the body of the request of a `HTTP_RES_NONBLOCK` response is read whole, with `http_spoolBody`, before it is routed
+ */
+int http_continue(res_t* res, parser_t* parser);
+
+/**
+ * routes and frames a request whose head is at the start of a buffer, with `http_begin` and `http_continue`
+ * @param fd, the client socket
+ * @param peer, the address of the client, or NULL
+ * @param buf, modified in place
+ * @param len, the number of bytes in the buffer, which may include the start of the body
+ * @param parser, done or failed on that buffer, whose `pos` is moved past the body of the request
+ * @param arena, where the request and response are allocated, to be reset once the response is written
+ * @param keepalive, 0 if the connection must be closed after this request
+ * @returns a framed buffered response, or NULL on error
+ * @remark `HTTP_RES_KEEPALIVE` is set in the state of the response if the connection may be kept open
+ * @remark whatever handlers leave of the body of the request is discarded, up to `SERVER_BODYSKIP` bytes, past which the connection is closed
+ */
+res_t* http_handle(int fd, const struct sockaddr* peer, char* buf, size_t len, parser_t* parser, arena_t* arena, int keepalive);
+
+/**
+ * logs a handled request
+ * @param req
+ * @param res
+ * @remark the record is pushed to the access log once the response is written and destroyed, with what it took
+ */
+void http_log(req_t* req, res_t* res);
+
+/**
+ * encodes a URL component, leaving only the unreserved characters of RFC 3986 as they are
  * @param str, not NULL
+ * @param arena, where the result is allocated, or NULL to `malloc` it
  * @returns the URL encoded equivalent of the input string
- * @remark it is your responsability to `free` the returned string
+ * @remark without an arena, it is your responsability to `free` the returned string
  */
-char* http_urlencode(char* str);
+char* http_urlencode(char* str, arena_t* arena);
 
 /**
  * decodes a URL component
  * @param str, a URL encoded string
- * @returns the decoded equivalent of the input string
- * @remark if the string isn't a valid URL encoded string, this function is guaranteed not to crash, but may return incoherent results or NULL
- * @remark it is your responsability to `free` the returned string
+ * @param arena, where the result is allocated, or NULL to `malloc` it
+ * @returns the decoded equivalent of the input string, or NULL if an escape is malformed
+ * @remark without an arena, it is your responsability to `free` the returned string
  */
-char* http_urldecode(char* str);
+char* http_urldecode(char* str, arena_t* arena);
+
+/**
+ * decodes a URL component in place
+ * @param str, a URL encoded string
+ * @param len, the length of the string
+ * @param form, 1 to decode `+` as a space, as in forms and query strings
+ * @returns the length of the decoded string, which is null-terminated, or -1 if an escape is malformed
+ * @remark the string may be left partly decoded on error
+ */
+ssize_t http_urldecodeInPlace(char* str, size_t len, int form);
 
 /**
  * handles a client socket
  * @param fd, a socket fd
+ * @param peer, the address of the client, or NULL
+ */
+void http_server(int fd, const struct sockaddr* peer);
+
+/**
+ * creates the cache of `http_static`, shared by the processes forked afterwards
+ * @param size, the byte budget of the cache, 0 to disable it
+ * @returns 0 on success, -1 on error
+ */
+int http_initStaticCache(size_t size);
+
+/**
+ * renders the error pages of every known error status, from `SERVER_ERR` or else `SERVER_ERRMSG`, so that errors are answered from memory
+ * @returns 0 on success, -1 on error
+ * @remark to be called before forking, so that the pages are shared, and from the directory `SERVER_ERR` is relative to
  */
-void http_server(int fd);
+int http_initErrors(void);
 
 /**
  * serves a directory statically
+ * small files are kept in a cache shared by all workers once `http_initStaticCache` was called
+ * responses carry a weak ETag and a Last-Modified derived from the metadata of the file, and conditional requests get a 304 when they match
  * @param req
  * @param res
  * @param fdp, fd to a directory, but cast as a `void*`
@@ -148,17 +411,69 @@ int http_static(req_t* req, res_t* res, void* fdp);
 
 /**
  * pumps the given fd into the response, closes the fd and ends the response
+ * regular files are sent with `sendfile` and pipes with `splice`, so their contents never go through userspace
  * @param res, not yet ended
  * @param fd, open for reading
  */
 void http_res_pipe(res_t* res, int fd);
 
+/**
+ * pumps a pipe into the response like `http_res_pipe`, after the head it starts with, which sets the status and headers of the response
+ * the head is read when the response is framed, so that event loops don't wait for it
+ * @param res, buffered and not yet ended
+ * @param fd, a pipe open for reading
+ * @param parse, which parses the head
+ * @remark the response is a 502 if the pipe ends before its head does, or if the head is longer than `SERVER_MAXHEAD`
+ */
+void http_res_pipeHead(res_t* res, int fd, headparser_t parse);
+
+/**
+ * streams a body read through a source into the response, and ends it
+ * @param res
+ * @param fd, which becomes readable when the source has data
+ * @param source, which outlives the response
+ * @param udata, given to the functions of the source
+ * @remark the source is closed once the body is sent, or if the response is destroyed before
+ */
+void http_res_stream(res_t* res, int fd, const bodysource_t* source, void* udata);
+
+/**
+ * streams a body read through a source into the response like `http_res_stream`, after the head it starts with, like `http_res_pipeHead`
+ * @param res, buffered and not yet ended
+ * @param fd, which becomes ready when the source has data, or room to send what it has to
+ * @param source, which outlives the response
+ * @param udata, given to the functions of the source
+ * @param parse, which parses the head
+ * @remark the response is a 502 if the body ends before its head does, or if the head is longer than `SERVER_MAXHEAD`
+ */
+void http_res_streamHead(res_t* res, int fd, const bodysource_t* source, void* udata, headparser_t parse);
+
+/**
+ * pumps ranges of a regular file into the response as a 206, closes the fd and ends the response
+ * a single range is sent with a Content-Range header, and several as a multipart/byteranges body whose parts have the Content-Type of the response
+ * @param res, not yet ended
+ * @param fd, a regular file open for reading
+ * @param ranges, satisfiable and in the order they are to be sent
+ * @param n, at least 1
+ */
+void http_res_pipeRanges(res_t* res, int fd, const byterange_t* ranges, int n);
+
 /**
  * ends the response
  * @param res, not yet ended
  */
 void http_res_endv(res_t* res);
 
+/**
+ * sets a trailer of a response, which is sent after its body if it is chunked, or as a header otherwise
+ * @param res, buffered
+ * @param name
+ * @param value, which is copied
+ * @returns 0 on success, -1 on error
+ * @remark bodies are only chunked when they are streamed from a pipe too long to be measured first, to HTTP/1.1 clients
+ */
+int http_res_trailer(res_t* res, char* name, char* value);
+
 /**
  * writes the given message to the response
  * @param res, not yet ended
@@ -196,10 +511,45 @@ void http_res_endl(res_t* res, char* data, size_t len);
  */
 void http_res_sendHeaders(res_t* res);
 
+/**
+ * frames an ended buffered response: sets its Content-Length and Connection headers and serializes its head
+ * @param res, buffered and ended
+ * @param keepalive, 1 if the connection is to be kept open after this response
+ * @returns 0 on success, -1 on error, with errno set to EAGAIN if the body fd of a `HTTP_RES_NONBLOCK` response has nothing to read yet, in which case it is called again once it is readable
+ * @remark a non-regular `bodyfd` is read into memory, as its length can't be known otherwise, while a regular one is measured with `fstat`
+ * @remark its producer may stay silent for `SERVER_PIPETIMEOUT` seconds at most, whether it is waited for or not
+ * @remark the body of a `HTTP_RES_HEADONLY` response is dropped once measured, and only its head is sent
+ */
+int http_res_frame(res_t* res, int keepalive);
+
+/**
+ * writes as much of a framed response as possible
+ * @param res, framed
+ * @returns 1 once the response is fully written, 0 if the socket would block, or the body fd has nothing to read if `HTTP_RES_BODYWAIT` is set, -1 on error
+ */
+int http_res_write(res_t* res);
+
+/**
+ * lists what is left to send of a framed response from memory, for callers which write it themselves
+ * @param res, framed
+ * @param iov, at least 5 long
+ * @returns the number of parts, 0 once nothing is left in memory, in which case `http_res_write` sends the rest
+ * @remark the socket is corked when a body fd follows, as `http_res_write` does
+ */
+int http_res_pending(res_t* res, struct iovec* iov);
+
+/**
+ * accounts for bytes of the parts listed by `http_res_pending` written by the caller
+ * @param res
+ * @param n
+ */
+void http_res_sent(res_t* res, size_t n);
+
 /**
  * sends the default error page for the given error
  * @param res
  * @param status, a valid HTTP status code
+ * @remark buffered responses whose headers aren't sent yet get the page prerendered by `http_initErrors`, if there is one
  */
 void http_res_error(res_t* res, int status);
 
@@ -11,6 +11,10 @@
 #include "http.h"
 #include "config.h"
 #include "cgi.h"
+#include "event.h"
+#include "uring.h"
+#include "metrics.h"
+#include "accesslog.h"
 
 int tagadatsointsoin(req_t* req, res_t* res, void* data) {
 	(void)(req);
@@ -55,8 +59,42 @@ int main(void) {
 		return 1;
 	}
 
+	if(http_initStaticCache(SERVER_CACHESIZE)) {
+		perror("http_initStaticCache()");
+		return 1;
+	}
+
+	// before the routes, which get their slots in the metrics
+	if(metrics_init()) {
+		perror("metrics_init()");
+		return 1;
+	}
+
+	// before the workers, which push to the ring buffer of the logger
+	if(accesslog_init(STDOUT_FILENO)) {
+		perror("accesslog_init()");
+		return 1;
+	}
+
+	if(http_initErrors()) {
+		perror("http_initErrors()");
+		return 1;
+	}
+
+	routepolicy_t pages={.cacheControl="no-cache"};
+	routepolicy_t assets={.cacheControl="public, max-age=86400"};
+	routepolicy_t dynamic={.compress=1};
+	http_addpolicy("/", &pages);
+	http_addpolicy("/images", &assets);
+	http_addpolicy("/cgi", &dynamic);
+	http_addpolicy("/tagadatsointsoin", &dynamic);
+
 	http_addroute("/", http_static, (void*) (intptr_t) dir);
 	http_addroute("/cgi", cgi_php, (void*) (intptr_t) cgidir);
 	http_addroute("/tagadatsointsoin", tagadatsointsoin, NULL);
-	server_accept(fd, http_server);
+	if(*SERVER_METRICS) http_addroute(SERVER_METRICS, metrics_serve, NULL);
+	if(SERVER_EVENTLOOP==2) server_supervise(fd, SERVER_WORKERS>0?SERVER_WORKERS:1, uring_loop);
+	else if(SERVER_EVENTLOOP) server_supervise(fd, SERVER_WORKERS>0?SERVER_WORKERS:1, event_loop);
+	else if(SERVER_WORKERS>0) server_prefork(fd, SERVER_WORKERS, http_server);
+	else server_accept(fd, http_server);
 }
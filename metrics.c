@@ -0,0 +1,280 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include <sys/mman.h>
+
+#include "metrics.h"
+#include "config.h"
+
+/**
+ * the latency histograms have `SUBBUCKETS` linear buckets per power of two of nanoseconds, as HDR histograms do
+ * this bounds the relative error of a recorded value to 1/`SUBBUCKETS`
+ */
+#define SUBBITS 3
+#define SUBBUCKETS (1<<SUBBITS)
+#define MAXBITS 36 // longer durations, past a minute, are recorded in the last bucket
+#define BUCKETS ((MAXBITS-SUBBITS+1)*SUBBUCKETS)
+#define MINLEBITS 10 // the smallest bound listed, about a microsecond
+
+/**
+ * represents the count of requests of a route, method and status
+ */
+typedef struct {
+	uint32_t key; // 0 while the series is unused
+	uint64_t count;
+	uint64_t bytes;
+} series_t;
+
+/**
+ * represents a latency histogram
+ */
+typedef struct {
+	uint64_t buckets[BUCKETS];
+	uint64_t count;
+	uint64_t sum; // in nanoseconds
+} histogram_t;
+
+/**
+ * represents the shared segment, updated by every process with atomics
+ */
+typedef struct {
+	int64_t connections;
+	int nroutes;
+	char routes[SERVER_METRICSROUTES][64];
+	histogram_t latency[SERVER_METRICSROUTES][METRICS_PHASES];
+	series_t series[SERVER_METRICSSERIES];
+} metrics_t;
+
+/**
+ * the shared segment, or NULL if the metrics aren't initialized
+ */
+static metrics_t* metrics;
+
+static const char* phaseNames[METRICS_PHASES]={"parse", "handler", "write"};
+
+int metrics_init(void) {
+	metrics_t* m=mmap(NULL, sizeof(metrics_t), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+	if(m==MAP_FAILED) return -1;
+	strcpy(m->routes[0], "none");
+	m->nroutes=1;
+	metrics=m;
+	return 0;
+}
+
+int metrics_route(const char* route) {
+	if(!metrics) return 0;
+	for(int i=1; i<metrics->nroutes; i++) {
+		if(!strcmp(metrics->routes[i], route)) return i;
+	}
+	if(metrics->nroutes>=SERVER_METRICSROUTES || strlen(route)>=sizeof(metrics->routes[0])) return 0;
+	strcpy(metrics->routes[metrics->nroutes], route);
+	return metrics->nroutes++;
+}
+
+unsigned long long metrics_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec*1000000000ULL+ts.tv_nsec;
+}
+
+int metrics_request(int route, int method, int status) {
+	if(!metrics) return -1;
+	uint32_t key=(uint32_t) (route+1)<<20 | (uint32_t) (method+1)<<12 | (status&0xfff);
+
+	// an open-addressed table, whose slots are claimed with a compare-and-swap and never freed
+	uint32_t h=key*2654435761u;
+	for(int i=0; i<SERVER_METRICSSERIES; i++) {
+		series_t* s=metrics->series+(h+i)%SERVER_METRICSSERIES;
+		uint32_t cur=__atomic_load_n(&s->key, __ATOMIC_ACQUIRE);
+		if(!cur) {
+			uint32_t expected=0;
+			if(__atomic_compare_exchange_n(&s->key, &expected, key, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) cur=key;
+			else cur=expected;
+		}
+		if(cur==key) {
+			__atomic_fetch_add(&s->count, 1, __ATOMIC_RELAXED);
+			return s-metrics->series;
+		}
+	}
+	return -1;
+}
+
+void metrics_bytes(int series, unsigned long long bytes) {
+	if(!metrics || series<0) return;
+	__atomic_fetch_add(&metrics->series[series].bytes, bytes, __ATOMIC_RELAXED);
+}
+
+/**
+ * returns the bucket of a duration
+ * @param ns
+ * @returns the index of the bucket
+ */
+static int bucketOf(unsigned long long ns) {
+	if(ns<2*SUBBUCKETS) return ns;
+	if(ns>=1ULL<<MAXBITS) return BUCKETS-1;
+	int msb=63-__builtin_clzll(ns);
+	return (msb-SUBBITS)*SUBBUCKETS+(ns>>(msb-SUBBITS));
+}
+
+/**
+ * returns the largest duration recorded in a bucket
+ * @param bucket
+ * @returns a duration in nanoseconds
+ */
+static unsigned long long bucketMax(int bucket) {
+	if(bucket<2*SUBBUCKETS) return bucket;
+	int shift=bucket/SUBBUCKETS-1;
+	unsigned long long sub=bucket%SUBBUCKETS+SUBBUCKETS;
+	return ((sub+1)<<shift)-1;
+}
+
+void metrics_observe(int route, int phase, unsigned long long ns) {
+	if(!metrics || route<0 || route>=SERVER_METRICSROUTES) return;
+	histogram_t* h=&metrics->latency[route][phase];
+	__atomic_fetch_add(&h->buckets[bucketOf(ns)], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, ns, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->count, 1, __ATOMIC_RELAXED);
+}
+
+void metrics_connection(int delta) {
+	if(!metrics) return;
+	__atomic_fetch_add(&metrics->connections, delta, __ATOMIC_RELAXED);
+}
+
+/**
+ * represents a growable text buffer
+ */
+typedef struct {
+	char* data;
+	size_t len;
+	size_t cap;
+	int error;
+} text_t;
+
+/**
+ * appends formatted text to a buffer
+ * @param t
+ * @param fmt
+ */
+__attribute__((format(printf, 2, 3)))
+static void put(text_t* t, const char* fmt, ...) {
+	if(t->error) return;
+	for(;;) {
+		va_list ap;
+		va_start(ap, fmt);
+		int n=vsnprintf(t->data+t->len, t->cap-t->len, fmt, ap);
+		va_end(ap);
+		if(n<0) {
+			t->error=1;
+			return;
+		}
+		if((size_t) n<t->cap-t->len) {
+			t->len+=n;
+			return;
+		}
+		size_t cap=t->cap*2>t->len+n+1?t->cap*2:t->len+n+1;
+		char* data=realloc(t->data, cap);
+		if(!data) {
+			t->error=1;
+			return;
+		}
+		t->data=data;
+		t->cap=cap;
+	}
+}
+
+/**
+ * appends a route as a label value, escaped
+ * @param t
+ * @param route
+ */
+static void putRoute(text_t* t, const char* route) {
+	char buf[2*sizeof(metrics->routes[0])];
+	size_t len=0;
+	for(; *route; route++) {
+		if(*route=='"' || *route=='\\') buf[len++]='\\';
+		buf[len++]=*route;
+	}
+	buf[len]='\0';
+	put(t, "route=\"%s\"", buf);
+}
+
+int metrics_serve(req_t* req, res_t* res, void* udata) {
+	(void) req;
+	(void) udata;
+	if(!metrics) {
+		http_res_error(res, 404);
+		return 0;
+	}
+
+	text_t t={malloc(4096), 0, 4096, 0};
+	if(!t.data) {
+		http_res_error(res, 500);
+		return 0;
+	}
+
+	put(&t, "# HELP http_connections_active Clients connected.\n# TYPE http_connections_active gauge\n");
+	put(&t, "http_connections_active %lld\n", (long long) __atomic_load_n(&metrics->connections, __ATOMIC_RELAXED));
+
+	const char* families[][2]={
+		{"requests_total", "Requests handled, by route, method and status."},
+		{"response_bytes_total", "Bytes sent in responses, by route, method and status."}
+	};
+	for(int f=0; f<2; f++) {
+		put(&t, "# HELP http_%s %s\n# TYPE http_%s counter\n", families[f][0], families[f][1], families[f][0]);
+		for(int i=0; i<SERVER_METRICSSERIES; i++) {
+			series_t* s=metrics->series+i;
+			uint32_t key=__atomic_load_n(&s->key, __ATOMIC_ACQUIRE);
+			if(!key) continue;
+			int route=(key>>20)-1;
+			int method=((key>>12)&0xff)-1;
+			put(&t, "http_%s{", families[f][0]);
+			putRoute(&t, route<metrics->nroutes?metrics->routes[route]:"none");
+			put(&t, ",method=\"%s\",status=\"%u\"} %llu\n", method<0?"UNKNOWN":http_methodName(method), key&0xfff, (unsigned long long) __atomic_load_n(f?&s->bytes:&s->count, __ATOMIC_RELAXED));
+		}
+	}
+
+	// every series lists the same bounds, the powers of two of nanoseconds, into which the finer buckets are summed, so that series can be aggregated
+	put(&t, "# HELP http_request_duration_seconds Latency of the phases of requests, by route.\n# TYPE http_request_duration_seconds histogram\n");
+	for(int r=0; r<metrics->nroutes; r++) {
+		for(int p=0; p<METRICS_PHASES; p++) {
+			histogram_t* h=&metrics->latency[r][p];
+			uint64_t count=__atomic_load_n(&h->count, __ATOMIC_RELAXED);
+			if(!count) continue;
+			uint64_t cumulative=0;
+			int b=0;
+			// the last bucket also holds the longer durations, so its bound isn't listed
+			for(int k=MINLEBITS; k<MAXBITS; k++) {
+				for(; bucketMax(b)<(1ULL<<k); b++) cumulative+=__atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+				put(&t, "http_request_duration_seconds_bucket{");
+				putRoute(&t, metrics->routes[r]);
+				put(&t, ",phase=\"%s\",le=\"%.9g\"} %llu\n", phaseNames[p], ((1ULL<<k)-1)/1e9, (unsigned long long) cumulative);
+			}
+			for(; b<BUCKETS; b++) cumulative+=__atomic_load_n(&h->buckets[b], __ATOMIC_RELAXED);
+			put(&t, "http_request_duration_seconds_bucket{");
+			putRoute(&t, metrics->routes[r]);
+			put(&t, ",phase=\"%s\",le=\"+Inf\"} %llu\n", phaseNames[p], (unsigned long long) cumulative);
+			put(&t, "http_request_duration_seconds_sum{");
+			putRoute(&t, metrics->routes[r]);
+			put(&t, ",phase=\"%s\"} %.9g\n", phaseNames[p], __atomic_load_n(&h->sum, __ATOMIC_RELAXED)/1e9);
+			put(&t, "http_request_duration_seconds_count{");
+			putRoute(&t, metrics->routes[r]);
+			put(&t, ",phase=\"%s\"} %llu\n", phaseNames[p], (unsigned long long) cumulative);
+		}
+	}
+
+	if(t.error) {
+		free(t.data);
+		http_res_error(res, 500);
+		return 0;
+	}
+	http_setHeader(res->headers, "Content-Type", "text/plain; version=0.0.4; charset=utf-8");
+	http_setHeaderId(res->headers, HDR_CACHE_CONTROL, "no-store");
+	http_res_endl(res, t.data, t.len);
+	free(t.data);
+	return 0;
+}
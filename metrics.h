@@ -0,0 +1,74 @@
+#ifndef _METRICS_H
+#define _METRICS_H
+
+#include "http.h"
+
+/**
+ * the phases of a request whose latency is measured
+ */
+#define METRICS_PARSE 0 // from the complete head to the request, with its body framing, being ready
+#define METRICS_HANDLER 1 // routing and handling, up to the framing of the response
+#define METRICS_WRITE 2 // from the framing of the response to its last byte being written
+#define METRICS_PHASES 3
+
+/**
+ * creates the shared segment the metrics are kept in, shared by the processes forked afterwards
+ * @returns 0 on success, -1 on error
+ * @remark metrics are silently dropped until this is called
+ */
+int metrics_init(void);
+
+/**
+ * gives a route a slot in the metrics, shared by routes with the same pattern
+ * @param route, the pattern of the route
+ * @returns the slot of the route, or 0, the slot of unrouted requests, if there is no room left or the metrics aren't initialized
+ * @remark routes are to be added before forking, so that every process sees their names
+ */
+int metrics_route(const char* route);
+
+/**
+ * returns the time of a monotonic clock, to measure phases
+ * @returns a time in nanoseconds
+ */
+unsigned long long metrics_now(void);
+
+/**
+ * counts a handled request
+ * @param route, the slot of the route which handled it
+ * @param method, the method of the request, or -1 if it couldn't be parsed
+ * @param status, the status of the response
+ * @returns the series of the request, for `metrics_bytes`, or -1 if the metrics are full or aren't initialized
+ */
+int metrics_request(int route, int method, int status);
+
+/**
+ * counts bytes sent for a request
+ * @param series, as returned by `metrics_request`, or -1
+ * @param bytes
+ */
+void metrics_bytes(int series, unsigned long long bytes);
+
+/**
+ * records the latency of a phase of a request
+ * @param route, the slot of the route which handled it
+ * @param phase, one of `METRICS_PARSE`, `METRICS_HANDLER` or `METRICS_WRITE`
+ * @param ns, the duration of the phase in nanoseconds
+ */
+void metrics_observe(int route, int phase, unsigned long long ns);
+
+/**
+ * counts clients connecting or disconnecting
+ * @param delta, 1 when a client connects, -1 when it leaves
+ */
+void metrics_connection(int delta);
+
+/**
+ * serves the metrics in the Prometheus text format
+ * @param req
+ * @param res
+ * @param udata, unused
+ * @returns 0
+ */
+int metrics_serve(req_t* req, res_t* res, void* udata);
+
+#endif
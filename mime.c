@@ -0,0 +1,288 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mime.h"
+#include "config.h"
+
+/**
+ * the longest extension known to the tables
+ */
+#define MAXEXT 15
+
+/**
+ * the perfect hash of an extension, from its first, second and last bytes and its length
+ * the built-in table has no collisions for this hash, which `-Woverride-init` checks at compile time
+ */
+#define EXTHASH(c0, c1, cl, len) (((c0)*2+(c1)*3+(cl)*31+(len)*3)&255)
+
+/**
+ * an entry of the built-in table, with the bytes to hash spelled out so that the index is a constant
+ */
+#define EXT(ext, c0, c1, cl, type) [EXTHASH(c0, c1, cl, sizeof(ext)-1)]={ext, type}
+
+/**
+ * the built-in extensions, indexed by their perfect hash
+ */
+static const struct {
+	const char* ext;
+	const char* type;
+} extensions[256]={
+	EXT("html", 'h', 't', 'l', "text/html"),
+	EXT("htm", 'h', 't', 'm', "text/html"),
+	EXT("css", 'c', 's', 's', "text/css"),
+	EXT("js", 'j', 's', 's', "text/javascript"),
+	EXT("mjs", 'm', 'j', 's', "text/javascript"),
+	EXT("json", 'j', 's', 'n', "application/json"),
+	EXT("map", 'm', 'a', 'p', "application/json"),
+	EXT("xml", 'x', 'm', 'l', "application/xml"),
+	EXT("rss", 'r', 's', 's', "application/rss+xml"),
+	EXT("atom", 'a', 't', 'm', "application/atom+xml"),
+	EXT("txt", 't', 'x', 't', "text/plain"),
+	EXT("csv", 'c', 's', 'v', "text/csv"),
+	EXT("md", 'm', 'd', 'd', "text/markdown"),
+	EXT("ics", 'i', 'c', 's', "text/calendar"),
+	EXT("c", 'c', 0, 'c', "text/x-c"),
+	EXT("h", 'h', 0, 'h', "text/x-c"),
+	EXT("py", 'p', 'y', 'y', "text/x-python"),
+	EXT("sh", 's', 'h', 'h', "application/x-sh"),
+	EXT("svg", 's', 'v', 'g', "image/svg+xml"),
+	EXT("png", 'p', 'n', 'g', "image/png"),
+	EXT("jpg", 'j', 'p', 'g', "image/jpeg"),
+	EXT("jpeg", 'j', 'p', 'g', "image/jpeg"),
+	EXT("gif", 'g', 'i', 'f', "image/gif"),
+	EXT("webp", 'w', 'e', 'p', "image/webp"),
+	EXT("avif", 'a', 'v', 'f', "image/avif"),
+	EXT("ico", 'i', 'c', 'o', "image/vnd.microsoft.icon"),
+	EXT("bmp", 'b', 'm', 'p', "image/bmp"),
+	EXT("tif", 't', 'i', 'f', "image/tiff"),
+	EXT("tiff", 't', 'i', 'f', "image/tiff"),
+	EXT("woff", 'w', 'o', 'f', "font/woff"),
+	EXT("woff2", 'w', 'o', '2', "font/woff2"),
+	EXT("ttf", 't', 't', 'f', "font/ttf"),
+	EXT("otf", 'o', 't', 'f', "font/otf"),
+	EXT("eot", 'e', 'o', 't', "application/vnd.ms-fontobject"),
+	EXT("pdf", 'p', 'd', 'f', "application/pdf"),
+	EXT("rtf", 'r', 't', 'f', "application/rtf"),
+	EXT("epub", 'e', 'p', 'b', "application/epub+zip"),
+	EXT("zip", 'z', 'i', 'p', "application/zip"),
+	EXT("jar", 'j', 'a', 'r', "application/java-archive"),
+	EXT("apk", 'a', 'p', 'k', "application/vnd.android.package-archive"),
+	EXT("gz", 'g', 'z', 'z', "application/gzip"),
+	EXT("tgz", 't', 'g', 'z', "application/gzip"),
+	EXT("bz2", 'b', 'z', '2', "application/x-bzip2"),
+	EXT("xz", 'x', 'z', 'z', "application/x-xz"),
+	EXT("zst", 'z', 's', 't', "application/zstd"),
+	EXT("tar", 't', 'a', 'r', "application/x-tar"),
+	EXT("7z", '7', 'z', 'z', "application/x-7z-compressed"),
+	EXT("wasm", 'w', 'a', 'm', "application/wasm"),
+	EXT("mp3", 'm', 'p', '3', "audio/mpeg"),
+	EXT("ogg", 'o', 'g', 'g', "audio/ogg"),
+	EXT("oga", 'o', 'g', 'a', "audio/ogg"),
+	EXT("opus", 'o', 'p', 's', "audio/opus"),
+	EXT("wav", 'w', 'a', 'v', "audio/wav"),
+	EXT("flac", 'f', 'l', 'c', "audio/flac"),
+	EXT("m4a", 'm', '4', 'a', "audio/mp4"),
+	EXT("aac", 'a', 'a', 'c', "audio/aac"),
+	EXT("mp4", 'm', 'p', '4', "video/mp4"),
+	EXT("m4v", 'm', '4', 'v', "video/mp4"),
+	EXT("webm", 'w', 'e', 'm', "video/webm"),
+	EXT("ogv", 'o', 'g', 'v', "video/ogg"),
+	EXT("mov", 'm', 'o', 'v', "video/quicktime"),
+	EXT("avi", 'a', 'v', 'i', "video/x-msvideo"),
+	EXT("mkv", 'm', 'k', 'v', "video/x-matroska"),
+};
+
+/**
+ * the extensions overridden at runtime
+ */
+static struct {
+	char ext[MAXEXT+1];
+	char* type;
+} overrides[SERVER_MIMEOVERRIDES];
+static int noverrides;
+
+/**
+ * the cache of the types of files, indexed by inode
+ */
+static struct {
+	dev_t dev;
+	ino_t ino;
+	struct timespec mtime;
+	unsigned generation;
+	const char* type;
+} cache[SERVER_MIMECACHE];
+
+/**
+ * bumped by every override, to invalidate the cache
+ */
+static unsigned generation=1;
+
+/**
+ * copies the extension of a file name, in lowercase
+ * @param name
+ * @param ext, at least `MAXEXT`+1 bytes long
+ * @returns the length of the extension, or 0 if there is none or it is too long
+ */
+static size_t getExt(const char* name, char* ext) {
+	const char* dot=strrchr(name, '.');
+	if(!dot || strchr(dot, '/')) return 0;
+	dot++;
+	size_t len=0;
+	for(; dot[len]; len++) {
+		if(len==MAXEXT) return 0;
+		char c=dot[len];
+		ext[len]=(c>='A' && c<='Z')?c+'a'-'A':c;
+	}
+	ext[len]=0;
+	return len;
+}
+
+const char* mime_fromExtension(const char* name) {
+	char ext[MAXEXT+1];
+	size_t len=getExt(name, ext);
+	if(!len) return NULL;
+
+	for(int i=0; i<noverrides; i++) {
+		if(!strcmp(overrides[i].ext, ext)) return overrides[i].type;
+	}
+
+	const unsigned char* e=(const unsigned char*) ext;
+	int h=EXTHASH(e[0], e[1], e[len-1], len);
+	if(extensions[h].ext && !strcmp(extensions[h].ext, ext)) return extensions[h].type;
+	return NULL;
+}
+
+/**
+ * checks if a buffer starts with a given prefix, ignoring ASCII case
+ * @param buf
+ * @param len
+ * @param prefix, in lowercase
+ * @returns 1 if it does, 0 otherwise
+ */
+static int startsWith(const char* buf, size_t len, const char* prefix) {
+	size_t plen=strlen(prefix);
+	if(len<plen) return 0;
+	for(size_t i=0; i<plen; i++) {
+		char c=buf[i];
+		if(c>='A' && c<='Z') c+='a'-'A';
+		if(c!=prefix[i]) return 0;
+	}
+	return 1;
+}
+
+const char* mime_sniff(const char* buf, size_t len) {
+	static const struct {
+		const char* magic;
+		size_t len;
+		const char* type;
+	} magics[]={
+		{"\x89PNG\r\n\x1a\n", 8, "image/png"},
+		{"\xff\xd8\xff", 3, "image/jpeg"},
+		{"GIF87a", 6, "image/gif"},
+		{"GIF89a", 6, "image/gif"},
+		{"%PDF-", 5, "application/pdf"},
+		{"\x1f\x8b", 2, "application/gzip"},
+		{"PK\x03\x04", 4, "application/zip"},
+		{"\x28\xb5\x2f\xfd", 4, "application/zstd"},
+		{"\xfd" "7zXZ\0", 6, "application/x-xz"},
+		{"BZh", 3, "application/x-bzip2"},
+		{"\0asm", 4, "application/wasm"},
+		{"wOFF", 4, "font/woff"},
+		{"wOF2", 4, "font/woff2"},
+		{"OggS", 4, "audio/ogg"},
+		{"ID3", 3, "audio/mpeg"},
+		{"fLaC", 4, "audio/flac"},
+		{"\x1a\x45\xdf\xa3", 4, "video/webm"}
+	};
+	for(size_t i=0; i<sizeof(magics)/sizeof(*magics); i++) {
+		if(len>=magics[i].len && !memcmp(buf, magics[i].magic, magics[i].len)) return magics[i].type;
+	}
+
+	// containers identified by a tag after their header
+	if(len>=12 && !memcmp(buf, "RIFF", 4)) {
+		if(!memcmp(buf+8, "WEBP", 4)) return "image/webp";
+		if(!memcmp(buf+8, "WAVE", 4)) return "audio/wav";
+		if(!memcmp(buf+8, "AVI ", 4)) return "video/x-msvideo";
+	}
+	if(len>=12 && !memcmp(buf+4, "ftyp", 4)) {
+		if(!memcmp(buf+8, "avif", 4)) return "image/avif";
+		if(!memcmp(buf+8, "qt  ", 4)) return "video/quicktime";
+		return "video/mp4";
+	}
+
+	// text formats, after an optional BOM and leading whitespace
+	const char* text=buf;
+	size_t tlen=len;
+	if(tlen>=3 && !memcmp(text, "\xef\xbb\xbf", 3)) {
+		text+=3;
+		tlen-=3;
+	}
+	while(tlen && (*text==' ' || *text=='\t' || *text=='\r' || *text=='\n')) {
+		text++;
+		tlen--;
+	}
+	if(startsWith(text, tlen, "<!doctype html") || startsWith(text, tlen, "<html") || startsWith(text, tlen, "<head")) return "text/html";
+	if(startsWith(text, tlen, "<svg")) return "image/svg+xml";
+	if(startsWith(text, tlen, "<?xml")) return memmem(text, tlen, "<svg", 4)?"image/svg+xml":"application/xml";
+
+	for(size_t i=0; i<len; i++) {
+		unsigned char c=buf[i];
+		if(c<0x20 && c!='\t' && c!='\n' && c!='\r' && c!='\f' && c!=0x1b) return SERVER_MIMEDEFAULT;
+		if(c==0x7f) return SERVER_MIMEDEFAULT;
+	}
+	return "text/plain";
+}
+
+const char* mime_type(int fd, const char* name, const struct stat* st) {
+	size_t i=(st->st_ino^(st->st_dev*0x9e3779b9u))%SERVER_MIMECACHE;
+	if(cache[i].generation==generation && cache[i].ino==st->st_ino && cache[i].dev==st->st_dev && cache[i].mtime.tv_sec==st->st_mtim.tv_sec && cache[i].mtime.tv_nsec==st->st_mtim.tv_nsec) {
+		return cache[i].type;
+	}
+
+	const char* type=mime_fromExtension(name);
+	if(!type) {
+		char buf[SERVER_MIMESNIFF];
+		ssize_t len=pread(fd, buf, sizeof(buf), 0);
+		type=len<0?SERVER_MIMEDEFAULT:mime_sniff(buf, len);
+	}
+
+	cache[i].dev=st->st_dev;
+	cache[i].ino=st->st_ino;
+	cache[i].mtime=st->st_mtim;
+	cache[i].generation=generation;
+	cache[i].type=type;
+	return type;
+}
+
+int mime_override(const char* ext, const char* type) {
+	if(!ext || !type || !*ext || strlen(ext)>MAXEXT) return -1;
+
+	char lower[MAXEXT+1];
+	size_t len=0;
+	for(; ext[len]; len++) {
+		char c=ext[len];
+		lower[len]=(c>='A' && c<='Z')?c+'a'-'A':c;
+	}
+	lower[len]=0;
+
+	char* dup=strdup(type);
+	if(!dup) return -1;
+
+	int i=0;
+	while(i<noverrides && strcmp(overrides[i].ext, lower)) i++;
+	if(i==noverrides) {
+		if(noverrides==SERVER_MIMEOVERRIDES) {
+			free(dup);
+			return -1;
+		}
+		memcpy(overrides[i].ext, lower, len+1);
+		noverrides++;
+	} else {
+		free(overrides[i].type);
+	}
+	overrides[i].type=dup;
+	generation++;
+	return 0;
+}
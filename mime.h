@@ -0,0 +1,43 @@
+#ifndef _MIME_H
+#define _MIME_H
+
+#include <stddef.h>
+
+#include <sys/stat.h>
+
+/**
+ * finds the MIME type of a file, from its extension or, if it is unknown, from its first bytes
+ * @param fd, open for reading
+ * @param name, the name or path of the file
+ * @param st, the result of `fstat` on the fd
+ * @returns the MIME type, never NULL
+ * @remark results are cached per inode and modification time, so a file is only sniffed once
+ */
+const char* mime_type(int fd, const char* name, const struct stat* st);
+
+/**
+ * finds the MIME type matching the extension of a file name
+ * @param name, the name or path of the file
+ * @returns the MIME type, or NULL if the extension is unknown
+ * @remark overrides are looked up before the built-in table
+ */
+const char* mime_fromExtension(const char* name);
+
+/**
+ * guesses the MIME type of some data from its magic bytes
+ * @param buf, the first bytes of the data
+ * @param len, the length of the buffer
+ * @returns the MIME type, never NULL
+ */
+const char* mime_sniff(const char* buf, size_t len);
+
+/**
+ * overrides the MIME type of an extension
+ * @param ext, the extension, without its dot
+ * @param type, the MIME type, which is copied
+ * @returns 0 on success, -1 on error
+ * @remark overriding an extension again replaces its type
+ */
+int mime_override(const char* ext, const char* type);
+
+#endif
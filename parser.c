@@ -0,0 +1,172 @@
+#include <string.h>
+
+#include "parser.h"
+
+/**
+ * the states of the parser
+ */
+enum {
+	STATE_REQUESTLINE, STATE_HEADERS, STATE_DONE, STATE_ERROR
+};
+
+/**
+ * the characters allowed in methods and header names (RFC 7230 `tchar`)
+ */
+static unsigned char tokenChars[256];
+
+/**
+ * fills the `tokenChars` table
+ */
+static void initTokenChars(void) {
+	if(tokenChars['A']) return;
+	for(int c='0'; c<='9'; c++) tokenChars[c]=1;
+	for(int c='a'; c<='z'; c++) tokenChars[c]=1;
+	for(int c='A'; c<='Z'; c++) tokenChars[c]=1;
+	for(const char* c="!#$%&'*+-.^_`|~"; *c; c++) tokenChars[(unsigned char) *c]=1;
+}
+
+/**
+ * checks if a part of a buffer is a non-empty token
+ * @param str
+ * @param len
+ * @returns 1 if it is a token, 0 otherwise
+ */
+static int isToken(const char* str, size_t len) {
+	if(!len) return 0;
+	for(size_t i=0; i<len; i++) {
+		if(!tokenChars[(unsigned char) str[i]]) return 0;
+	}
+	return 1;
+}
+
+/**
+ * makes the parser fail
+ * @param parser
+ * @param status, the HTTP status to reply with
+ * @returns `PARSER_ERROR`
+ */
+static int fail(parser_t* parser, int status) {
+	parser->state=STATE_ERROR;
+	parser->status=status;
+	return PARSER_ERROR;
+}
+
+/**
+ * parses the request line
+ * @param parser
+ * @param buf
+ * @param start, the offset of the line
+ * @param end, the offset of the end of the line, line terminator excluded
+ * @returns `PARSER_AGAIN` on success, `PARSER_ERROR` on error
+ */
+static int parseRequestLine(parser_t* parser, const char* buf, size_t start, size_t end) {
+	const char* line=buf+start;
+	size_t len=end-start;
+
+	const char* sp=memchr(line, ' ', len);
+	if(!sp || !isToken(line, sp-line)) return fail(parser, 400);
+	parser->method=(slice_t) {start, sp-line};
+
+	const char* url=sp+1;
+	sp=memchr(url, ' ', line+len-url);
+	if(!sp) {
+		if((size_t) (line+len-url)>parser->limits.maxUrl) return fail(parser, 414);
+		return fail(parser, 400);
+	}
+	if(sp==url) return fail(parser, 400);
+	if((size_t) (sp-url)>parser->limits.maxUrl) return fail(parser, 414);
+	parser->url=(slice_t) {url-buf, sp-url};
+
+	const char* version=sp+1;
+	size_t vlen=line+len-version;
+	if(vlen!=8 || memcmp(version, "HTTP/", 5) || version[6]!='.') return fail(parser, 400);
+	if(version[5]!='1' || version[7]<'0' || version[7]>'9') return fail(parser, 505);
+	parser->version=(slice_t) {version-buf, vlen};
+
+	return PARSER_AGAIN;
+}
+
+/**
+ * parses a header line
+ * @param parser
+ * @param buf
+ * @param start, the offset of the line
+ * @param end, the offset of the end of the line, line terminator excluded
+ * @returns `PARSER_AGAIN` on success, `PARSER_ERROR` on error
+ */
+static int parseHeaderLine(parser_t* parser, const char* buf, size_t start, size_t end) {
+	const char* line=buf+start;
+	size_t len=end-start;
+
+	// this also rejects obsolete line folding, as the name can't start with a space
+	const char* colon=memchr(line, ':', len);
+	if(!colon || !isToken(line, colon-line)) return fail(parser, 400);
+	if(parser->nheaders>=parser->limits.maxHeaders) return fail(parser, 431);
+
+	const char* value=colon+1;
+	const char* vend=line+len;
+	while(value<vend && (*value==' ' || *value=='\t')) value++;
+	while(vend>value && (vend[-1]==' ' || vend[-1]=='\t')) vend--;
+
+	hslice_t* header=parser->headers+(parser->nheaders++);
+	header->name=(slice_t) {start, colon-line};
+	header->value=(slice_t) {value-buf, vend-value};
+	return PARSER_AGAIN;
+}
+
+void parser_init(parser_t* parser, const parserlimits_t* limits) {
+	initTokenChars();
+	parser->state=STATE_REQUESTLINE;
+	parser->status=0;
+	parser->pos=0;
+	parser->scan=0;
+	parser->nheaders=0;
+	if(limits) {
+		parser->limits=*limits;
+	} else {
+		parser->limits.maxHead=SERVER_MAXHEAD;
+		parser->limits.maxUrl=SERVER_MAXURL;
+		parser->limits.maxHeaders=SERVER_MAXHEADERS;
+	}
+	if(parser->limits.maxHeaders>SERVER_MAXHEADERS) parser->limits.maxHeaders=SERVER_MAXHEADERS;
+}
+
+int parser_feed(parser_t* parser, const char* buf, size_t len) {
+	if(parser->state==STATE_DONE) return PARSER_DONE;
+	if(parser->state==STATE_ERROR) return PARSER_ERROR;
+
+	for(;;) {
+		// find the end of the current line, skipping what was already scanned
+		const char* nl=parser->scan<len?memchr(buf+parser->scan, '\n', len-parser->scan):NULL;
+		if(!nl) {
+			parser->scan=len;
+			if(len>parser->limits.maxHead) {
+				return fail(parser, parser->state==STATE_REQUESTLINE?414:431);
+			}
+			return PARSER_AGAIN;
+		}
+		size_t end=nl-buf;
+		parser->scan=end+1;
+		if(end+1>parser->limits.maxHead) {
+			return fail(parser, parser->state==STATE_REQUESTLINE?414:431);
+		}
+
+		size_t lend=end;
+		if(lend>parser->pos && buf[lend-1]=='\r') lend--;
+
+		if(parser->state==STATE_REQUESTLINE) {
+			// empty lines before the request line are ignored
+			if(lend>parser->pos) {
+				if(parseRequestLine(parser, buf, parser->pos, lend)) return PARSER_ERROR;
+				parser->state=STATE_HEADERS;
+			}
+		} else if(lend==parser->pos) {
+			parser->pos=end+1;
+			parser->state=STATE_DONE;
+			return PARSER_DONE;
+		} else {
+			if(parseHeaderLine(parser, buf, parser->pos, lend)) return PARSER_ERROR;
+		}
+		parser->pos=end+1;
+	}
+}
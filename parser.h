@@ -0,0 +1,77 @@
+#ifndef _PARSER_H
+#define _PARSER_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+
+/**
+ * represents a part of the buffer being parsed, as an offset and a length
+ */
+typedef struct {
+	uint32_t off;
+	uint32_t len;
+} slice_t;
+
+/**
+ * represents a parsed header line
+ */
+typedef struct {
+	slice_t name;
+	slice_t value;
+} hslice_t;
+
+/**
+ * represents the limits enforced by the parser
+ */
+typedef struct {
+	size_t maxHead; // bytes in the whole head
+	size_t maxUrl; // bytes in the request target
+	int maxHeaders; // header lines, at most `SERVER_MAXHEADERS`
+} parserlimits_t;
+
+/**
+ * represents the state of a resumable request head parser
+ * the parser never copies anything: it records slices of the buffer it is fed
+ */
+typedef struct {
+	int state;
+	int status; // the HTTP status to answer with when parsing fails
+	size_t pos; // start of the line being parsed, or length of the head once done
+	size_t scan; // where the search for the end of the line resumes
+	parserlimits_t limits;
+	slice_t method;
+	slice_t url;
+	slice_t version;
+	int nheaders;
+	hslice_t headers[SERVER_MAXHEADERS];
+} parser_t;
+
+/**
+ * the return values of `parser_feed`
+ */
+#define PARSER_ERROR -1
+#define PARSER_AGAIN 0
+#define PARSER_DONE 1
+
+/**
+ * initializes a parser for a new request head
+ * @param parser
+ * @param limits, or NULL to use the defaults from config.h
+ */
+void parser_init(parser_t* parser, const parserlimits_t* limits);
+
+/**
+ * feeds a parser with everything received so far
+ * @param parser
+ * @param buf, the receive buffer, which must start where the request starts and must not move until the parser is done
+ * @param len, the number of bytes in the buffer, which may only grow between calls
+ * @returns `PARSER_DONE` once the head is complete, `PARSER_AGAIN` if more bytes are needed, or `PARSER_ERROR` if the head is invalid or too large
+ * @remark bytes already consumed are never looked at again, so feeding a byte at a time stays linear
+ * @remark once done, `pos` is the length of the head, and the bytes after it belong to the body or to the next request
+ * @remark on error, `status` is set to the HTTP status to reply with
+ */
+int parser_feed(parser_t* parser, const char* buf, size_t len);
+
+#endif
@@ -0,0 +1,247 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "router.h"
+
+/**
+ * represents a node of the tree
+ * static nodes are reached through their label, parameter nodes through a whole segment
+ */
+typedef struct rnode_t rnode_t;
+typedef struct rnode_t {
+	const char* label;
+	size_t len;
+	char* paramName; // for parameter nodes
+	rnode_t** children; // static children
+	char* firsts; // the first byte of the label of each static child
+	int nchildren;
+	rnode_t* param; // parameter child
+	void* data[ROUTER_METHODS+1]; // routes ending here, by method, `ROUTER_ANY` last
+} rnode_t;
+
+typedef struct router_t {
+	rnode_t root;
+} router_t;
+
+/**
+ * represents the state of a lookup
+ */
+typedef struct {
+	const char* url;
+	int method;
+	routematch_t* matches;
+	int max;
+	int n;
+	int other;
+	int nparams;
+	const char* names[SERVER_MAXPARAMS];
+	const char* values[SERVER_MAXPARAMS];
+	size_t lens[SERVER_MAXPARAMS];
+} lookup_t;
+
+/**
+ * creates a node
+ * @param label
+ * @param len
+ * @returns the node, or NULL on error
+ */
+static rnode_t* createNode(const char* label, size_t len) {
+	rnode_t* node=calloc(1, sizeof(rnode_t));
+	if(!node) return NULL;
+	node->label=label;
+	node->len=len;
+	return node;
+}
+
+/**
+ * finds the static child of a node starting with the given byte
+ * @param node
+ * @param c
+ * @returns the index of the child, or -1
+ */
+static int findChild(rnode_t* node, char c) {
+	if(!node->nchildren) return -1;
+	const char* first=memchr(node->firsts, c, node->nchildren);
+	return first?first-node->firsts:-1;
+}
+
+/**
+ * adds a static child to a node
+ * @param node
+ * @param child
+ * @returns 0 on success, -1 on error
+ */
+static int addChild(rnode_t* node, rnode_t* child) {
+	rnode_t** children=realloc(node->children, (node->nchildren+1)*sizeof(rnode_t*));
+	if(!children) return -1;
+	node->children=children;
+	char* firsts=realloc(node->firsts, node->nchildren+1);
+	if(!firsts) return -1;
+	node->firsts=firsts;
+	children[node->nchildren]=child;
+	firsts[node->nchildren]=child->label[0];
+	node->nchildren++;
+	return 0;
+}
+
+/**
+ * finds or creates the node a pattern leads to
+ * @param node, where the pattern starts
+ * @param pat
+ * @returns the node, or NULL on error
+ */
+static rnode_t* insert(rnode_t* node, const char* pat) {
+	while(*pat) {
+		if(*pat==':') {
+			const char* name=pat+1;
+			size_t len=strcspn(name, "/");
+			if(!len) return NULL;
+			if(!node->param) {
+				node->param=createNode(NULL, 0);
+				if(!node->param) return NULL;
+				node->param->paramName=strndup(name, len);
+				if(!node->param->paramName) return NULL;
+			} else if(strlen(node->param->paramName)!=len || strncmp(node->param->paramName, name, len)) {
+				return NULL;
+			}
+			node=node->param;
+			pat=name+len;
+			continue;
+		}
+
+		size_t seglen=strcspn(pat, ":");
+		int i=findChild(node, *pat);
+		if(i<0) {
+			char* label=strndup(pat, seglen);
+			if(!label) return NULL;
+			rnode_t* child=createNode(label, seglen);
+			if(!child || addChild(node, child)) return NULL;
+			node=child;
+			pat+=seglen;
+			continue;
+		}
+
+		rnode_t* child=node->children[i];
+		size_t common=0;
+		while(common<child->len && common<seglen && child->label[common]==pat[common]) common++;
+		if(common<child->len) {
+			// split the edge where the pattern diverges
+			rnode_t* mid=createNode(child->label, common);
+			if(!mid) return NULL;
+			child->label+=common;
+			child->len-=common;
+			if(addChild(mid, child)) return NULL;
+			node->children[i]=mid;
+			child=mid;
+		}
+		node=child;
+		pat+=common;
+	}
+	return node;
+}
+
+router_t* router_create(void) {
+	return calloc(1, sizeof(router_t));
+}
+
+int router_add(router_t* router, int method, const char* route, void* data) {
+	if(!router || !route || *route!='/' || !data) return -1;
+	if(method!=ROUTER_ANY && (method<0 || method>=ROUTER_METHODS)) return -1;
+	rnode_t* node=insert(&router->root, route);
+	if(!node) return -1;
+	node->data[method==ROUTER_ANY?ROUTER_METHODS:method]=data;
+	return 0;
+}
+
+/**
+ * checks if a position of a URL is at the boundary of a path segment
+ * @param url
+ * @param pos
+ * @returns 1 if it is, 0 otherwise
+ */
+static int isBoundary(const char* url, size_t pos) {
+	char c=url[pos];
+	return !c || c=='/' || c=='?' || (pos && url[pos-1]=='/');
+}
+
+/**
+ * records a match, keeping the matches sorted from the longest to the shortest
+ * @param lookup
+ * @param data
+ * @param pos
+ */
+static void record(lookup_t* lookup, void* data, size_t pos) {
+	int i=lookup->n;
+	if(i==lookup->max) {
+		if(lookup->matches[i-1].len>=pos) return;
+		i--;
+	} else {
+		lookup->n++;
+	}
+	while(i>0 && lookup->matches[i-1].len<pos) {
+		lookup->matches[i]=lookup->matches[i-1];
+		i--;
+	}
+
+	routematch_t* match=lookup->matches+i;
+	match->data=data;
+	match->len=pos;
+	match->nparams=lookup->nparams;
+	for(int j=0; j<lookup->nparams; j++) {
+		match->params[j].name=lookup->names[j];
+		match->params[j].value=lookup->values[j];
+		match->params[j].len=lookup->lens[j];
+	}
+}
+
+/**
+ * walks the tree, recording every route matching the URL
+ * static children are tried before parameters
+ * @param lookup
+ * @param node, whose label is already matched
+ * @param pos, where the URL continues
+ */
+static void walk(lookup_t* lookup, rnode_t* node, size_t pos) {
+	const char* url=lookup->url;
+
+	if(isBoundary(url, pos)) {
+		void* data=node->data[ROUTER_METHODS];
+		if(lookup->method>=0 && lookup->method<ROUTER_METHODS && node->data[lookup->method]) data=node->data[lookup->method];
+		if(data) {
+			record(lookup, data, pos);
+		} else {
+			for(int i=0; i<ROUTER_METHODS; i++) {
+				if(node->data[i]) lookup->other=1;
+			}
+		}
+	}
+
+	char c=url[pos];
+	if(!c || c=='?') return;
+
+	int i=findChild(node, c);
+	if(i>=0) {
+		rnode_t* child=node->children[i];
+		if(!strncmp(url+pos, child->label, child->len)) walk(lookup, child, pos+child->len);
+	}
+
+	if(node->param && c!='/' && lookup->nparams<SERVER_MAXPARAMS) {
+		size_t end=pos+strcspn(url+pos, "/?");
+		int p=lookup->nparams++;
+		lookup->names[p]=node->param->paramName;
+		lookup->values[p]=url+pos;
+		lookup->lens[p]=end-pos;
+		walk(lookup, node->param, end);
+		lookup->nparams--;
+	}
+}
+
+int router_match(router_t* router, int method, const char* url, routematch_t* matches, int max, int* other) {
+	if(other) *other=0;
+	if(!router || !url || max<=0) return 0;
+
+	lookup_t lookup={.url=url, .method=method, .matches=matches, .max=max};
+	walk(&lookup, &router->root, 0);
+	if(other) *other=lookup.other && !lookup.n;
+	return lookup.n;
+}
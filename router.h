@@ -0,0 +1,70 @@
+#ifndef _ROUTER_H
+#define _ROUTER_H
+
+#include <stddef.h>
+
+#include "config.h"
+
+/**
+ * the method slot matching any method
+ */
+#define ROUTER_ANY -1
+
+/**
+ * the number of method slots of a route, `ROUTER_ANY` excluded
+ */
+#define ROUTER_METHODS 16
+
+/**
+ * represents a router, a compressed prefix tree of routes
+ */
+typedef struct router_t router_t;
+
+/**
+ * represents a route matching a URL
+ */
+typedef struct {
+	void* data;
+	size_t len; // the length of the part of the URL matched by the route
+	int nparams;
+	struct {
+		const char* name;
+		const char* value; // not terminated, points into the URL
+		size_t len;
+	} params[SERVER_MAXPARAMS];
+} routematch_t;
+
+/**
+ * creates an empty router
+ * @returns the router, or NULL on error
+ */
+router_t* router_create(void);
+
+/**
+ * adds a route to a router
+ * a route is a prefix of URLs which only matches whole path segments: `/cgi` matches `/cgi`, `/cgi/x` and `/cgi?x`, but not `/cgifoo`
+ * segments of the form `:name` match any single non-empty segment, and are given to the handler as parameters
+ * @param router
+ * @param method, a method between 0 and `ROUTER_METHODS`-1, or `ROUTER_ANY`
+ * @param route, starting with a `/`
+ * @param data, associated with the route, not NULL
+ * @returns 0 on success, -1 on error
+ * @remark a route replaces any route with the same pattern and method
+ * @remark two parameters at the same place must have the same name
+ */
+int router_add(router_t* router, int method, const char* route, void* data);
+
+/**
+ * finds the routes matching a URL
+ * @param router
+ * @param method, the method of the request
+ * @param url, the path of the request, with its query string if any
+ * @param matches, filled with the matching routes, the longest first
+ * @param max, the size of `matches`
+ * @param other, set to 1 if routes only matched for other methods, or NULL
+ * @returns the number of matching routes
+ * @remark the cost of a lookup depends on the length of the URL, not on the number of routes
+ */
+int router_match(router_t* router, int method, const char* url, routematch_t* matches, int max, int* other);
+
+#endif
@@ -8,14 +8,20 @@
 #include <string.h>
 #include <signal.h>
 #include <sys/wait.h>
+#include <time.h>
 
 #include "config.h"
 #include "server.h"
+#include "accesslog.h"
 
 static void reapChild(int sig) {
 	(void)(sig);
+	int saved=errno;
 	int status=0;
-	waitpid(-1, &status, WNOHANG);
+	pid_t pid;
+	// signals coalesce, so every child which exited is reaped, and the logger is restarted by the accept loop
+	while((pid=waitpid(-1, &status, WNOHANG))>0) accesslog_exited(pid);
+	errno=saved;
 }
 
 int server_create(void) {
@@ -38,6 +44,9 @@ int server_create(void) {
 		perror("socket()");
 		return -1;
 	}
+	// restarting the server mustn't wait for the connections of the previous one to leave TIME_WAIT
+	int one=1;
+	setsockopt(sockfd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
 	if(bind(sockfd, res->ai_addr, res->ai_addrlen)<0) {
 		freeaddrinfo(res);
 		close(sockfd);
@@ -58,7 +67,10 @@ void server_accept(int fd, sockaction_t action) {
 	sigaction(SIGCHLD, &reapAction, NULL);
 
 	for(;;) {
-		int sock=accept(fd, NULL, 0);
+		if(accesslog_restart()) perror("accesslog_restart()");
+		struct sockaddr_storage peer;
+		socklen_t peerlen=sizeof(peer);
+		int sock=accept(fd, (struct sockaddr*) &peer, &peerlen);
 		if(sock<0 && errno==EINTR) continue;
 		if(sock<0) {
 			perror("accept()");
@@ -70,7 +82,7 @@ void server_accept(int fd, sockaction_t action) {
 			close(sock);
 			return;
 		} else if(pid==0) {
-			action(sock);
+			action(sock, (struct sockaddr*) &peer);
 			close(sock);
 			exit(0);
 		} else {
@@ -78,3 +90,100 @@ void server_accept(int fd, sockaction_t action) {
 		}
 	}
 }
+
+/**
+ * the action ran by the accept loop of pre-forked workers
+ */
+static sockaction_t preforkAction;
+
+/**
+ * runs the accept loop of a pre-forked worker
+ * @param fd, a server socket fd
+ * @remark this never returns
+ */
+static void acceptLoop(int fd) {
+	for(;;) {
+		struct sockaddr_storage peer;
+		socklen_t peerlen=sizeof(peer);
+		int sock=accept(fd, (struct sockaddr*) &peer, &peerlen);
+		if(sock<0 && (errno==EINTR || errno==ECONNABORTED)) continue;
+		if(sock<0) {
+			perror("accept()");
+			exit(1);
+		}
+		preforkAction(sock, (struct sockaddr*) &peer);
+		close(sock);
+	}
+}
+
+/**
+ * forks a new worker process
+ * @param fd, a server socket fd
+ * @param loop
+ * @returns the pid of the worker, or -1 on error
+ */
+static pid_t spawnWorker(int fd, workerloop_t loop) {
+	pid_t pid=fork();
+	while(pid<0 && errno==EAGAIN) pid=fork();
+	if(pid==0) {
+		// the worker waits for its own `php-cgi` children and must survive broken clients
+		signal(SIGCHLD, SIG_DFL);
+		signal(SIGPIPE, SIG_IGN);
+		setvbuf(stdout, NULL, _IOLBF, 0);
+		loop(fd);
+		exit(0);
+	}
+	if(pid<0) perror("fork()");
+	return pid;
+}
+
+void server_supervise(int fd, int workers, workerloop_t loop) {
+	pid_t* pids=calloc(workers, sizeof(pid_t));
+	time_t* started=calloc(workers, sizeof(time_t));
+	if(!pids || !started) {
+		free(pids);
+		free(started);
+		return;
+	}
+
+	for(int i=0; i<workers; i++) {
+		pids[i]=spawnWorker(fd, loop);
+		started[i]=time(NULL);
+	}
+
+	for(;;) {
+		int status=0;
+		pid_t pid=waitpid(-1, &status, 0);
+		if(pid<0 && errno==EINTR) continue;
+		if(pid<0) {
+			perror("waitpid()");
+			break;
+		}
+
+		if(accesslog_exited(pid)) {
+			if(accesslog_restart()) perror("accesslog_restart()");
+			continue;
+		}
+		for(int i=0; i<workers; i++) {
+			if(pids[i]!=pid) continue;
+			if(WIFSIGNALED(status)) {
+				fprintf(stderr, "worker %d killed by signal %d, respawning\n", pid, WTERMSIG(status));
+			} else {
+				fprintf(stderr, "worker %d exited with status %d, respawning\n", pid, WEXITSTATUS(status));
+			}
+			// don't spin if workers die as soon as they are started
+			if(time(NULL)-started[i]<1) sleep(1);
+			pids[i]=spawnWorker(fd, loop);
+			started[i]=time(NULL);
+			break;
+		}
+	}
+
+	free(pids);
+	free(started);
+}
+
+void server_prefork(int fd, int workers, sockaction_t action) {
+	preforkAction=action;
+	server_supervise(fd, workers, acceptLoop);
+}
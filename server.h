@@ -1,6 +1,8 @@
 #ifndef __SERVER_H
 #define __SERVER_H
 
+#include <sys/socket.h>
+
 /**
  * creates a server socket, `listen()`s on it and returns it
  * @returns the fd of the server socket
@@ -9,8 +11,9 @@ int server_create(void);
 
 /**
  * represents an action to be ran when the server gets a connection
+ * it is given the client socket and the address of the client
  */
-typedef void(*sockaction_t)(int);
+typedef void(*sockaction_t)(int, const struct sockaddr*);
 
 /**
  * accepts clients from a server socket and open a new process for each of them
@@ -18,7 +21,35 @@ typedef void(*sockaction_t)(int);
  * @param action
  * @remark this blocks the main thread and only returns on error
  * @remark this also masks SIGCHLD
+ * @remark the access logger is restarted if it exits
  */
 void server_accept(int fd, sockaction_t action);
 
+/**
+ * represents the main loop of a worker process
+ * it is given the server socket and is expected to never return
+ */
+typedef void(*workerloop_t)(int);
+
+/**
+ * runs a pool of long-lived worker processes sharing a server socket
+ * @param fd, a server socket fd
+ * @param workers, the number of worker processes to keep alive, at least 1
+ * @param loop, the main loop of each worker
+ * @remark this blocks the main thread and only returns on error
+ * @remark workers that die are respawned, and so is the access logger
+ */
+void server_supervise(int fd, int workers, workerloop_t loop);
+
+/**
+ * accepts clients from a server socket in a pool of long-lived worker processes
+ * each worker runs its own accept loop on the shared socket and handles its clients one at a time
+ * @param fd, a server socket fd
+ * @param workers, the number of worker processes to keep alive, at least 1
+ * @param action
+ * @remark this blocks the main thread and only returns on error
+ * @remark workers that die are respawned, and so is the access logger
+ */
+void server_prefork(int fd, int workers, sockaction_t action);
+
 #endif
@@ -0,0 +1,509 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <stdint.h>
+#include <poll.h>
+#include <time.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+
+#include <linux/io_uring.h>
+
+#include "uring.h"
+#include "event.h"
+#include "http.h"
+#include "metrics.h"
+#include "parser.h"
+#include "arena.h"
+#include "config.h"
+
+/**
+ * the operations submitted, kept in the low bits of the user data of their entries, next to their connection
+ */
+#define OP_ACCEPT 0
+#define OP_RECV 1
+#define OP_SEND 2
+#define OP_POLL 3
+#define OP_TIMEOUT 4
+#define OP_CANCEL 5
+#define OP_MASK 7
+
+/**
+ * represents the state of a connection
+ */
+typedef enum {
+	CONN_READ, CONN_HANDLE, CONN_WRITE
+} connstate_t;
+
+typedef struct conn_t conn_t;
+
+/**
+ * represents a list of connections, least recently active first
+ */
+typedef struct {
+	conn_t* first;
+	conn_t* last;
+	time_t timeout; // seconds after which idle connections are closed
+} connlist_t;
+
+/**
+ * represents a client connection
+ * a connection has at most one operation in flight, and is freed once it has none
+ */
+typedef struct conn_t {
+	int fd;
+	connstate_t state;
+	int eof;
+	int served;
+	int inflight; // 1 while an operation of the connection is in flight
+	int bodywait; // 1 while that operation polls the body fd of the response rather than the socket
+	int closing; // 1 once the connection is closed, and is to be freed when its operation completes
+	res_t* res;
+	arena_t* arena;
+	parser_t parser;
+	time_t lastActive;
+	connlist_t* list; // the activity list the connection is in, or NULL
+	conn_t* prev;
+	conn_t* next;
+	struct sockaddr_storage peer; // the address of the client
+	struct msghdr msg; // what is being sent
+	struct iovec iov[5];
+	size_t inlen;
+	char in[SERVER_MAXHEAD+1]; // one more byte than the longest head, so that too long heads are detected by the parser
+} conn_t;
+
+/**
+ * represents the rings shared with the kernel
+ * entries are queued by moving `tail`, and only published to the kernel when they are submitted
+ */
+typedef struct {
+	int fd;
+	unsigned* sqhead;
+	unsigned* sqtail;
+	unsigned* sqarray;
+	unsigned sqmask;
+	unsigned sqentries;
+	struct io_uring_sqe* sqes;
+	unsigned tail;
+	unsigned* cqhead;
+	unsigned* cqtail;
+	unsigned cqmask;
+	struct io_uring_cqe* cqes;
+} ring_t;
+
+static ring_t ring;
+
+/**
+ * 1 while the kernel accepts multishot accepts, which came with Linux 5.19
+ */
+static int multishot=1;
+
+/**
+ * 1 while the timeout closing idle connections is in flight
+ */
+static int timerArmed;
+
+/**
+ * the connections waiting for their clients, and those waiting for the body of their response
+ */
+static connlist_t clients={NULL, NULL, SERVER_KEEPALIVE_TIMEOUT};
+static connlist_t bodies={NULL, NULL, SERVER_PIPETIMEOUT};
+
+/**
+ * returns the current time of a monotonic clock
+ * @returns a time in seconds
+ */
+static time_t now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec;
+}
+
+/**
+ * sets up the rings, with the raw syscalls
+ * @param entries, the size of the submission queue
+ * @returns 0 on success, -1 on error
+ */
+static int ringSetup(unsigned entries) {
+	// task work runs only when the loop waits, rather than interrupting handlers, where the kernel allows it
+	unsigned flags[]={IORING_SETUP_SINGLE_ISSUER|IORING_SETUP_DEFER_TASKRUN, IORING_SETUP_COOP_TASKRUN, 0};
+	struct io_uring_params p;
+	int fd=-1;
+	for(size_t i=0; i<sizeof(flags)/sizeof(*flags) && fd<0; i++) {
+		memset(&p, 0, sizeof(p));
+		p.flags=flags[i];
+		fd=syscall(__NR_io_uring_setup, entries, &p);
+		if(fd<0 && errno!=EINVAL) return -1;
+	}
+	if(fd<0) return -1;
+
+	size_t sqsize=p.sq_off.array+p.sq_entries*sizeof(unsigned);
+	size_t cqsize=p.cq_off.cqes+p.cq_entries*sizeof(struct io_uring_cqe);
+	int single=p.features&IORING_FEAT_SINGLE_MMAP;
+	if(single && cqsize>sqsize) sqsize=cqsize;
+	char* sq=mmap(NULL, sqsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+	char* cq=single?sq:mmap(NULL, cqsize, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+	struct io_uring_sqe* sqes=mmap(NULL, p.sq_entries*sizeof(struct io_uring_sqe), PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+	if(sq==MAP_FAILED || cq==MAP_FAILED || sqes==MAP_FAILED) {
+		close(fd);
+		return -1;
+	}
+
+	ring.fd=fd;
+	ring.sqhead=(unsigned*) (sq+p.sq_off.head);
+	ring.sqtail=(unsigned*) (sq+p.sq_off.tail);
+	ring.sqarray=(unsigned*) (sq+p.sq_off.array);
+	ring.sqmask=*(unsigned*) (sq+p.sq_off.ring_mask);
+	ring.sqentries=p.sq_entries;
+	ring.sqes=sqes;
+	ring.tail=*ring.sqtail;
+	ring.cqhead=(unsigned*) (cq+p.cq_off.head);
+	ring.cqtail=(unsigned*) (cq+p.cq_off.tail);
+	ring.cqmask=*(unsigned*) (cq+p.cq_off.ring_mask);
+	ring.cqes=(struct io_uring_cqe*) (cq+p.cq_off.cqes);
+	return 0;
+}
+
+/**
+ * submits the queued entries, and waits for completions
+ * @param wait, the number of completions to wait for
+ * @returns 0 on success, -1 on error
+ */
+static int ringSubmit(unsigned wait) {
+	__atomic_store_n(ring.sqtail, ring.tail, __ATOMIC_RELEASE);
+	for(;;) {
+		unsigned queued=ring.tail-__atomic_load_n(ring.sqhead, __ATOMIC_ACQUIRE);
+		if(!queued && !wait) return 0;
+		int rst=syscall(__NR_io_uring_enter, ring.fd, queued, wait, wait?IORING_ENTER_GETEVENTS:0, NULL, 0);
+		if(rst>=0) return 0;
+		if(errno==EINTR) {
+			if(wait) return 0;
+			continue;
+		}
+		// the completion queue is full, so the completions have to be reaped before submitting more
+		if(wait && (errno==EBUSY || errno==EAGAIN)) return 0;
+		return -1;
+	}
+}
+
+/**
+ * queues a new entry
+ * @param opcode, an IORING_OP_ opcode
+ * @param op, the operation it is to its connection, an OP_ constant
+ * @param conn, or NULL
+ * @param fd
+ * @returns the entry, zeroed but for its opcode, fd and user data
+ */
+static struct io_uring_sqe* ringQueue(int opcode, int op, conn_t* conn, int fd) {
+	// a full queue is flushed to make room
+	while(ring.tail-__atomic_load_n(ring.sqhead, __ATOMIC_ACQUIRE)>=ring.sqentries) {
+		if(ringSubmit(0)) {
+			perror("io_uring_enter()");
+			exit(1);
+		}
+	}
+	unsigned i=ring.tail&ring.sqmask;
+	struct io_uring_sqe* sqe=ring.sqes+i;
+	memset(sqe, 0, sizeof(*sqe));
+	sqe->opcode=opcode;
+	sqe->fd=fd;
+	sqe->user_data=(uint64_t) (uintptr_t) conn|op;
+	ring.sqarray[i]=i;
+	ring.tail++;
+	if(conn) conn->inflight=1;
+	return sqe;
+}
+
+/**
+ * queues the accept of the clients of the server socket
+ * @param fd, a server socket
+ */
+static void queueAccept(int fd) {
+	struct io_uring_sqe* sqe=ringQueue(IORING_OP_ACCEPT, OP_ACCEPT, NULL, fd);
+	sqe->accept_flags=SOCK_NONBLOCK|SOCK_CLOEXEC; // handlers and responses still do non-blocking I/O on the socket
+	if(multishot) sqe->ioprio=IORING_ACCEPT_MULTISHOT;
+}
+
+/**
+ * queues the timeout which wakes the loop up to close idle connections
+ */
+static void queueTimeout(void) {
+	static struct __kernel_timespec ts={1, 0};
+	struct io_uring_sqe* sqe=ringQueue(IORING_OP_TIMEOUT, OP_TIMEOUT, NULL, -1);
+	sqe->addr=(uint64_t) (uintptr_t) &ts;
+	sqe->len=1;
+	timerArmed=1;
+}
+
+/**
+ * removes a connection from its activity list
+ * @param conn
+ */
+static void connUnlink(conn_t* conn) {
+	connlist_t* list=conn->list;
+	if(!list) return;
+	if(conn->prev) conn->prev->next=conn->next;
+	else list->first=conn->next;
+	if(conn->next) conn->next->prev=conn->prev;
+	else list->last=conn->prev;
+	conn->prev=conn->next=NULL;
+	conn->list=NULL;
+}
+
+/**
+ * marks a connection as active, moving it to the end of the activity list of what it waits for
+ * @param conn
+ */
+static void connTouch(conn_t* conn) {
+	connlist_t* list=conn->bodywait?&bodies:&clients;
+	if(list->last!=conn) {
+		connUnlink(conn);
+		conn->prev=list->last;
+		if(list->last) list->last->next=conn;
+		else list->first=conn;
+		list->last=conn;
+		conn->list=list;
+	}
+	conn->lastActive=now();
+}
+
+/**
+ * frees a connection and everything it owns
+ * @param conn, with no operation in flight
+ */
+static void connFree(conn_t* conn) {
+	close(conn->fd);
+	http_destroyResponse(conn->res);
+	arena_destroy(conn->arena);
+	free(conn);
+	metrics_connection(-1);
+}
+
+/**
+ * closes a connection, which is freed once its operation in flight completes
+ * @param conn
+ */
+static void connClose(conn_t* conn) {
+	connUnlink(conn);
+	conn->closing=1;
+	if(!conn->inflight) {
+		connFree(conn);
+		return;
+	}
+	// completes what is in flight at once, as the ring holds the socket open, while a poll of the body fd has to be cancelled
+	if(conn->bodywait) {
+		struct io_uring_sqe* sqe=ringQueue(IORING_OP_POLL_REMOVE, OP_CANCEL, NULL, -1);
+		sqe->addr=(uint64_t) (uintptr_t) conn|OP_POLL;
+	} else {
+		shutdown(conn->fd, SHUT_RDWR);
+	}
+}
+
+/**
+ * closes the connections of a list which were idle for too long
+ * @param list
+ * @param t, the current time
+ */
+static void connExpire(connlist_t* list, time_t t) {
+	while(list->first && t-list->first->lastActive>=list->timeout) connClose(list->first);
+}
+
+/**
+ * queues a poll for the body fd of the response of a connection if it isn't ready, or for its socket otherwise
+ * @param conn, with a response
+ * @param events, what is waited for on the socket
+ */
+static void connSuspend(conn_t* conn, uint32_t events) {
+	conn->bodywait=(conn->res->state&HTTP_RES_BODYWAIT)!=0;
+	if(conn->bodywait) events=conn->res->bodyevents;
+	struct io_uring_sqe* sqe=ringQueue(IORING_OP_POLL_ADD, OP_POLL, conn, conn->bodywait?conn->res->bodyfd:conn->fd);
+#if __BYTE_ORDER__==__ORDER_BIG_ENDIAN__
+	events=events<<16|events>>16; // the kernel swaps the halves of the 32-bit mask on big-endian machines
+#endif
+	sqe->poll32_events=events;
+}
+
+/**
+ * makes as much progress as possible on a connection, until it has to wait for an operation
+ * requests are handled one at a time, in order, so pipelined requests are answered in order
+ * @param conn, with no operation in flight
+ * @returns 0 if the connection is waiting for an operation, -1 if it is to be closed
+ */
+static int connProcess(conn_t* conn) {
+	for(;;) {
+		if(conn->state==CONN_READ) {
+			if(parser_feed(&conn->parser, conn->in, conn->inlen)==PARSER_AGAIN) {
+				if(conn->eof) return -1;
+				// receive only while waiting for a request, as request bodies are read from the socket by `http_continue` once it is readable
+				struct io_uring_sqe* sqe=ringQueue(IORING_OP_RECV, OP_RECV, conn, conn->fd);
+				sqe->addr=(uint64_t) (uintptr_t) (conn->in+conn->inlen);
+				sqe->len=sizeof(conn->in)-conn->inlen;
+				return 0;
+			}
+
+			conn->res=http_begin(conn->fd, (struct sockaddr*) &conn->peer, conn->in, conn->inlen, &conn->parser, conn->arena, ++conn->served<SERVER_KEEPALIVE_MAX);
+			if(!conn->res) return -1;
+			conn->res->state|=HTTP_RES_NONBLOCK;
+			conn->state=CONN_HANDLE;
+		}
+
+		if(conn->state==CONN_HANDLE) {
+			int rst=http_continue(conn->res, &conn->parser);
+			if(rst<0) return -1;
+			if(rst==0) {
+				connSuspend(conn, POLLIN);
+				return 0;
+			}
+			conn->state=CONN_WRITE;
+		}
+
+		// what is in memory is sent by the ring, and bodies from fds with `sendfile` and `splice` once the ring says the socket is writable
+		int n=http_res_pending(conn->res, conn->iov);
+		if(n) {
+			conn->msg=(struct msghdr) {.msg_iov=conn->iov, .msg_iovlen=n};
+			struct io_uring_sqe* sqe=ringQueue(IORING_OP_SENDMSG, OP_SEND, conn, conn->fd);
+			sqe->addr=(uint64_t) (uintptr_t) &conn->msg;
+			sqe->len=1;
+			sqe->msg_flags=MSG_NOSIGNAL;
+			return 0;
+		}
+		int rst=http_res_write(conn->res);
+		if(rst<0) return -1;
+		if(rst==0) {
+			connSuspend(conn, POLLOUT);
+			return 0;
+		}
+
+		int keep=conn->res->state&HTTP_RES_KEEPALIVE;
+		http_destroyResponse(conn->res);
+		conn->res=NULL;
+		arena_reset(conn->arena);
+		if(!keep) return -1;
+
+		// keep whatever the client pipelined after this request
+		memmove(conn->in, conn->in+conn->parser.pos, conn->inlen-conn->parser.pos);
+		conn->inlen-=conn->parser.pos;
+		parser_init(&conn->parser, NULL);
+		conn->state=CONN_READ;
+	}
+}
+
+/**
+ * registers a newly accepted client, and starts reading its first request
+ * @param fd, a non-blocking client socket
+ * @returns 0 on success, -1 on error
+ */
+static int connOpen(int fd) {
+	conn_t* conn=malloc(sizeof(conn_t));
+	if(!conn) return -1;
+	conn->arena=arena_create(SERVER_ARENA);
+	if(!conn->arena) {
+		free(conn);
+		return -1;
+	}
+	conn->fd=fd;
+	memset(&conn->peer, 0, sizeof(conn->peer));
+	socklen_t peerlen=sizeof(conn->peer);
+	getpeername(fd, (struct sockaddr*) &conn->peer, &peerlen); // multishot accepts don't give the addresses of clients
+	conn->state=CONN_READ;
+	conn->eof=0;
+	conn->served=0;
+	conn->inflight=0;
+	conn->bodywait=0;
+	conn->closing=0;
+	conn->res=NULL;
+	parser_init(&conn->parser, NULL);
+	conn->list=NULL;
+	conn->prev=conn->next=NULL;
+	conn->inlen=0;
+	metrics_connection(1);
+	if(connProcess(conn)) connClose(conn);
+	else connTouch(conn);
+	return 0;
+}
+
+/**
+ * handles a completion
+ * @param fd, the server socket
+ * @param cqe
+ */
+static void complete(int fd, const struct io_uring_cqe* cqe) {
+	int op=cqe->user_data&OP_MASK;
+	conn_t* conn=(conn_t*) (uintptr_t) (cqe->user_data&~(uint64_t) OP_MASK);
+	int res=cqe->res;
+
+	if(op==OP_ACCEPT) {
+		if(res>=0 && connOpen(res)) close(res);
+		if(res==-EINVAL && multishot) {
+			multishot=0;
+		} else if(res<0 && res!=-EINTR && res!=-ECONNABORTED && res!=-EAGAIN) {
+			fprintf(stderr, "accept(): %s\n", strerror(-res));
+		}
+		if(!(cqe->flags&IORING_CQE_F_MORE)) queueAccept(fd);
+		return;
+	}
+	if(op==OP_TIMEOUT) {
+		timerArmed=0;
+		return;
+	}
+	if(op==OP_CANCEL) return;
+
+	conn->inflight=0;
+	conn->bodywait=0;
+	if(conn->closing) {
+		connFree(conn);
+		return;
+	}
+	if(res<0 && res!=-EINTR && res!=-EAGAIN) {
+		connClose(conn);
+		return;
+	}
+	if(op==OP_RECV) {
+		if(res==0) conn->eof=1;
+		if(res>0) conn->inlen+=res;
+	} else if(op==OP_SEND && res>0) {
+		http_res_sent(conn->res, res);
+	}
+	if(connProcess(conn)) connClose(conn);
+	else connTouch(conn);
+}
+
+void uring_loop(int fd) {
+	if(ringSetup(SERVER_URINGENTRIES)) {
+		perror("io_uring_setup()");
+		fprintf(stderr, "io_uring unavailable, using epoll\n");
+		event_loop(fd);
+	}
+
+	queueAccept(fd);
+	for(;;) {
+		if((clients.first || bodies.first) && !timerArmed) queueTimeout();
+
+		// everything queued since the last turn is submitted along with the wait
+		if(ringSubmit(1)) {
+			perror("io_uring_enter()");
+			exit(1);
+		}
+
+		unsigned head=*ring.cqhead;
+		unsigned tail=__atomic_load_n(ring.cqtail, __ATOMIC_ACQUIRE);
+		while(head!=tail) {
+			struct io_uring_cqe cqe=ring.cqes[head&ring.cqmask];
+			__atomic_store_n(ring.cqhead, ++head, __ATOMIC_RELEASE);
+			complete(fd, &cqe);
+		}
+
+		// close idle connections, and those whose response stays silent
+		time_t t=now();
+		connExpire(&clients, t);
+		connExpire(&bodies, t);
+	}
+}
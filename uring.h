@@ -0,0 +1,14 @@
+#ifndef _URING_H
+#define _URING_H
+
+/**
+ * runs an io_uring-based event loop serving every client of a server socket from a single thread
+ * clients are accepted by a multishot accept, and the receives, sends and waits of every connection are submitted in batches, with a single syscall per turn of the loop
+ * @param fd, a server socket fd
+ * @remark this never returns, and exits the process on fatal errors
+ * @remark it falls back to `event_loop` if the kernel doesn't allow io_uring
+ * @remark route handlers are ran synchronously, as with `event_loop`
+ */
+void uring_loop(int fd);
+
+#endif